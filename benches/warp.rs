@@ -0,0 +1,173 @@
+use criterion::{black_box, criterion_group, criterion_main, BatchSize, Criterion, Throughput};
+use rand::{rngs::OsRng, RngCore};
+
+use zcash_warp::{
+    coin::CoinDef,
+    data::fb::PacketsT,
+    network::Network,
+    utils::{
+        chain::get_activation_height,
+        data_split::{merge, split},
+    },
+    warp::{
+        hasher::{OrchardHasher, SaplingHasher},
+        sync::bench::{
+            empty_wallet, orchard_keys, sapling_keys, spam_density, store_notes, sync_blocks,
+            synchronizers, synthetic_blocks, synthetic_notes, synthetic_wallet, SPAM_DENSITIES,
+        },
+        try_orchard_decrypt, try_sapling_decrypt, Edge, Hasher, Witness,
+    },
+};
+
+// Criterion suite of the warp hot paths, on the fixtures of the
+// `bench` command: synthetic blocks of every spam density generated
+// from a fixed seed, and in-memory wallets of random accounts
+// Run with `cargo bench --features bench`
+
+const PAIRS: usize = 4096;
+
+fn bench_hasher<H: Hasher>(c: &mut Criterion, name: &str, h: H) {
+    let empty = h.empty();
+    let layer = vec![empty; 2 * PAIRS];
+    let mut g = c.benchmark_group(name);
+    g.throughput(Throughput::Elements(PAIRS as u64));
+    g.bench_function("parallel_combine", |b| {
+        b.iter(|| black_box(h.parallel_combine(0, &layer, PAIRS)))
+    });
+    let layer = vec![Some(empty); 2 * PAIRS];
+    g.bench_function("parallel_combine_opt", |b| {
+        let mut out = Vec::with_capacity(PAIRS);
+        b.iter(|| {
+            out.clear();
+            h.parallel_combine_opt(0, &layer, PAIRS, &mut out);
+            black_box(out.len())
+        })
+    });
+    g.finish();
+
+    // a full edge, every level has an ommer
+    let edge = Edge([Some(empty); 32]);
+    let auth_path = edge.to_auth_path(&h);
+    let witness = Witness {
+        value: empty,
+        position: 0,
+        ommers: edge.clone(),
+    };
+    let mut g = c.benchmark_group(format!("{name}_roots"));
+    g.bench_function("Edge::root", |b| b.iter(|| black_box(edge.root(&h))));
+    g.bench_function("Witness::root", |b| {
+        b.iter(|| black_box(witness.root(&auth_path, &h)))
+    });
+    g.finish();
+}
+
+fn hashers(c: &mut Criterion) {
+    bench_hasher(c, "sapling", SaplingHasher::default());
+    bench_hasher(c, "orchard", OrchardHasher::default());
+}
+
+fn data_split(c: &mut Criterion) {
+    let size = 64 * 1024;
+    let mut data = vec![0u8; size];
+    OsRng.fill_bytes(&mut data);
+    let threshold = (size / 256 + 10) as u32;
+    let mut g = c.benchmark_group("data_split");
+    g.throughput(Throughput::Bytes(size as u64));
+    g.bench_function("split", |b| b.iter(|| split(&data, threshold).unwrap()));
+    let packets = PacketsT {
+        packets: Some(split(&data, threshold).unwrap()),
+    };
+    g.bench_function("merge", |b| b.iter(|| merge(&packets).unwrap()));
+    g.finish();
+}
+
+fn notes(c: &mut Criterion) {
+    let count = 1000;
+    let mut notes = synthetic_notes(count);
+    let mut g = c.benchmark_group("notes");
+    g.throughput(Throughput::Elements(count as u64));
+    g.bench_function("store_received_note", |b| {
+        b.iter_batched(
+            || empty_wallet().unwrap(),
+            |mut connection| store_notes(&mut connection, &mut notes).unwrap(),
+            BatchSize::PerIteration,
+        )
+    });
+    g.finish();
+}
+
+// Trial decryption of every output of a block of the spam profile,
+// none of which is for the accounts
+fn decrypt(c: &mut Criterion) {
+    let network = Network::Main;
+    let start = get_activation_height(&network).unwrap();
+    let (txs, outputs) = spam_density("spam").unwrap();
+    let blocks = synthetic_blocks(0, start, 1, txs, outputs);
+    let block = &blocks[0];
+    let n = txs * outputs;
+    let height = block.height as u32;
+    let mut g = c.benchmark_group("decrypt");
+    g.throughput(Throughput::Elements(n as u64));
+    for accounts in [1, 100, 1000] {
+        let keys = sapling_keys(accounts);
+        g.bench_function(format!("try_sapling_decrypt/{accounts}"), |b| {
+            b.iter(|| {
+                let mut notes = vec![];
+                for (ivtx, tx) in block.vtx.iter().enumerate() {
+                    for (vout, o) in tx.outputs.iter().enumerate() {
+                        try_sapling_decrypt(
+                            &network, &keys, height, 0, ivtx as u32, vout as u32, o, &mut notes,
+                        )
+                        .unwrap();
+                    }
+                }
+                black_box(notes)
+            })
+        });
+        let keys = orchard_keys(accounts);
+        g.bench_function(format!("try_orchard_decrypt/{accounts}"), |b| {
+            b.iter(|| {
+                let mut notes = vec![];
+                for (ivtx, tx) in block.vtx.iter().enumerate() {
+                    for (vout, a) in tx.actions.iter().enumerate() {
+                        try_orchard_decrypt(
+                            &network, &keys, height, 0, ivtx as u32, vout as u32, a, &mut notes,
+                        )
+                        .unwrap();
+                    }
+                }
+                black_box(notes)
+            })
+        });
+    }
+    g.finish();
+}
+
+// Synchronizer::add (decryption and hashing, Sapling and Orchard side
+// by side) of 100 blocks of each spam density
+fn sync(c: &mut Criterion) {
+    let coin = CoinDef::from_network(0, Network::Main);
+    let start = get_activation_height(&coin.network).unwrap();
+    let mut g = c.benchmark_group("sync");
+    g.sample_size(10);
+    for accounts in [1, 100] {
+        let connection = synthetic_wallet(&coin, accounts).unwrap();
+        for (density, txs, outputs) in SPAM_DENSITIES {
+            let blocks = synthetic_blocks(0, start, 100, txs, outputs);
+            g.throughput(Throughput::Elements((blocks.len() * txs * outputs * 2) as u64));
+            g.bench_function(format!("Synchronizer::add/{density}/{accounts}"), |b| {
+                b.iter_batched(
+                    || synchronizers(&coin, &connection, start).unwrap(),
+                    |(mut sap_dec, mut orch_dec)| {
+                        sync_blocks(&coin, &mut sap_dec, &mut orch_dec, &blocks).unwrap()
+                    },
+                    BatchSize::PerIteration,
+                )
+            });
+        }
+    }
+    g.finish();
+}
+
+criterion_group!(benches, hashers, data_split, notes, decrypt, sync);
+criterion_main!(benches);
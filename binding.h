@@ -13,6 +13,8 @@ typedef char bool;
 #endif
 typedef void *DartPostCObjectFnType;
 
+typedef void (*JobCallback)(uint32_t, uint8_t, uint32_t);
+
 
 typedef struct CResult_u8 {
   uint8_t value;
@@ -185,6 +187,10 @@ struct CResult_u8 c_retrieve_tx_details(uint8_t coin);
 
 void c_setup(void);
 
+void c_free_bytes(const uint8_t *ptr);
+
+void c_free_string(char *s);
+
 struct CResult_u8 c_configure(uint8_t coin, struct CParam config);
 
 struct CResult_u32 c_get_activation_date(uint8_t coin);
@@ -201,6 +207,20 @@ struct CResult______u8 c_split(struct CParam data, uint32_t threshold);
 
 struct CResult______u8 c_merge(struct CParam parts);
 
+struct CResult_u32 c_new_split_session(struct CParam data);
+
+struct CResult______u8 c_next_split_packets(uint32_t session, uint32_t count);
+
+struct CResult_u8 c_close_split_session(uint32_t session);
+
+struct CResult_u32 c_new_merge_session(void);
+
+struct CResult_bool c_add_merge_packet(uint32_t session, struct CParam packet);
+
+struct CResult______u8 c_take_merge_result(uint32_t session);
+
+struct CResult_u8 c_close_merge_session(uint32_t session);
+
 struct CResult_u8 c_check_db_password(char *path, char *password);
 
 struct CResult_u8 c_encrypt_db(uint8_t coin, char *password, char *new_db_path);
@@ -243,10 +263,19 @@ struct CResult______u8 c_prepare_payment(uint8_t coin,
                                          struct CParam payment,
                                          char *redirect);
 
+struct CResult______u8 c_prepare_batch_payment(uint8_t coin,
+                                               uint32_t account,
+                                               struct CParam payment,
+                                               uint32_t max_recipients);
+
 struct CResult_bool c_can_sign(uint8_t coin, uint32_t account, struct CParam summary);
 
 struct CResult______u8 c_sign(uint8_t coin, struct CParam summary, uint32_t expiration_height);
 
+struct CResult______u8 c_sign_batch(uint8_t coin,
+                                    struct CParam summaries,
+                                    uint32_t expiration_height);
+
 struct CResult_____c_char c_tx_broadcast(uint8_t coin, struct CParam txbytes);
 
 struct CResult______u8 c_save_contacts(uint8_t coin,
@@ -269,6 +298,12 @@ struct CResult______u8 c_parse_payment_uri(uint8_t coin,
 
 struct CResult_u8 c_is_valid_address_or_uri(uint8_t coin, char *s);
 
+struct CResult_u32 c_get_zip_database_progress(void);
+
+// Only while c_warp_synchronize_async runs, a blocking
+// c_warp_synchronize holds the coin until it returns
+struct CResult______u8 c_get_sync_stats(uint8_t coin);
+
 struct CResult_u8 c_encrypt_zip_database_files(struct CParam zip_db_config);
 
 struct CResult_u8 c_decrypt_zip_database_files(char *file_path,
@@ -283,8 +318,38 @@ struct CResult_u8 c_mempool_set_account(uint8_t coin, uint32_t account);
 
 struct CResult_u8 c_download_warp_blocks(uint8_t coin, char *warp_url, uint32_t end, char *dest);
 
+struct CResult_u8 c_download_warp_snapshot(uint8_t coin,
+                                           char *warp_url,
+                                           uint32_t height,
+                                           char *dest);
+
+struct CResult_u32 c_load_warp_snapshot(uint8_t coin, char *file, char *public_key);
+
 struct CResult_u8 c_warp_synchronize(uint8_t coin, uint32_t end_height);
 
 struct CResult_u8 c_warp_synchronize_from_file(uint8_t coin, char *file);
 
 struct CResult_u8 c_transparent_scan(uint8_t coin, uint32_t account, uint32_t end_height);
+
+struct CResult_u8 c_job_status(uint32_t job);
+
+struct CResult_u32 c_job_progress(uint32_t job);
+
+struct CResult_u8 c_job_cancel(uint32_t job);
+
+struct CResult______u8 c_job_result(uint32_t job);
+
+uint32_t c_warp_synchronize_async(uint8_t coin, uint32_t end_height, JobCallback callback);
+
+uint32_t c_transparent_scan_async(uint8_t coin,
+                                  uint32_t account,
+                                  uint32_t end_height,
+                                  JobCallback callback);
+
+uint32_t c_retrieve_tx_details_async(uint8_t coin, JobCallback callback);
+
+uint32_t c_prepare_payment_async(uint8_t coin,
+                                 uint32_t account,
+                                 struct CParam payment,
+                                 char *redirect,
+                                 JobCallback callback);
@@ -61,7 +61,8 @@ pub fn transfer_pools<R: RngCore + CryptoRng>(
     )?;
     builder.add_account_funds(connection)?;
     builder.set_use_change(true)?;
-    let utx = builder.prepare()?;
+    let mut utx = builder.prepare()?;
+    builder.load_witnesses(connection, &mut utx)?;
     let utx = builder.finalize(utx, None)?;
     let tx = utx.build(network, connection, height + EXPIRATION_HEIGHT_DELTA, rng)?;
     Ok(tx)
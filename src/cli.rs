@@ -18,10 +18,14 @@ use crate::{
     warp::{
         mempool::MempoolMsg,
         sync::{
-            download_warp_blocks, transparent_scan, warp_synchronize, warp_synchronize_from_file,
+            download_warp_blocks,
+            snapshot::{download_warp_snapshot, load_warp_snapshot, sign_warp_snapshot},
+            transparent_scan, warp_synchronize, warp_synchronize_from_file,
         },
     },
 };
+#[cfg(feature = "bench")]
+use crate::warp::sync::bench;
 use anyhow::Result;
 use chrono::{DateTime, Utc};
 use clap::{Parser, Subcommand};
@@ -31,7 +35,7 @@ use clap_repl::{
 };
 use console::style;
 use figment::{
-    providers::{Env, Format as _, Toml},
+    providers::{Env, Format as _, Serialized, Toml},
     Figment,
 };
 use rand::rngs::OsRng;
@@ -173,6 +177,9 @@ pub enum ChainCommand {
     GetHeightFromTime { time: u32 },
     Download { filename: String },
     SyncFromFile { filename: String },
+    DownloadSnapshot { height: u32, filename: String },
+    SignSnapshot { filename: String, secret_key: String, dest: String },
+    LoadSnapshot { filename: String, public_key: Option<String> },
 }
 
 #[derive(Parser, Clone, Debug)]
@@ -268,6 +275,24 @@ pub enum QRDataCommand {
     Merge { parts: String },
 }
 
+#[cfg(feature = "bench")]
+#[derive(Parser, Clone, Debug)]
+pub struct Bench {
+    #[structopt(subcommand)]
+    command: BenchCommand,
+}
+
+#[cfg(feature = "bench")]
+#[derive(Subcommand, Clone, Debug)]
+pub enum BenchCommand {
+    Hashers { pairs: Option<usize> },
+    DataSplit { size: Option<usize> },
+    StoreNotes { count: Option<u32> },
+    /// Write a synthetic warp block file (light, medium or spam)
+    Fixture { filename: String, density: String, blocks: Option<u32> },
+    Sync { filename: String, blocks: Option<u32> },
+}
+
 /// The enum of sub-commands supported by the CLI
 #[derive(Parser, Clone, Debug)]
 pub enum Command {
@@ -280,6 +305,8 @@ pub enum Command {
     Keys(Keys),
     QRData(QRData),
     Checkpoint(Checkpoint),
+    #[cfg(feature = "bench")]
+    Bench(Bench),
     CreateDatabase,
     GenerateSeed,
     Backup {
@@ -540,6 +567,29 @@ async fn process_command(
                 ChainCommand::SyncFromFile { filename } => {
                     warp_synchronize_from_file(&zec, &filename).await?;
                 }
+                ChainCommand::DownloadSnapshot { height, filename } => {
+                    download_warp_snapshot(
+                        zec.config.warp_url.as_deref().unwrap(),
+                        height,
+                        &filename,
+                    )
+                    .await?;
+                }
+                ChainCommand::SignSnapshot {
+                    filename,
+                    secret_key,
+                    dest,
+                } => {
+                    sign_warp_snapshot(&filename, &secret_key, &dest)?;
+                }
+                ChainCommand::LoadSnapshot {
+                    filename,
+                    public_key,
+                } => {
+                    let height =
+                        load_warp_snapshot(&zec, &filename, public_key.as_deref().unwrap_or(""))?;
+                    println!("height: {height}");
+                }
             }
         }
         Command::Message(message_command) => {
@@ -679,6 +729,28 @@ async fn process_command(
                 rewind(&network, &mut connection, &mut client, height).await?;
             }
         },
+        #[cfg(feature = "bench")]
+        Command::Bench(bench_command) => match bench_command.command {
+            BenchCommand::Hashers { pairs } => {
+                bench::bench_hashers(pairs.unwrap_or(100_000));
+            }
+            BenchCommand::DataSplit { size } => {
+                bench::bench_data_split(size.unwrap_or(10_000))?;
+            }
+            BenchCommand::StoreNotes { count } => {
+                bench::bench_store_notes(count.unwrap_or(10_000))?;
+            }
+            BenchCommand::Fixture {
+                filename,
+                density,
+                blocks,
+            } => {
+                bench::write_fixture(zec, &filename, &density, blocks.unwrap_or(10_000))?;
+            }
+            BenchCommand::Sync { filename, blocks } => {
+                bench::bench_sync(zec, &filename, blocks.unwrap_or(100_000), &[1, 100, 1000])?;
+            }
+        },
         Command::GenerateSeed => {
             let seed = generate_random_mnemonic_phrase(&mut OsRng);
             println!("{seed}");
@@ -737,7 +809,15 @@ async fn process_command(
             let mut connection = zec.connection()?;
             let mut client = zec.connect_lwd()?;
             let bc_height = get_last_height(&mut client).await?;
-            transparent_scan(network, &mut connection, &mut client, account, bc_height).await?;
+            transparent_scan(
+                &zec,
+                network,
+                &mut connection,
+                &mut client,
+                account,
+                bc_height,
+            )
+            .await?;
         }
         Command::Mempool { account } => {
             if let Some(tx) = zec.mempool_tx.as_ref() {
@@ -908,7 +988,8 @@ pub fn cli_main(config: &ConfigT) -> Result<()> {
 }
 
 pub fn init_config() -> ConfigT {
-    let config: ConfigT = Figment::new()
+    // the fields missing from App.toml and the env keep their defaults
+    let config: ConfigT = Figment::from(Serialized::defaults(ConfigT::default()))
         .merge(Toml::file("App.toml"))
         .merge(Env::prefixed("ZCASH_WARP_"))
         .extract()
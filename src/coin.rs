@@ -1,7 +1,7 @@
 use anyhow::Result;
 use lazy_static::lazy_static;
 use parking_lot::Mutex;
-use r2d2::Pool;
+use r2d2::{CustomizeConnection, Pool};
 use r2d2_sqlite::SqliteConnectionManager;
 use rusqlite::OptionalExtension;
 use std::future::Future;
@@ -9,13 +9,14 @@ use std::str::FromStr;
 use std::sync::Arc;
 use std::time::Duration;
 use tokio::runtime::Runtime;
-use tokio::sync::mpsc::Sender;
+use tokio::sync::{mpsc::Sender, Semaphore};
 use tonic::transport::{Certificate, Channel, ClientTlsConfig, Endpoint};
 use tower::discover::Change;
 
 use crate::network::Network;
 
-use crate::warp::mempool::{Mempool, MempoolMsg};
+use crate::warp::mempool::{Mempool, MempoolMsg, UnconfirmedTxs};
+use crate::warp::sync::stats::SyncStats;
 use crate::{
     data::fb::ConfigT, lwd::rpc::compact_tx_streamer_client::CompactTxStreamerClient, Client,
 };
@@ -27,10 +28,15 @@ pub struct CoinDef {
     pub coin: u8,
     pub network: Network,
     pub pool: Option<Pool<SqliteConnectionManager>>,
+    pub read_pool: Option<Pool<SqliteConnectionManager>>,
     pub db_password: Option<String>,
     pub channel: Option<Channel>,
     pub config: ConfigT,
     pub mempool_tx: Option<Sender<MempoolMsg>>,
+    pub unconfirmed: Arc<Mutex<UnconfirmedTxs>>,
+    // one warp_sync at a time per database, shared by the clones
+    pub sync_lock: Arc<Semaphore>,
+    pub sync_stats: Arc<SyncStats>,
     pub runtime: TokioRuntime, // this runtime needs to live for the whole duration of the app
 }
 
@@ -48,6 +54,33 @@ impl Drop for CoinDef {
 pub struct TokioRuntime(pub Option<Arc<Runtime>>);
 
 const TIMEOUT_SEC: u64 = 5;
+const DEFAULT_DOWNLOAD_CONCURRENCY: usize = 4;
+const STATEMENT_CACHE_CAPACITY: usize = 64;
+const WRITE_POOL_SIZE: u32 = 10;
+const READ_POOL_SIZE: u32 = 8;
+
+// Runs once for every connection opened by the pools
+#[derive(Debug)]
+struct ConnectionInit {
+    password: Option<String>,
+    read_only: bool,
+}
+
+impl CustomizeConnection<rusqlite::Connection, rusqlite::Error> for ConnectionInit {
+    fn on_acquire(&self, connection: &mut rusqlite::Connection) -> Result<(), rusqlite::Error> {
+        if let Some(ref password) = self.password {
+            let _ = connection
+                .query_row(&format!("PRAGMA key = '{}'", password), [], |_| Ok(()))
+                .optional();
+        }
+        connection.busy_timeout(Duration::from_secs(60))?;
+        connection.set_prepared_statement_cache_capacity(STATEMENT_CACHE_CAPACITY);
+        if self.read_only {
+            connection.execute_batch("PRAGMA query_only = ON")?;
+        }
+        Ok(())
+    }
+}
 
 impl CoinDef {
     pub fn from_network(coin: u8, network: Network) -> Self {
@@ -55,10 +88,14 @@ impl CoinDef {
             coin,
             network,
             pool: None,
+            read_pool: None,
             db_password: None,
             channel: None,
             config: ConfigT::default(),
             mempool_tx: None,
+            unconfirmed: Arc::new(Mutex::new(UnconfirmedTxs::default())),
+            sync_lock: Arc::new(Semaphore::new(1)),
+            sync_stats: Arc::new(SyncStats::default()),
             runtime: TokioRuntime(Some(Arc::new(Runtime::new().unwrap()))),
         }
     }
@@ -91,32 +128,67 @@ impl CoinDef {
     pub fn set_path_password(&mut self, path: &str, password: &str) -> Result<()> {
         self.db_password = Some(password.to_string());
         tracing::info!("Setting pool");
-        let manager = r2d2_sqlite::SqliteConnectionManager::file(path);
-        let pool = r2d2::Pool::new(manager)?;
+        let build = |read_only: bool, size: u32, min_idle: Option<u32>| {
+            let manager = r2d2_sqlite::SqliteConnectionManager::file(path);
+            r2d2::Pool::builder()
+                .max_size(size)
+                .min_idle(min_idle)
+                .connection_customizer(Box::new(ConnectionInit {
+                    password: Some(password.to_string()),
+                    read_only,
+                }))
+                .build(manager)
+        };
+        let pool = build(false, WRITE_POOL_SIZE, None)?;
+        // Make sure the key is valid before going any further
+        {
+            let connection = pool.get()?;
+            let c = connection
+                .query_row("SELECT COUNT(*) FROM sqlite_master", [], |row| {
+                    row.get::<_, u32>(0)
+                })
+                .optional()?;
+            if c.is_none() {
+                anyhow::bail!("Could not open db (invalid password?)")
+            }
+            // readers do not block the writer and vice versa
+            let _ = connection.query_row("PRAGMA journal_mode = WAL", [], |_| Ok(()));
+        }
         self.pool = Some(pool);
+        self.sync_lock = Arc::new(Semaphore::new(1));
+        self.sync_stats = Arc::new(SyncStats::default());
+        self.read_pool = Some(build(true, READ_POOL_SIZE, Some(0))?);
         Ok(())
     }
 
+    /// Connection for writing, or reading what was just written
     pub fn connection(&self) -> Result<Connection> {
         let pool = self.pool.as_ref().expect("No db path set");
-        let connection = pool.get().unwrap();
-        if let Some(ref password) = self.db_password {
-            let _ = connection
-                .query_row(&format!("PRAGMA key = '{}'", password), [], |_| Ok(()))
-                .optional();
-        }
-        let _ = connection.busy_timeout(Duration::from_secs(60));
-        let c = connection
-            .query_row("SELECT COUNT(*) FROM sqlite_master", [], |row| {
-                row.get::<_, u32>(0)
-            })
-            .optional()?;
-        if c.is_none() {
-            anyhow::bail!("Could not open db (invalid password?)")
-        }
+        let connection = pool.get()?;
         Ok(connection)
     }
 
+    /// Connection from the read only pool. Under WAL, it does not wait for
+    /// the commits of the writer
+    pub fn read_connection(&self) -> Result<Connection> {
+        let pool = self.read_pool.as_ref().expect("No db path set");
+        let connection = pool.get()?;
+        Ok(connection)
+    }
+
+    /// Max number of concurrent requests to the lightwalletd servers
+    pub fn download_concurrency(&self) -> usize {
+        match self.config.download_concurrency {
+            0 => DEFAULT_DOWNLOAD_CONCURRENCY,
+            n => n as usize,
+        }
+    }
+
+    /// Memory budget of the sync in bytes, 0 if unlimited
+    pub fn memory_limit(&self) -> usize {
+        self.config.memory_limit as usize
+    }
+
     pub fn connect_lwd(&self) -> Result<Client> {
         let channel = self
             .channel
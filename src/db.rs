@@ -8,13 +8,20 @@ pub mod account;
 pub mod account_manager;
 pub mod chain;
 pub mod contacts;
-pub mod mempool;
 pub mod messages;
 pub mod notes;
 pub mod swap;
 pub mod tx;
 pub mod witnesses;
 
+/// Pragmas for the bulk writes of the sync commits
+pub fn tune_for_sync(connection: &Connection) -> Result<()> {
+    connection.pragma_update_and_check(None, "journal_mode", "WAL", |_| Ok(()))?;
+    connection.pragma_update(None, "synchronous", "NORMAL")?;
+    connection.pragma_update(None, "cache_size", -65536)?; // 64 MB
+    Ok(())
+}
+
 #[c_export]
 pub fn create_schema(connection: &mut Connection, _version: &str) -> Result<()> {
     connection
@@ -182,6 +189,19 @@ pub fn create_schema(connection: &mut Connection, _version: &str) -> Result<()>
         )
         .with_file_line(|| "witnesses")?;
 
+    connection
+        .execute(
+            "CREATE TABLE IF NOT EXISTS witness_deltas(
+        id_delta INTEGER PRIMARY KEY,
+        account INTEGER NOT NULL,
+        note INTEGER NOT NULL,
+        height INTEGER NOT NULL,
+        ommers BLOB NOT NULL,
+        UNIQUE (account, note, height))",
+            [],
+        )
+        .with_file_line(|| "witness_deltas")?;
+
     connection
         .execute(
             "CREATE TABLE IF NOT EXISTS utxos(
@@ -281,6 +301,18 @@ pub fn create_schema(connection: &mut Connection, _version: &str) -> Result<()>
         )
         .with_file_line(|| "blck_times")?;
 
+    connection
+        .execute(
+            "CREATE TABLE IF NOT EXISTS tree_states(
+        height INTEGER PRIMARY KEY,
+        sapling_size INTEGER NOT NULL,
+        sapling_edge BLOB NOT NULL,
+        orchard_size INTEGER NOT NULL,
+        orchard_edge BLOB NOT NULL)",
+            [],
+        )
+        .with_file_line(|| "tree_states")?;
+
     connection
         .execute(
             "CREATE TABLE IF NOT EXISTS swaps(
@@ -302,5 +334,159 @@ pub fn create_schema(connection: &mut Connection, _version: &str) -> Result<()>
         )
         .with_file_line(|| "swaps")?;
 
+    create_balances(connection)?;
+    create_height_indexes(connection)?;
+
+    Ok(())
+}
+
+// Every synced row carries the height it belongs to, so the tables
+// double as an undo journal keyed by height: with these indexes a rewind
+// of a few blocks only visits the rows of those blocks
+fn create_height_indexes(connection: &Connection) -> Result<()> {
+    for (table, column) in [
+        ("txs", "height"),
+        ("notes", "height"),
+        ("notes", "spent"),
+        ("note_spends", "height"),
+        ("witnesses", "height"),
+        ("witness_deltas", "height"),
+        ("utxos", "height"),
+        ("utxos", "spent"),
+        ("utxo_spends", "height"),
+        ("txdetails", "height"),
+        ("msgs", "height"),
+    ] {
+        connection
+            .execute(
+                &format!("CREATE INDEX IF NOT EXISTS i_{table}_{column} ON {table}({column})"),
+                [],
+            )
+            .with_file_line(|| format!("i_{table}_{column}"))?;
+    }
+    for table in ["notes", "utxos"] {
+        connection
+            .execute(
+                &format!(
+                    "CREATE INDEX IF NOT EXISTS i_{table}_expiration ON {table}(expiration)
+                    WHERE expiration IS NOT NULL"
+                ),
+                [],
+            )
+            .with_file_line(|| format!("i_{table}_expiration"))?;
+    }
+    // selection of the notes of a payment by value
+    connection
+        .execute(
+            "CREATE INDEX IF NOT EXISTS i_notes_spendable ON notes(account, orchard, value DESC)
+            WHERE spent IS NULL",
+            [],
+        )
+        .with_file_line(|| "i_notes_spendable")?;
+    Ok(())
+}
+
+// Unspent value per account, pool (0: transparent, 1: sapling, 2: orchard)
+// and bucket of BALANCE_BUCKET blocks of the height the coins were received at.
+// Maintained by triggers on notes and utxos, so every insert, spend,
+// rewind and reset updates it by the value that changed
+pub const BALANCE_BUCKET: u32 = 1000;
+
+fn create_balances(connection: &Connection) -> Result<()> {
+    connection
+        .execute(
+            "CREATE TABLE IF NOT EXISTS balances(
+        account INTEGER NOT NULL,
+        pool INTEGER NOT NULL,
+        bucket INTEGER NOT NULL,
+        value INTEGER NOT NULL,
+        PRIMARY KEY (account, pool, bucket))",
+            [],
+        )
+        .with_file_line(|| "balances")?;
+    connection
+        .execute(
+            "CREATE INDEX IF NOT EXISTS i_notes_account_height ON notes(account, height)",
+            [],
+        )
+        .with_file_line(|| "i_notes_account_height")?;
+    connection
+        .execute(
+            "CREATE INDEX IF NOT EXISTS i_utxos_account_height ON utxos(account, height)",
+            [],
+        )
+        .with_file_line(|| "i_utxos_account_height")?;
+
+    for (table, pool) in [("notes", "1 + {row}.orchard"), ("utxos", "0")] {
+        let add = |row: &str| {
+            let pool = pool.replace("{row}", row);
+            format!(
+                "INSERT INTO balances(account, pool, bucket, value)
+                SELECT {row}.account, {pool}, {row}.height / {BALANCE_BUCKET}, {row}.value
+                WHERE {row}.spent IS NULL
+                ON CONFLICT DO UPDATE SET value = value + excluded.value;"
+            )
+        };
+        let sub = |row: &str| {
+            let pool = pool.replace("{row}", row);
+            format!(
+                "UPDATE balances SET value = value - {row}.value
+                WHERE {row}.spent IS NULL AND account = {row}.account
+                AND pool = {pool} AND bucket = {row}.height / {BALANCE_BUCKET};"
+            )
+        };
+        connection
+            .execute(
+                &format!(
+                    "CREATE TRIGGER IF NOT EXISTS {table}_balances_insert
+                    AFTER INSERT ON {table} BEGIN {} END",
+                    add("NEW")
+                ),
+                [],
+            )
+            .with_file_line(|| "balances insert trigger")?;
+        connection
+            .execute(
+                &format!(
+                    "CREATE TRIGGER IF NOT EXISTS {table}_balances_delete
+                    AFTER DELETE ON {table} BEGIN {} END",
+                    sub("OLD")
+                ),
+                [],
+            )
+            .with_file_line(|| "balances delete trigger")?;
+        connection
+            .execute(
+                &format!(
+                    "CREATE TRIGGER IF NOT EXISTS {table}_balances_update
+                    AFTER UPDATE OF account, height, value, spent ON {table} BEGIN {} {} END",
+                    sub("OLD"),
+                    add("NEW")
+                ),
+                [],
+            )
+            .with_file_line(|| "balances update trigger")?;
+    }
+
+    // first run on an existing db
+    let empty = connection.query_row("SELECT NOT EXISTS (SELECT 1 FROM balances)", [], |r| {
+        r.get::<_, bool>(0)
+    })?;
+    if empty {
+        connection
+            .execute(
+                &format!(
+                    "INSERT INTO balances(account, pool, bucket, value)
+                SELECT account, pool, bucket, SUM(value) FROM
+                (SELECT account, 1 + orchard AS pool, height / {BALANCE_BUCKET} AS bucket, value
+                FROM notes WHERE spent IS NULL UNION ALL
+                SELECT account, 0, height / {BALANCE_BUCKET}, value
+                FROM utxos WHERE spent IS NULL)
+                GROUP BY account, pool, bucket"
+                ),
+                [],
+            )
+            .with_file_line(|| "balances init")?;
+    }
     Ok(())
 }
@@ -19,6 +19,7 @@ use crate::data::fb::{
     TransparentAddressT,
 };
 use crate::db::contacts::list_contacts;
+use crate::db::BALANCE_BUCKET;
 use crate::keys::{export_sk_bip38, import_sk_bip38};
 use crate::network::Network;
 use crate::types::{AccountInfo, OrchardAccountInfo, SaplingAccountInfo, TransparentAccountInfo};
@@ -28,7 +29,7 @@ use warp_macros::c_export;
 
 #[c_export]
 pub fn list_accounts(coin: &CoinDef, connection: &Connection) -> Result<AccountNameListT> {
-    let mut s = connection.prepare(
+    let mut s = connection.prepare_cached(
         "SELECT id_account, name, birth, balance, icon, hidden FROM accounts ORDER BY position",
     )?;
     let rows = s.query_map([], |r| {
@@ -65,7 +66,7 @@ pub fn list_account_transparent_addresses(
     connection: &Connection,
     account: u32,
 ) -> Result<Vec<TransparentAddressT>> {
-    let mut s = connection.prepare(
+    let mut s = connection.prepare_cached(
         "SELECT t.external, t.addr_index, t.address, SUM(u.value)
         FROM t_addresses t
         LEFT JOIN utxos u
@@ -107,7 +108,7 @@ pub struct TransparentDerPath {
 pub fn list_transparent_addresses(
     connection: &Connection,
 ) -> Result<Vec<(TransparentDerPath, String)>> {
-    let mut s = connection.prepare(
+    let mut s = connection.prepare_cached(
         "SELECT account, external, addr_index, address FROM t_addresses ORDER BY addr_index",
     )?;
     let rows = s.query_map([], |r| {
@@ -317,32 +318,9 @@ pub fn get_balance(connection: &Connection, account: u32, height: u32) -> Result
     // includes spent but not confirmed
     // for display on the balance page
     let height = if height == 0 { u32::MAX } else { height };
-    let transparent = connection
-        .query_row(
-            "SELECT SUM(value) FROM utxos
-        WHERE account = ?1 AND height <= ?2 AND spent IS NULL",
-            params![account, height],
-            |r| r.get::<_, Option<u64>>(0),
-        )?
-        .unwrap_or_default();
-    let sapling = connection
-        .query_row(
-            "SELECT SUM(value) FROM notes
-        WHERE account = ?1 AND height <= ?2 AND orchard = 0
-        AND spent IS NULL",
-            params![account, height],
-            |r| r.get::<_, Option<u64>>(0),
-        )?
-        .unwrap_or_default();
-    let orchard = connection
-        .query_row(
-            "SELECT SUM(value) FROM notes
-        WHERE account = ?1 AND height <= ?2 AND orchard = 1
-        AND spent IS NULL",
-            params![account, height],
-            |r| r.get::<_, Option<u64>>(0),
-        )?
-        .unwrap_or_default();
+    let transparent = get_pool_balance(connection, account, 0, height)?;
+    let sapling = get_pool_balance(connection, account, 1, height)?;
+    let orchard = get_pool_balance(connection, account, 2, height)?;
     let b = BalanceT {
         transparent,
         sapling,
@@ -432,7 +410,7 @@ pub fn get_spendings(
     timestamp: u32,
 ) -> Result<Vec<SpendingT>> {
     let contacts = list_contacts(network, connection)?;
-    let mut s = connection.prepare(
+    let mut s = connection.prepare_cached(
         "SELECT -SUM(value) as v, t.address FROM txs t
         WHERE account = ?1 AND timestamp >= ?2 AND value < 0
         AND t.address IS NOT NULL GROUP BY t.address ORDER BY v ASC LIMIT 5",
@@ -471,17 +449,62 @@ pub fn get_unconfirmed_spent(connection: &Connection, account: u32) -> Result<u6
     Ok(spent.unwrap_or_default())
 }
 
+/// Unspent value of a pool (0: transparent, 1: sapling, 2: orchard)
+/// received at or before height
+///
+/// Sums the balances buckets below the bucket of height and
+/// the coins of this last, partial bucket
+pub fn get_pool_balance(connection: &Connection, account: u32, pool: u8, height: u32) -> Result<u64> {
+    let bucket = height / BALANCE_BUCKET;
+    let full = connection
+        .query_row(
+            "SELECT SUM(value) FROM balances
+        WHERE account = ?1 AND pool = ?2 AND bucket < ?3",
+            params![account, pool, bucket],
+            |r| r.get::<_, Option<u64>>(0),
+        )?
+        .unwrap_or_default();
+    let partial = if pool == 0 {
+        connection.query_row(
+            "SELECT SUM(value) FROM utxos
+        WHERE account = ?1 AND height >= ?2 AND height <= ?3 AND spent IS NULL",
+            params![account, bucket * BALANCE_BUCKET, height],
+            |r| r.get::<_, Option<u64>>(0),
+        )?
+    } else {
+        connection.query_row(
+            "SELECT SUM(value) FROM notes
+        WHERE account = ?1 AND height >= ?2 AND height <= ?3 AND orchard = ?4
+        AND spent IS NULL",
+            params![account, bucket * BALANCE_BUCKET, height, pool == 2],
+            |r| r.get::<_, Option<u64>>(0),
+        )?
+    }
+    .unwrap_or_default();
+    Ok(full + partial)
+}
+
 pub fn get_unspent_before(connection: &Connection, account: u32, height: u32) -> Result<u64> {
-    let spent = connection.query_row(
+    let mut unspent = 0;
+    for pool in 0..3 {
+        unspent += get_pool_balance(connection, account, pool, height)?;
+    }
+    // minus the coins spent by txs not mined yet
+    let expiring = connection.query_row(
         "WITH n(value, account, height, spent, expiration) AS (
-	SELECT value, account, height, spent, expiration FROM notes UNION ALL
-	SELECT value, account, height, spent, expiration FROM utxos )
-    SELECT SUM(value) FROM n WHERE account = ?1 AND height <= ?2
-    AND expiration IS NULL AND spent IS NULL",
+	SELECT value, account, height, spent, expiration FROM notes WHERE expiration IS NOT NULL UNION ALL
+	SELECT value, account, height, spent, expiration FROM utxos WHERE expiration IS NOT NULL)
+    SELECT SUM(value) FROM n WHERE account = ?1 AND height <= ?2 AND spent IS NULL",
         [account, height],
         |r| r.get::<_, Option<u64>>(0),
     )?;
-    Ok(spent.unwrap_or_default())
+    // the balances are maintained by triggers, going below zero
+    // means that they fell out of step with the notes
+    let expiring = expiring.unwrap_or_default();
+    unspent.checked_sub(expiring).ok_or_else(|| {
+        tracing::error!("Balance of account {account} @{height}: {unspent} < {expiring}");
+        anyhow::anyhow!("Inconsistent balance of account {account}")
+    })
 }
 
 #[c_export]
@@ -489,7 +512,9 @@ pub fn get_spendable(connection: &Connection, account: u32, height: u32) -> Resu
     let unconfirmed = get_unconfirmed_spent(connection, account)?;
     let total = get_unspent_before(connection, account, u32::MAX)?;
     let spendable = get_unspent_before(connection, account, height)?;
-    let immature = total - spendable;
+    let immature = total
+        .checked_sub(spendable)
+        .ok_or(anyhow::anyhow!("Inconsistent balance of account {account}"))?;
     let sp = SpendableT {
         total,
         unconfirmed,
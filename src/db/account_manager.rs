@@ -573,6 +573,11 @@ pub fn delete_account(connection: &Connection, account: u32) -> Result<()> {
         params![account],
     )?;
     connection.execute("DELETE FROM witnesses WHERE account = ?1", params![account])?;
+    connection.execute(
+        "DELETE FROM witness_deltas WHERE account = ?1",
+        params![account],
+    )?;
+    connection.execute("DELETE FROM balances WHERE account = ?1", params![account])?;
     connection.execute("DELETE FROM txs WHERE account = ?1", params![account])?;
     connection.execute("DELETE FROM txdetails WHERE account = ?1", params![account])?;
     connection.execute(
@@ -3,11 +3,16 @@ use rusqlite::{params, Connection, OptionalExtension as _, Transaction};
 use zcash_protocol::consensus::{NetworkUpgrade, Parameters as _};
 
 use crate::db::notes::update_account_balances;
+use crate::db::witnesses::compact_witnesses;
+use crate::lwd::get_compact_block;
 use crate::network::Network;
 use crate::types::CheckpointHeight;
 use crate::utils::chain::reset_chain;
 use crate::utils::ContextExt;
-use crate::{data::fb::CheckpointT, warp::BlockHeader};
+use crate::{
+    data::fb::CheckpointT,
+    warp::{BlockHeader, Edge},
+};
 use crate::{Client, Hash};
 
 use warp_macros::c_export;
@@ -53,6 +58,59 @@ pub fn store_block(connection: &Transaction, bh: &BlockHeader) -> Result<()> {
     Ok(())
 }
 
+/// Save the commitment trees (size, edge) at a height, when
+/// they come from a snapshot rather than from the server
+pub fn store_tree_state(
+    connection: &Transaction,
+    height: u32,
+    sapling: &(u32, Edge),
+    orchard: &(u32, Edge),
+) -> Result<()> {
+    connection.execute(
+        "INSERT INTO tree_states
+        (height, sapling_size, sapling_edge, orchard_size, orchard_edge)
+        VALUES (?1, ?2, ?3, ?4, ?5)
+        ON CONFLICT DO UPDATE SET
+        sapling_size = excluded.sapling_size, sapling_edge = excluded.sapling_edge,
+        orchard_size = excluded.orchard_size, orchard_edge = excluded.orchard_edge",
+        params![
+            height,
+            sapling.0,
+            bincode::serialize(&sapling.1)?,
+            orchard.0,
+            bincode::serialize(&orchard.1)?,
+        ],
+    )?;
+    Ok(())
+}
+
+pub fn get_stored_tree_state(
+    connection: &Connection,
+    height: u32,
+) -> Result<Option<((u32, Edge), (u32, Edge))>> {
+    let r = connection
+        .query_row(
+            "SELECT sapling_size, sapling_edge, orchard_size, orchard_edge
+            FROM tree_states WHERE height = ?1",
+            [height],
+            |r| {
+                Ok((
+                    r.get::<_, u32>(0)?,
+                    r.get::<_, Vec<u8>>(1)?,
+                    r.get::<_, u32>(2)?,
+                    r.get::<_, Vec<u8>>(3)?,
+                ))
+            },
+        )
+        .optional()?;
+    let Some((ss, se, os, oe)) = r else {
+        return Ok(None);
+    };
+    let se = bincode::deserialize::<Edge>(&se)?;
+    let oe = bincode::deserialize::<Edge>(&oe)?;
+    Ok(Some(((ss, se), (os, oe))))
+}
+
 #[c_export]
 pub fn get_sync_height(connection: &Connection) -> Result<CheckpointT> {
     let height = connection
@@ -75,11 +133,13 @@ pub fn get_sync_height(connection: &Connection) -> Result<CheckpointT> {
 pub fn truncate_scan(connection: &Connection) -> Result<()> {
     connection.execute("DELETE FROM blcks", [])?;
     connection.execute("DELETE FROM blck_times", [])?;
+    connection.execute("DELETE FROM tree_states", [])?;
     connection.execute("DELETE FROM txs", [])?;
     connection.execute("DELETE FROM txdetails", [])?;
     connection.execute("DELETE FROM notes", [])?;
     connection.execute("DELETE FROM note_spends", [])?;
     connection.execute("DELETE FROM witnesses", [])?;
+    connection.execute("DELETE FROM witness_deltas", [])?;
     connection.execute("DELETE FROM utxos", [])?;
     connection.execute("DELETE FROM utxo_spends", [])?;
     connection.execute("DELETE FROM contacts", [])?;
@@ -107,27 +167,41 @@ pub fn reset_scan(
     db_tx.execute("DELETE FROM notes WHERE height >= ?1", [height])?;
     db_tx.execute("DELETE FROM note_spends WHERE height >= ?1", [height])?;
     db_tx.execute("DELETE FROM witnesses WHERE height >= ?1", [height])?;
+    db_tx.execute("DELETE FROM witness_deltas WHERE height >= ?1", [height])?;
     db_tx.execute("DELETE FROM utxos WHERE height >= ?1", [height])?;
     db_tx.execute("DELETE FROM utxo_spends WHERE height >= ?1", [height])?;
     db_tx.execute("DELETE FROM msgs", [])?;
     db_tx.execute("UPDATE notes SET spent = NULL WHERE spent >= ?1", [height])?;
-    db_tx.execute("UPDATE notes SET expiration = NULL", [])?;
+    db_tx.execute("UPDATE notes SET expiration = NULL WHERE expiration IS NOT NULL", [])?;
     db_tx.execute("UPDATE utxos SET spent = NULL WHERE spent >= ?1", [height])?;
-    db_tx.execute("UPDATE utxos SET expiration = NULL", [])?;
+    db_tx.execute("UPDATE utxos SET expiration = NULL WHERE expiration IS NOT NULL", [])?;
     update_account_balances(&db_tx)?;
     db_tx.commit()?;
 
     Ok(height)
 }
 
+/// Rewind to the latest checkpoint that is still on the server chain
+///
+/// After a reorg that hit blocks past the last checkpoint, nothing is
+/// deleted and the sync resumes from there. Only the orphaned blocks
+/// are downloaded again
 pub async fn rewind_checkpoint(
     network: &Network,
     connection: &mut Connection,
     client: &mut Client,
 ) -> Result<()> {
-    let checkpoint = get_sync_height(connection)?.height;
-    if checkpoint > 0 {
-        rewind(network, connection, client, checkpoint - 1).await?;
+    loop {
+        let checkpoint = get_sync_height(connection)?;
+        if checkpoint.height == 0 {
+            break;
+        }
+        let block = get_compact_block(client, checkpoint.height).await?;
+        if checkpoint.hash.as_ref() == Some(&block.hash) {
+            break;
+        }
+        tracing::info!("Checkpoint @{} is orphaned", checkpoint.height);
+        rewind(network, connection, client, checkpoint.height - 1).await?;
     }
     Ok(())
 }
@@ -155,14 +229,15 @@ pub async fn rewind(
         db_tx.execute("DELETE FROM notes WHERE height > ?1", [height])?;
         db_tx.execute("DELETE FROM note_spends WHERE height > ?1", [height])?;
         db_tx.execute("DELETE FROM witnesses WHERE height > ?1", [height])?;
+        db_tx.execute("DELETE FROM witness_deltas WHERE height > ?1", [height])?;
         db_tx.execute("DELETE FROM utxos WHERE height > ?1", [height])?;
         db_tx.execute("DELETE FROM utxo_spends WHERE height > ?1", [height])?;
         db_tx.execute("DELETE FROM txdetails WHERE height > ?1", [height])?;
         db_tx.execute("DELETE FROM msgs WHERE height > ?1", [height])?;
         db_tx.execute("UPDATE notes SET spent = NULL WHERE spent > ?1", [height])?;
-        db_tx.execute("UPDATE notes SET expiration = NULL", [])?;
+        db_tx.execute("UPDATE notes SET expiration = NULL WHERE expiration IS NOT NULL", [])?;
         db_tx.execute("UPDATE utxos SET spent = NULL WHERE spent > ?1", [height])?;
-        db_tx.execute("UPDATE utxos SET expiration = NULL", [])?;
+        db_tx.execute("UPDATE utxos SET expiration = NULL WHERE expiration IS NOT NULL", [])?;
         update_account_balances(&db_tx)?;
         db_tx.commit()?;
     } else {
@@ -194,7 +269,7 @@ pub fn delete_checkpoint(connection: &mut Connection, height: u32) -> Result<()>
     let db_tx = connection.transaction()?;
     {
         db_tx.execute("DELETE FROM blcks WHERE height = ?1", [height])?;
-        db_tx.execute("DELETE FROM witnesses WHERE height = ?1", [height])?;
+        compact_witnesses(&db_tx, height)?;
     }
     db_tx.commit()?;
     Ok(())
@@ -133,7 +133,7 @@ pub fn get_message(connection: &Connection, id: u32) -> Result<ShieldedMessageT>
 
 #[c_export]
 pub fn list_messages(connection: &Connection, account: u32) -> Result<Vec<ShieldedMessageT>> {
-    let mut s = connection.prepare(
+    let mut s = connection.prepare_cached(
         "SELECT m.id_msg, m.account, m.height, m.timestamp, m.txid, m.nout, m.incoming, m.sender, 
         m.recipient, m.subject, m.body, m.read, t.id_tx, c.name FROM msgs m 
         JOIN txs t ON m.txid = t.txid AND m.account = t.account
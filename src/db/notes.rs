@@ -1,3 +1,4 @@
+
 use crate::{
     data::fb::{IdNoteT, InputTransparentT, ShieldedNoteT},
     types::CheckpointHeight,
@@ -13,7 +14,10 @@ use rusqlite::{params, Connection, OptionalExtension, Row, Transaction};
 
 use warp_macros::c_export;
 
-use super::tx::{add_tx_value, store_tx};
+use super::{
+    tx::{add_tx_value, store_tx},
+    witnesses::{apply_witness_deltas, encode_ommers, store_witness_deltas, store_witnesses},
+};
 
 pub fn get_note_by_nf(
     connection: &Connection,
@@ -21,8 +25,10 @@ pub fn get_note_by_nf(
     nullifier: &Hash,
 ) -> Result<Option<PlainNote>> {
     let r = connection
-        .query_row(
+        .prepare_cached(
             "SELECT id_note, address, value, rcm, rho FROM notes WHERE nf = ?1 AND account = ?2",
+        )?
+        .query_row(
             params![nullifier, account],
             |r| {
                 Ok((
@@ -48,7 +54,8 @@ pub fn get_note_by_nf(
     Ok(r)
 }
 
-fn select_note(row: &Row) -> Result<ReceivedNote, rusqlite::Error> {
+// Without the witness, when it is not in the selected columns
+fn select_note_data(row: &Row) -> Result<ReceivedNote, rusqlite::Error> {
     let (
         id_note,
         account,
@@ -64,7 +71,6 @@ fn select_note(row: &Row) -> Result<ReceivedNote, rusqlite::Error> {
         txid,
         timestamp,
         tx_value,
-        witness,
     ) = (
         row.get::<_, u32>(0)?,
         row.get::<_, u32>(1)?,
@@ -80,7 +86,6 @@ fn select_note(row: &Row) -> Result<ReceivedNote, rusqlite::Error> {
         row.get::<_, Hash>(11)?,
         row.get::<_, u32>(12)?,
         row.get::<_, i64>(13)?,
-        row.get::<_, Vec<u8>>(14)?,
     );
     let note = ReceivedNote {
         is_new: false,
@@ -104,11 +109,18 @@ fn select_note(row: &Row) -> Result<ReceivedNote, rusqlite::Error> {
             ivtx: 0, // not persisted
         },
         spent,
-        witness: bincode::deserialize_from(&*witness).unwrap(),
+        witness: Witness::default(),
     };
     Ok(note)
 }
 
+fn select_note(row: &Row) -> Result<ReceivedNote, rusqlite::Error> {
+    let mut note = select_note_data(row)?;
+    let witness = row.get::<_, Vec<u8>>(14)?;
+    note.witness = bincode::deserialize_from(&*witness).unwrap();
+    Ok(note)
+}
+
 // used by synchronization
 // must returned all the nodes including the ones spent but unconfirmed
 pub fn list_all_received_notes(
@@ -117,17 +129,20 @@ pub fn list_all_received_notes(
     orchard: bool,
 ) -> Result<Vec<ReceivedNote>> {
     let height: u32 = height.into();
-    let mut s = connection.prepare(
+    let mut s = connection.prepare_cached(
         "SELECT n.id_note, n.account, n.position, n.height, n.output_index, n.address,
         n.value, n.rcm, n.nf, n.rho, n.spent, t.txid, t.timestamp, t.value, w.witness
         FROM notes n, txs t, witnesses w WHERE
         n.tx = t.id_tx AND n.account = t.account
-        AND w.account = n.account AND w.note = n.id_note AND w.height = ?1
+        AND w.account = n.account AND w.note = n.id_note
+        AND w.height = (SELECT MAX(w2.height) FROM witnesses w2
+        WHERE w2.account = n.account AND w2.note = n.id_note AND w2.height <= ?1)
         AND orchard = ?2 AND spent IS NULL
         ORDER BY n.value DESC",
     )?;
     let rows = s.query_map(params![height, orchard], select_note)?;
-    let notes = rows.collect::<Result<Vec<_>, _>>()?;
+    let mut notes = rows.collect::<Result<Vec<_>, _>>()?;
+    apply_witness_deltas(connection, height, &mut notes)?;
     Ok(notes)
 }
 
@@ -138,17 +153,46 @@ pub fn list_received_notes(
     orchard: bool,
 ) -> Result<Vec<ReceivedNote>> {
     let height: u32 = height.into();
-    let mut s = connection.prepare(
+    let mut s = connection.prepare_cached(
         "SELECT n.id_note, n.account, n.position, n.height, n.output_index, n.address,
         n.value, n.rcm, n.nf, n.rho, n.spent, t.txid, t.timestamp, t.value, w.witness
         FROM notes n, txs t, witnesses w
         WHERE n.tx = t.id_tx AND n.account = t.account
-        AND w.note = n.id_note AND w.account = n.account AND w.height = ?1
+        AND w.note = n.id_note AND w.account = n.account
+        AND w.height = (SELECT MAX(w2.height) FROM witnesses w2
+        WHERE w2.account = n.account AND w2.note = n.id_note AND w2.height <= ?1)
         AND orchard = ?2 AND spent IS NULL AND n.account = ?3 AND NOT excluded
         AND n.height <= ?1 AND n.expiration IS NULL
         ORDER BY n.value DESC",
     )?;
     let rows = s.query_map(params![height, orchard, account], select_note)?;
+    let mut notes = rows.collect::<Result<Vec<_>, _>>()?;
+    apply_witness_deltas(connection, height, &mut notes)?;
+    Ok(notes)
+}
+
+/// Same notes as `list_received_notes`, without their witnesses.
+/// Used to select the inputs of a payment, the witnesses of the selected
+/// notes are then read by `get_note_witness`
+pub fn list_spendable_notes(
+    connection: &Connection,
+    account: u32,
+    height: CheckpointHeight,
+    orchard: bool,
+) -> Result<Vec<ReceivedNote>> {
+    let height: u32 = height.into();
+    let mut s = connection.prepare_cached(
+        "SELECT n.id_note, n.account, n.position, n.height, n.output_index, n.address,
+        n.value, n.rcm, n.nf, n.rho, n.spent, t.txid, t.timestamp, t.value
+        FROM notes n, txs t
+        WHERE n.tx = t.id_tx AND n.account = t.account
+        AND orchard = ?2 AND spent IS NULL AND n.account = ?3 AND NOT excluded
+        AND n.height <= ?1 AND n.expiration IS NULL
+        AND EXISTS (SELECT 1 FROM witnesses w
+        WHERE w.account = n.account AND w.note = n.id_note AND w.height <= ?1)
+        ORDER BY n.value DESC",
+    )?;
+    let rows = s.query_map(params![height, orchard, account], select_note_data)?;
     let notes = rows.collect::<Result<Vec<_>, _>>()?;
     Ok(notes)
 }
@@ -231,6 +275,19 @@ pub fn mark_notes_unconfirmed_spent(
     Ok(())
 }
 
+/// Whether some notes of the pool are spent by txs that are not mined yet
+pub fn has_pending_spends(connection: &Connection, orchard: bool) -> Result<bool> {
+    let pending = connection
+        .query_row(
+            "SELECT 1 FROM notes WHERE orchard = ?1
+            AND expiration IS NOT NULL AND spent IS NULL LIMIT 1",
+            [orchard],
+            |_| Ok(()),
+        )
+        .optional()?;
+    Ok(pending.is_some())
+}
+
 pub fn recover_expired_spends(connection: &Connection, height: u32) -> Result<()> {
     connection.execute(
         "UPDATE notes SET expiration = NULL WHERE expiration < ?1",
@@ -248,19 +305,30 @@ pub fn recover_expired_spends(connection: &Connection, height: u32) -> Result<()
     Ok(())
 }
 
+/// Store the new notes and the witnesses of all the notes at height
+///
+/// `stored` has, for each note, the mask of the ommers saved
+/// by the previous checkpoints or None if its witness was never saved
+///
+/// The ids of the new notes are written back into `notes`, the
+/// notes that are not new must already have theirs
 pub fn store_received_note(
     connection: &Transaction,
     height: u32,
-    notes: &[ReceivedNote],
+    notes: &mut [ReceivedNote],
+    stored: &[Option<u32>],
 ) -> Result<()> {
     let mut s_note = connection.prepare_cached(
         "INSERT INTO notes
     (account, position, height, tx, output_index, address, value, rcm, nf, rho, spent, orchard, excluded)
-    VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12, FALSE)",
+    VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12, FALSE)
+    RETURNING id_note",
     )?;
-    for n in notes {
+    let mut witnesses = vec![];
+    let mut deltas = vec![];
+    for (n, stored) in notes.iter_mut().zip(stored.iter()) {
         let orchard = n.rho.is_some();
-        if n.is_new {
+        let id_note = if n.is_new {
             let id_tx = store_tx(connection, &n.tx)?;
             add_tx_value(
                 connection,
@@ -273,43 +341,34 @@ pub fn store_received_note(
                     value: n.tx.value,
                 },
             )?;
-            s_note.execute(params![
-                n.account, n.position, n.height, id_tx, n.vout, n.address, n.value, n.rcm, n.nf,
-                n.rho, n.spent, orchard,
-            ])?;
+            s_note.query_row(
+                params![
+                    n.account, n.position, n.height, id_tx, n.vout, n.address, n.value, n.rcm,
+                    n.nf, n.rho, n.spent, orchard,
+                ],
+                |r| r.get::<_, u32>(0),
+            )?
+        } else if n.id != 0 {
+            n.id
+        } else {
+            anyhow::bail!("Unknown note @{}", n.position);
+        };
+        n.id = id_note;
+        match stored {
+            None => witnesses.push((n.account, id_note, bincode::serialize(&n.witness)?)),
+            Some(mask) => {
+                if let Some(delta) = encode_ommers(&n.witness.ommers, *mask) {
+                    deltas.push((n.account, id_note, delta));
+                }
+            }
         }
-        let id_note = connection.query_row(
-            "SELECT id_note FROM notes
-            WHERE account = ?1 AND position = ?2 AND orchard = ?3",
-            params![n.account, n.position, orchard],
-            |r| r.get::<_, u32>(0),
-        )?;
-        store_witness(connection, n.account, id_note, height, &n.witness)?;
     }
+    store_witnesses(connection, height, &witnesses)?;
+    store_witness_deltas(connection, height, &deltas)?;
 
     Ok(())
 }
 
-pub fn store_witness(
-    connection: &Transaction,
-    account: u32,
-    id_note: u32,
-    height: u32,
-    witness: &Witness,
-) -> Result<()> {
-    let mut s = connection.prepare_cached(
-        "INSERT INTO witnesses
-        (account, note, height, witness) VALUES (?1, ?2, ?3, ?4)",
-    )?;
-    s.execute(params![
-        account,
-        id_note,
-        height,
-        bincode::serialize(witness).unwrap()
-    ])?;
-    Ok(())
-}
-
 fn select_utxo(r: &Row) -> Result<UTXO, rusqlite::Error> {
     let (id_utxo, account, external, addr_index, height, timestamp, txid, vout, address, value) = (
         r.get(0)?,
@@ -343,7 +402,7 @@ fn select_utxo(r: &Row) -> Result<UTXO, rusqlite::Error> {
 // include unconfirmed spent
 pub fn list_all_utxos(connection: &Connection) -> Result<Vec<UTXO>> {
     // include the unconfirmed spents
-    let mut s = connection.prepare(
+    let mut s = connection.prepare_cached(
         "SELECT u.id_utxo, u.account, u.external, u.addr_index, u.height, u.timestamp, u.txid, u.vout, s.address,
         u.value FROM utxos u
         JOIN t_accounts t ON u.account = t.account
@@ -361,7 +420,7 @@ pub fn list_all_utxos(connection: &Connection) -> Result<Vec<UTXO>> {
 
 // List the unconfirmed and spent tx outputs
 pub fn list_pending_stxos(connection: &Connection, account: u32) -> Result<Vec<STXO>> {
-    let mut s = connection.prepare(
+    let mut s = connection.prepare_cached(
         &("SELECT u.txid, u.vout, u.value, s.address FROM utxos u
         JOIN t_accounts t ON u.account = t.account
         JOIN t_addresses s ON t.account = s.account
@@ -396,7 +455,7 @@ pub fn list_utxos(
 ) -> Result<Vec<UTXO>> {
     let height: u32 = height.into();
     // exclude unconfirmed spents
-    let mut s = connection.prepare(
+    let mut s = connection.prepare_cached(
         &("SELECT u.id_utxo, u.account, u.external, u.addr_index, u.height, u.external, u.txid, u.vout, s.address,
         u.value FROM utxos u
         JOIN t_accounts t ON u.account = t.account
@@ -458,16 +517,12 @@ pub fn update_tx_timestamp<'a, I: IntoIterator<Item = &'a Option<BlockHeader>>>(
     Ok(())
 }
 
+// the balances table is kept up to date by triggers
+// so this only adds up a few buckets per account
 pub fn update_account_balances(connection: &Transaction) -> Result<()> {
     connection.execute(
-        "UPDATE accounts SET balance = balances.balance FROM
-        (WITH 
-            coins AS (SELECT account, value, spent FROM notes UNION ALL
-                SELECT account, value, spent FROM utxos),
-            unspent AS (SELECT account, SUM(value) AS balance , spent FROM coins WHERE spent IS NULL GROUP BY account)
-		SELECT id_account, COALESCE(u.balance, 0) AS balance FROM accounts a
-		LEFT JOIN unspent u ON a.id_account = u.account) AS balances
-        WHERE balances.id_account = accounts.id_account",
+        "UPDATE accounts SET balance = COALESCE(
+        (SELECT SUM(value) FROM balances b WHERE b.account = accounts.id_account), 0)",
         [],
     )?;
     Ok(())
@@ -479,7 +534,7 @@ pub fn get_unspent_notes(
     account: u32,
     bc_height: u32,
 ) -> Result<Vec<ShieldedNoteT>> {
-    let mut s = connection.prepare(
+    let mut s = connection.prepare_cached(
         "SELECT n.id_note, n.height, t.timestamp, n.value, n.orchard, n.excluded
         FROM notes n JOIN txs t ON n.tx = t.id_tx
         WHERE n.account = ?1 AND (spent IS NULL OR spent > ?2) AND n.expiration IS NULL
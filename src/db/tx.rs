@@ -14,7 +14,7 @@ use warp_macros::c_export;
 use super::contacts::address_to_bytes;
 
 pub fn list_new_txids(connection: &Connection) -> Result<Vec<(u32, u32, u32, Hash)>> {
-    let mut s = connection.prepare(
+    let mut s = connection.prepare_cached(
         "SELECT t.id_tx, t.account, t.timestamp, t.txid FROM txs t
         LEFT JOIN txdetails d ON t.id_tx = d.id_tx WHERE d.id_tx IS NULL",
     )?;
@@ -36,7 +36,7 @@ pub fn list_new_txids(connection: &Connection) -> Result<Vec<(u32, u32, u32, Has
 }
 
 pub fn list_txs(connection: &Connection, account: u32) -> Result<Vec<ExtendedReceivedTx>> {
-    let mut s = connection.prepare(
+    let mut s = connection.prepare_cached(
         "SELECT t.id_tx, t.txid, t.height, t.timestamp, t.value, t.address, c.name, t.memo FROM txs t
         LEFT JOIN contact_receivers r ON r.address = t.receiver AND r.account = t.account
         LEFT JOIN contacts c ON c.id_contact = r.contact
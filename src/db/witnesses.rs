@@ -1,14 +1,251 @@
-// use anyhow::Result;
 // use incrementalmerkletree::witness::IncrementalWitness;
-// use rusqlite::Connection;
 // use sapling_crypto::Node;
 // use tracing::info;
 
+use anyhow::Result;
+use rusqlite::{params, params_from_iter, types::ToSql, Connection};
+
 use crate::{
-    warp::{AuthPath, Hasher, Witness, MERKLE_DEPTH},
+    utils::ContextExt,
+    warp::{sync::ReceivedNote, AuthPath, Edge, Hasher, Witness, MERKLE_DEPTH},
     Hash,
 };
 
+// Witness storage
+//
+// A note has one full witness in `witnesses`, at the first checkpoint
+// where it is saved. The later checkpoints only add a row to `witness_deltas`
+// with the ommers filled in since the previous one (ommers never change once set).
+// The witness at height h is the latest full witness at or below h plus
+// the deltas in between. Databases written before still have a full
+// witness per checkpoint, which this reads the same way.
+//
+// delta: u32 LE bitmask of the depths present, followed by their hashes
+
+/// Bitmask of the ommers that are set
+pub fn ommer_mask(ommers: &Edge) -> u32 {
+    let mut mask = 0;
+    for (i, o) in ommers.0.iter().enumerate() {
+        if o.is_some() {
+            mask |= 1 << i;
+        }
+    }
+    mask
+}
+
+/// Encode the ommers that are not in `stored`, None if there are none
+pub fn encode_ommers(ommers: &Edge, stored: u32) -> Option<Vec<u8>> {
+    let mask = ommer_mask(ommers) & !stored;
+    if mask == 0 {
+        return None;
+    }
+    let mut data = Vec::with_capacity(4 + 32 * mask.count_ones() as usize);
+    data.extend_from_slice(&mask.to_le_bytes());
+    for i in 0..MERKLE_DEPTH as usize {
+        if mask & (1 << i) != 0 {
+            data.extend_from_slice(ommers.0[i].as_ref().unwrap());
+        }
+    }
+    Some(data)
+}
+
+/// Set the ommers of a delta record
+pub fn apply_ommers(ommers: &mut Edge, data: &[u8]) -> Result<()> {
+    if data.len() < 4 {
+        anyhow::bail!("Invalid witness delta");
+    }
+    let mask = u32::from_le_bytes(data[0..4].try_into().unwrap());
+    if data.len() != 4 + 32 * mask.count_ones() as usize {
+        anyhow::bail!("Invalid witness delta");
+    }
+    let mut hashes = data[4..].chunks_exact(32);
+    for i in 0..MERKLE_DEPTH as usize {
+        if mask & (1 << i) != 0 {
+            ommers.0[i] = Some(hashes.next().unwrap().try_into().unwrap());
+        }
+    }
+    Ok(())
+}
+
+/// Complete the witnesses of notes read from their full witness
+/// with the deltas up to height
+pub fn apply_witness_deltas(
+    connection: &Connection,
+    height: u32,
+    notes: &mut [ReceivedNote],
+) -> Result<()> {
+    // one lookup per note on the (account, note, height) index
+    let mut s = connection.prepare_cached(
+        "SELECT d.ommers FROM witness_deltas d
+        WHERE d.account = ?1 AND d.note = ?2 AND d.height <= ?3 AND d.height >
+        (SELECT MAX(w.height) FROM witnesses w
+        WHERE w.account = ?1 AND w.note = ?2 AND w.height <= ?3)",
+    )?;
+    for n in notes.iter_mut() {
+        let rows = s.query_map(params![n.account, n.id, height], |r| {
+            r.get::<_, Vec<u8>>(0)
+        })?;
+        for r in rows {
+            apply_ommers(&mut n.witness.ommers, &r?)?;
+        }
+    }
+    Ok(())
+}
+
+/// Witness of a single note at height
+pub fn get_note_witness(
+    connection: &Connection,
+    account: u32,
+    id_note: u32,
+    height: u32,
+) -> Result<Witness> {
+    let (w_height, witness) = connection
+        .prepare_cached(
+            "SELECT height, witness FROM witnesses
+            WHERE account = ?1 AND note = ?2 AND height <= ?3
+            ORDER BY height DESC LIMIT 1",
+        )?
+        .query_row(params![account, id_note, height], |r| {
+            Ok((r.get::<_, u32>(0)?, r.get::<_, Vec<u8>>(1)?))
+        })
+        .with_file_line(|| format!("No witness for note {id_note}"))?;
+    let mut witness: Witness = bincode::deserialize_from(&*witness)?;
+    let mut s = connection.prepare_cached(
+        "SELECT ommers FROM witness_deltas
+        WHERE account = ?1 AND note = ?2 AND height > ?3 AND height <= ?4",
+    )?;
+    let rows = s.query_map(params![account, id_note, w_height, height], |r| {
+        r.get::<_, Vec<u8>>(0)
+    })?;
+    for r in rows {
+        apply_ommers(&mut witness.ommers, &r?)?;
+    }
+    Ok(witness)
+}
+
+// number of rows per INSERT statement
+const WITNESS_BATCH_SIZE: usize = 64;
+
+fn insert_witness_rows(
+    connection: &Connection,
+    table: &str,
+    column: &str,
+    height: u32,
+    rows: &[(u32, u32, Vec<u8>)],
+) -> Result<()> {
+    for batch in rows.chunks(WITNESS_BATCH_SIZE) {
+        let values = vec!["(?, ?, ?, ?)"; batch.len()].join(", ");
+        let mut s = connection.prepare_cached(&format!(
+            "INSERT INTO {table}
+            (account, note, height, {column}) VALUES {values}"
+        ))?;
+        let params = batch
+            .iter()
+            .flat_map(|(account, id_note, data)| [account as &dyn ToSql, id_note, &height, data]);
+        s.execute(params_from_iter(params))?;
+    }
+    Ok(())
+}
+
+/// Store serialized full witnesses (account, id_note, witness) at height
+pub fn store_witnesses(
+    connection: &Connection,
+    height: u32,
+    witnesses: &[(u32, u32, Vec<u8>)],
+) -> Result<()> {
+    insert_witness_rows(connection, "witnesses", "witness", height, witnesses)
+}
+
+/// Store encoded deltas (account, id_note, ommers) at height
+pub fn store_witness_deltas(
+    connection: &Connection,
+    height: u32,
+    deltas: &[(u32, u32, Vec<u8>)],
+) -> Result<()> {
+    insert_witness_rows(connection, "witness_deltas", "ommers", height, deltas)
+}
+
+/// Fold the witness records of a checkpoint that is deleted
+/// into the next checkpoint, or drop them if there is none
+pub fn compact_witnesses(connection: &Connection, height: u32) -> Result<()> {
+    let next = connection.query_row(
+        "SELECT MIN(height) FROM blcks WHERE height > ?1",
+        [height],
+        |r| r.get::<_, Option<u32>>(0),
+    )?;
+    if let Some(next) = next {
+        // full witnesses move to the next checkpoint, with its delta applied
+        // unless it already has a full witness
+        let moved = {
+            let mut s = connection.prepare(
+                "SELECT w.id_witness, w.witness, d.id_delta, d.ommers FROM witnesses w
+                LEFT JOIN witness_deltas d ON d.account = w.account
+                AND d.note = w.note AND d.height = ?2
+                WHERE w.height = ?1 AND NOT EXISTS
+                (SELECT 1 FROM witnesses w2 WHERE w2.account = w.account
+                AND w2.note = w.note AND w2.height = ?2)",
+            )?;
+            let rows = s.query_map(params![height, next], |r| {
+                Ok((
+                    r.get::<_, u32>(0)?,
+                    r.get::<_, Vec<u8>>(1)?,
+                    r.get::<_, Option<u32>>(2)?,
+                    r.get::<_, Option<Vec<u8>>>(3)?,
+                ))
+            })?;
+            rows.collect::<Result<Vec<_>, _>>()?
+        };
+        for (id_witness, witness, id_delta, delta) in moved {
+            let mut witness: Witness = bincode::deserialize_from(&*witness)?;
+            if let Some(delta) = delta {
+                apply_ommers(&mut witness.ommers, &delta)?;
+                connection.execute("DELETE FROM witness_deltas WHERE id_delta = ?1", [id_delta])?;
+            }
+            connection.execute(
+                "UPDATE witnesses SET height = ?2, witness = ?3 WHERE id_witness = ?1",
+                params![id_witness, next, bincode::serialize(&witness)?],
+            )?;
+        }
+
+        // deltas merge with the delta of the next checkpoint
+        // and are dropped if it has a full witness
+        let merged = {
+            let mut s = connection.prepare(
+                "SELECT d.id_delta, d.ommers, d2.id_delta, d2.ommers FROM witness_deltas d
+                LEFT JOIN witness_deltas d2 ON d2.account = d.account
+                AND d2.note = d.note AND d2.height = ?2
+                WHERE d.height = ?1 AND NOT EXISTS
+                (SELECT 1 FROM witnesses w WHERE w.account = d.account
+                AND w.note = d.note AND w.height = ?2)",
+            )?;
+            let rows = s.query_map(params![height, next], |r| {
+                Ok((
+                    r.get::<_, u32>(0)?,
+                    r.get::<_, Vec<u8>>(1)?,
+                    r.get::<_, Option<u32>>(2)?,
+                    r.get::<_, Option<Vec<u8>>>(3)?,
+                ))
+            })?;
+            rows.collect::<Result<Vec<_>, _>>()?
+        };
+        for (id_delta, delta, id_next, next_delta) in merged {
+            let mut ommers = Edge::default();
+            apply_ommers(&mut ommers, &delta)?;
+            if let Some(next_delta) = next_delta {
+                apply_ommers(&mut ommers, &next_delta)?;
+                connection.execute("DELETE FROM witness_deltas WHERE id_delta = ?1", [id_next])?;
+            }
+            connection.execute(
+                "UPDATE witness_deltas SET height = ?2, ommers = ?3 WHERE id_delta = ?1",
+                params![id_delta, next, encode_ommers(&ommers, 0)],
+            )?;
+        }
+    }
+    connection.execute("DELETE FROM witnesses WHERE height = ?1", [height])?;
+    connection.execute("DELETE FROM witness_deltas WHERE height = ?1", [height])?;
+    Ok(())
+}
+
 // TODO: Use witness migration
 // Read is no longer in librustzcash
 // #[allow(dead_code)]
@@ -118,3 +355,46 @@ impl Witness {
         hash
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn edge(depths: &[usize], seed: u8) -> Edge {
+        let mut edge = Edge::default();
+        for &d in depths {
+            edge.0[d] = Some([seed.wrapping_add(d as u8); 32]);
+        }
+        edge
+    }
+
+    #[test]
+    fn ommers_roundtrip() {
+        let ommers = edge(&[0, 3, 4, 17, 31], 9);
+        let data = encode_ommers(&ommers, 0).unwrap();
+        let mut decoded = Edge::default();
+        apply_ommers(&mut decoded, &data).unwrap();
+        assert_eq!(decoded, ommers);
+    }
+
+    #[test]
+    fn ommers_delta() {
+        let before = edge(&[0, 3], 9);
+        let after = edge(&[0, 3, 5, 6], 9);
+        let stored = ommer_mask(&before);
+        assert!(encode_ommers(&before, stored).is_none());
+        let data = encode_ommers(&after, stored).unwrap();
+        assert_eq!(data.len(), 4 + 2 * 32);
+        let mut w = before.clone();
+        apply_ommers(&mut w, &data).unwrap();
+        assert_eq!(w, after);
+    }
+
+    #[test]
+    fn ommers_invalid() {
+        let mut w = Edge::default();
+        assert!(apply_ommers(&mut w, &[1, 0]).is_err());
+        // mask with one depth and no hash
+        assert!(apply_ommers(&mut w, &[1, 0, 0, 0]).is_err());
+    }
+}
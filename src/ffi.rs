@@ -1,5 +1,10 @@
 use anyhow::Result;
+use flatbuffers::FlatBufferBuilder;
+use lazy_static::lazy_static;
+use parking_lot::Mutex;
 use std::{
+    cell::RefCell,
+    collections::HashMap,
     ffi::{c_char, CString},
     ptr,
 };
@@ -71,11 +76,50 @@ fn to_c_str(s: String) -> *mut c_char {
     CString::new(s).unwrap().into_raw()
 }
 
-fn to_bytes(mut b: Vec<u8>) -> (*const u8, u32) {
-    b.shrink_to_fit();
-    let buf = b.into_boxed_slice();
-    let ptr = buf.as_ptr();
-    let len = buf.len() as u32;
-    std::mem::forget(buf);
+lazy_static! {
+    // Byte results handed out to the caller, by address, until c_free_bytes
+    static ref BUFFERS: Mutex<HashMap<usize, Vec<u8>>> = Mutex::new(HashMap::new());
+}
+
+thread_local! {
+    // Reused by the flatbuffer serializers running on this thread
+    static FB_BUILDER: RefCell<FlatBufferBuilder<'static>> =
+        RefCell::new(FlatBufferBuilder::with_capacity(4096));
+}
+
+/// Run `f` with the reset flatbuffer builder of this thread.
+/// It keeps its buffer between calls
+pub fn with_fb_builder<R, F: FnOnce(&mut FlatBufferBuilder<'static>) -> R>(f: F) -> R {
+    FB_BUILDER.with(|b| {
+        let mut b = b.borrow_mut();
+        b.reset();
+        f(&mut b)
+    })
+}
+
+// The vec is kept as is, without shrinking, so that no reallocation
+// and copy happen. It is released by c_free_bytes
+fn to_bytes(b: Vec<u8>) -> (*const u8, u32) {
+    let ptr = b.as_ptr();
+    let len = b.len() as u32;
+    if b.capacity() > 0 {
+        BUFFERS.lock().insert(ptr as usize, b);
+    }
     (ptr, len)
 }
+
+/// Release a byte result
+#[no_mangle]
+pub extern "C" fn c_free_bytes(ptr: *const u8) {
+    if !ptr.is_null() {
+        BUFFERS.lock().remove(&(ptr as usize));
+    }
+}
+
+/// Release a string result or an error message
+#[no_mangle]
+pub unsafe extern "C" fn c_free_string(s: *mut c_char) {
+    if !s.is_null() {
+        drop(CString::from_raw(s));
+    }
+}
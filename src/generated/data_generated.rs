@@ -7452,6 +7452,10 @@ pub mod fb {
         pub const VT_WARP_END_HEIGHT: flatbuffers::VOffsetT = 10;
         pub const VT_CONFIRMATIONS: flatbuffers::VOffsetT = 12;
         pub const VT_REGTEST: flatbuffers::VOffsetT = 14;
+        pub const VT_DOWNLOAD_CONCURRENCY: flatbuffers::VOffsetT = 16;
+        pub const VT_MEMORY_LIMIT: flatbuffers::VOffsetT = 18;
+        pub const VT_SPAM_FILTER_THRESHOLD: flatbuffers::VOffsetT = 20;
+        pub const VT_SPAM_REFETCH: flatbuffers::VOffsetT = 22;
 
         #[inline]
         pub unsafe fn init_from_table(table: flatbuffers::Table<'a>) -> Self {
@@ -7468,6 +7472,9 @@ pub mod fb {
             args: &'args ConfigArgs<'args>,
         ) -> flatbuffers::WIPOffset<Config<'bldr>> {
             let mut builder = ConfigBuilder::new(_fbb);
+            builder.add_memory_limit(args.memory_limit);
+            builder.add_spam_filter_threshold(args.spam_filter_threshold);
+            builder.add_download_concurrency(args.download_concurrency);
             builder.add_confirmations(args.confirmations);
             builder.add_warp_end_height(args.warp_end_height);
             if let Some(x) = args.warp_url {
@@ -7479,6 +7486,7 @@ pub mod fb {
             if let Some(x) = args.db_path {
                 builder.add_db_path(x);
             }
+            builder.add_spam_refetch(args.spam_refetch);
             builder.add_regtest(args.regtest);
             builder.finish()
         }
@@ -7492,6 +7500,10 @@ pub mod fb {
             let warp_end_height = self.warp_end_height();
             let confirmations = self.confirmations();
             let regtest = self.regtest();
+            let download_concurrency = self.download_concurrency();
+            let memory_limit = self.memory_limit();
+            let spam_filter_threshold = self.spam_filter_threshold();
+            let spam_refetch = self.spam_refetch();
             ConfigT {
                 db_path,
                 servers,
@@ -7499,6 +7511,10 @@ pub mod fb {
                 warp_end_height,
                 confirmations,
                 regtest,
+                download_concurrency,
+                memory_limit,
+                spam_filter_threshold,
+                spam_refetch,
             }
         }
 
@@ -7568,6 +7584,50 @@ pub mod fb {
                     .unwrap()
             }
         }
+        #[inline]
+        pub fn download_concurrency(&self) -> u32 {
+            // Safety:
+            // Created from valid Table for this object
+            // which contains a valid value in this slot
+            unsafe {
+                self._tab
+                    .get::<u32>(Config::VT_DOWNLOAD_CONCURRENCY, Some(0))
+                    .unwrap()
+            }
+        }
+        #[inline]
+        pub fn memory_limit(&self) -> u64 {
+            // Safety:
+            // Created from valid Table for this object
+            // which contains a valid value in this slot
+            unsafe {
+                self._tab
+                    .get::<u64>(Config::VT_MEMORY_LIMIT, Some(0))
+                    .unwrap()
+            }
+        }
+        #[inline]
+        pub fn spam_filter_threshold(&self) -> u32 {
+            // Safety:
+            // Created from valid Table for this object
+            // which contains a valid value in this slot
+            unsafe {
+                self._tab
+                    .get::<u32>(Config::VT_SPAM_FILTER_THRESHOLD, Some(0))
+                    .unwrap()
+            }
+        }
+        #[inline]
+        pub fn spam_refetch(&self) -> bool {
+            // Safety:
+            // Created from valid Table for this object
+            // which contains a valid value in this slot
+            unsafe {
+                self._tab
+                    .get::<bool>(Config::VT_SPAM_REFETCH, Some(false))
+                    .unwrap()
+            }
+        }
     }
 
     impl flatbuffers::Verifiable for Config<'_> {
@@ -7594,6 +7654,10 @@ pub mod fb {
                 .visit_field::<u32>("warp_end_height", Self::VT_WARP_END_HEIGHT, false)?
                 .visit_field::<u32>("confirmations", Self::VT_CONFIRMATIONS, false)?
                 .visit_field::<bool>("regtest", Self::VT_REGTEST, false)?
+                .visit_field::<u32>("download_concurrency", Self::VT_DOWNLOAD_CONCURRENCY, false)?
+                .visit_field::<u64>("memory_limit", Self::VT_MEMORY_LIMIT, false)?
+                .visit_field::<u32>("spam_filter_threshold", Self::VT_SPAM_FILTER_THRESHOLD, false)?
+                .visit_field::<bool>("spam_refetch", Self::VT_SPAM_REFETCH, false)?
                 .finish();
             Ok(())
         }
@@ -7607,6 +7671,10 @@ pub mod fb {
         pub warp_end_height: u32,
         pub confirmations: u32,
         pub regtest: bool,
+        pub download_concurrency: u32,
+        pub memory_limit: u64,
+        pub spam_filter_threshold: u32,
+        pub spam_refetch: bool,
     }
     impl<'a> Default for ConfigArgs<'a> {
         #[inline]
@@ -7618,6 +7686,10 @@ pub mod fb {
                 warp_end_height: 0,
                 confirmations: 0,
                 regtest: false,
+                download_concurrency: 0,
+                memory_limit: 0,
+                spam_filter_threshold: 0,
+                spam_refetch: false,
             }
         }
     }
@@ -7663,6 +7735,29 @@ pub mod fb {
                 .push_slot::<bool>(Config::VT_REGTEST, regtest, false);
         }
         #[inline]
+        pub fn add_download_concurrency(&mut self, download_concurrency: u32) {
+            self.fbb_
+                .push_slot::<u32>(Config::VT_DOWNLOAD_CONCURRENCY, download_concurrency, 0);
+        }
+        #[inline]
+        pub fn add_memory_limit(&mut self, memory_limit: u64) {
+            self.fbb_
+                .push_slot::<u64>(Config::VT_MEMORY_LIMIT, memory_limit, 0);
+        }
+        #[inline]
+        pub fn add_spam_filter_threshold(&mut self, spam_filter_threshold: u32) {
+            self.fbb_.push_slot::<u32>(
+                Config::VT_SPAM_FILTER_THRESHOLD,
+                spam_filter_threshold,
+                0,
+            );
+        }
+        #[inline]
+        pub fn add_spam_refetch(&mut self, spam_refetch: bool) {
+            self.fbb_
+                .push_slot::<bool>(Config::VT_SPAM_REFETCH, spam_refetch, false);
+        }
+        #[inline]
         pub fn new(
             _fbb: &'b mut flatbuffers::FlatBufferBuilder<'a, A>,
         ) -> ConfigBuilder<'a, 'b, A> {
@@ -7688,6 +7783,10 @@ pub mod fb {
             ds.field("warp_end_height", &self.warp_end_height());
             ds.field("confirmations", &self.confirmations());
             ds.field("regtest", &self.regtest());
+            ds.field("download_concurrency", &self.download_concurrency());
+            ds.field("memory_limit", &self.memory_limit());
+            ds.field("spam_filter_threshold", &self.spam_filter_threshold());
+            ds.field("spam_refetch", &self.spam_refetch());
             ds.finish()
         }
     }
@@ -7700,6 +7799,10 @@ pub mod fb {
         pub warp_end_height: u32,
         pub confirmations: u32,
         pub regtest: bool,
+        pub download_concurrency: u32,
+        pub memory_limit: u64,
+        pub spam_filter_threshold: u32,
+        pub spam_refetch: bool,
     }
     impl Default for ConfigT {
         fn default() -> Self {
@@ -7710,6 +7813,10 @@ pub mod fb {
                 warp_end_height: 0,
                 confirmations: 0,
                 regtest: false,
+                download_concurrency: 0,
+                memory_limit: 0,
+                spam_filter_threshold: 0,
+                spam_refetch: false,
             }
         }
     }
@@ -7727,6 +7834,10 @@ pub mod fb {
             let warp_end_height = self.warp_end_height;
             let confirmations = self.confirmations;
             let regtest = self.regtest;
+            let download_concurrency = self.download_concurrency;
+            let memory_limit = self.memory_limit;
+            let spam_filter_threshold = self.spam_filter_threshold;
+            let spam_refetch = self.spam_refetch;
             Config::create(
                 _fbb,
                 &ConfigArgs {
@@ -7736,6 +7847,10 @@ pub mod fb {
                     warp_end_height,
                     confirmations,
                     regtest,
+                    download_concurrency,
+                    memory_limit,
+                    spam_filter_threshold,
+                    spam_refetch,
                 },
             )
         }
@@ -9905,4 +10020,678 @@ pub mod fb {
             )
         }
     }
+    pub enum SyncStatsOffset {}
+    #[derive(Copy, Clone, PartialEq)]
+
+    pub struct SyncStats<'a> {
+        pub _tab: flatbuffers::Table<'a>,
+    }
+
+    impl<'a> flatbuffers::Follow<'a> for SyncStats<'a> {
+        type Inner = SyncStats<'a>;
+        #[inline]
+        unsafe fn follow(buf: &'a [u8], loc: usize) -> Self::Inner {
+            Self {
+                _tab: flatbuffers::Table::new(buf, loc),
+            }
+        }
+    }
+
+    impl<'a> SyncStats<'a> {
+        pub const VT_START_HEIGHT: flatbuffers::VOffsetT = 4;
+        pub const VT_END_HEIGHT: flatbuffers::VOffsetT = 6;
+        pub const VT_HEIGHT: flatbuffers::VOffsetT = 8;
+        pub const VT_ELAPSED_MS: flatbuffers::VOffsetT = 10;
+        pub const VT_BLOCKS_DOWNLOADED: flatbuffers::VOffsetT = 12;
+        pub const VT_OUTPUTS_DOWNLOADED: flatbuffers::VOffsetT = 14;
+        pub const VT_BLOCKS_DECRYPTED: flatbuffers::VOffsetT = 16;
+        pub const VT_OUTPUTS_DECRYPTED: flatbuffers::VOffsetT = 18;
+        pub const VT_BLOCKS_PER_SEC: flatbuffers::VOffsetT = 20;
+        pub const VT_OUTPUTS_PER_SEC: flatbuffers::VOffsetT = 22;
+        pub const VT_ETA_SEC: flatbuffers::VOffsetT = 24;
+        pub const VT_DECRYPT_MS: flatbuffers::VOffsetT = 26;
+        pub const VT_HASH_US: flatbuffers::VOffsetT = 28;
+        pub const VT_COMMITS: flatbuffers::VOffsetT = 30;
+        pub const VT_COMMIT_MS: flatbuffers::VOffsetT = 32;
+        pub const VT_COMMIT_MAX_MS: flatbuffers::VOffsetT = 34;
+        pub const VT_COMMIT_HISTOGRAM: flatbuffers::VOffsetT = 36;
+        pub const VT_REORGS: flatbuffers::VOffsetT = 38;
+        pub const VT_BLOCK_QUEUE: flatbuffers::VOffsetT = 40;
+        pub const VT_CHECKPOINT_QUEUE: flatbuffers::VOffsetT = 42;
+
+        #[inline]
+        pub unsafe fn init_from_table(table: flatbuffers::Table<'a>) -> Self {
+            SyncStats { _tab: table }
+        }
+        #[allow(unused_mut)]
+        pub fn create<
+            'bldr: 'args,
+            'args: 'mut_bldr,
+            'mut_bldr,
+            A: flatbuffers::Allocator + 'bldr,
+        >(
+            _fbb: &'mut_bldr mut flatbuffers::FlatBufferBuilder<'bldr, A>,
+            args: &'args SyncStatsArgs<'args>,
+        ) -> flatbuffers::WIPOffset<SyncStats<'bldr>> {
+            let mut builder = SyncStatsBuilder::new(_fbb);
+            builder.add_commit_ms(args.commit_ms);
+            builder.add_decrypt_ms(args.decrypt_ms);
+            builder.add_outputs_decrypted(args.outputs_decrypted);
+            builder.add_blocks_decrypted(args.blocks_decrypted);
+            builder.add_outputs_downloaded(args.outputs_downloaded);
+            builder.add_blocks_downloaded(args.blocks_downloaded);
+            builder.add_elapsed_ms(args.elapsed_ms);
+            builder.add_checkpoint_queue(args.checkpoint_queue);
+            builder.add_block_queue(args.block_queue);
+            builder.add_reorgs(args.reorgs);
+            if let Some(x) = args.commit_histogram {
+                builder.add_commit_histogram(x);
+            }
+            builder.add_commit_max_ms(args.commit_max_ms);
+            builder.add_commits(args.commits);
+            if let Some(x) = args.hash_us {
+                builder.add_hash_us(x);
+            }
+            builder.add_eta_sec(args.eta_sec);
+            builder.add_outputs_per_sec(args.outputs_per_sec);
+            builder.add_blocks_per_sec(args.blocks_per_sec);
+            builder.add_height(args.height);
+            builder.add_end_height(args.end_height);
+            builder.add_start_height(args.start_height);
+            builder.finish()
+        }
+
+        pub fn unpack(&self) -> SyncStatsT {
+            let start_height = self.start_height();
+            let end_height = self.end_height();
+            let height = self.height();
+            let elapsed_ms = self.elapsed_ms();
+            let blocks_downloaded = self.blocks_downloaded();
+            let outputs_downloaded = self.outputs_downloaded();
+            let blocks_decrypted = self.blocks_decrypted();
+            let outputs_decrypted = self.outputs_decrypted();
+            let blocks_per_sec = self.blocks_per_sec();
+            let outputs_per_sec = self.outputs_per_sec();
+            let eta_sec = self.eta_sec();
+            let decrypt_ms = self.decrypt_ms();
+            let hash_us = self.hash_us().map(|x| x.into_iter().collect());
+            let commits = self.commits();
+            let commit_ms = self.commit_ms();
+            let commit_max_ms = self.commit_max_ms();
+            let commit_histogram = self.commit_histogram().map(|x| x.into_iter().collect());
+            let reorgs = self.reorgs();
+            let block_queue = self.block_queue();
+            let checkpoint_queue = self.checkpoint_queue();
+            SyncStatsT {
+                start_height,
+                end_height,
+                height,
+                elapsed_ms,
+                blocks_downloaded,
+                outputs_downloaded,
+                blocks_decrypted,
+                outputs_decrypted,
+                blocks_per_sec,
+                outputs_per_sec,
+                eta_sec,
+                decrypt_ms,
+                hash_us,
+                commits,
+                commit_ms,
+                commit_max_ms,
+                commit_histogram,
+                reorgs,
+                block_queue,
+                checkpoint_queue,
+            }
+        }
+
+        #[inline]
+        pub fn start_height(&self) -> u32 {
+            // Safety:
+            // Created from valid Table for this object
+            // which contains a valid value in this slot
+            unsafe {
+                self._tab
+                    .get::<u32>(SyncStats::VT_START_HEIGHT, Some(0))
+                    .unwrap()
+            }
+        }
+        #[inline]
+        pub fn end_height(&self) -> u32 {
+            // Safety:
+            // Created from valid Table for this object
+            // which contains a valid value in this slot
+            unsafe {
+                self._tab
+                    .get::<u32>(SyncStats::VT_END_HEIGHT, Some(0))
+                    .unwrap()
+            }
+        }
+        #[inline]
+        pub fn height(&self) -> u32 {
+            // Safety:
+            // Created from valid Table for this object
+            // which contains a valid value in this slot
+            unsafe {
+                self._tab
+                    .get::<u32>(SyncStats::VT_HEIGHT, Some(0))
+                    .unwrap()
+            }
+        }
+        #[inline]
+        pub fn elapsed_ms(&self) -> u64 {
+            // Safety:
+            // Created from valid Table for this object
+            // which contains a valid value in this slot
+            unsafe {
+                self._tab
+                    .get::<u64>(SyncStats::VT_ELAPSED_MS, Some(0))
+                    .unwrap()
+            }
+        }
+        #[inline]
+        pub fn blocks_downloaded(&self) -> u64 {
+            // Safety:
+            // Created from valid Table for this object
+            // which contains a valid value in this slot
+            unsafe {
+                self._tab
+                    .get::<u64>(SyncStats::VT_BLOCKS_DOWNLOADED, Some(0))
+                    .unwrap()
+            }
+        }
+        #[inline]
+        pub fn outputs_downloaded(&self) -> u64 {
+            // Safety:
+            // Created from valid Table for this object
+            // which contains a valid value in this slot
+            unsafe {
+                self._tab
+                    .get::<u64>(SyncStats::VT_OUTPUTS_DOWNLOADED, Some(0))
+                    .unwrap()
+            }
+        }
+        #[inline]
+        pub fn blocks_decrypted(&self) -> u64 {
+            // Safety:
+            // Created from valid Table for this object
+            // which contains a valid value in this slot
+            unsafe {
+                self._tab
+                    .get::<u64>(SyncStats::VT_BLOCKS_DECRYPTED, Some(0))
+                    .unwrap()
+            }
+        }
+        #[inline]
+        pub fn outputs_decrypted(&self) -> u64 {
+            // Safety:
+            // Created from valid Table for this object
+            // which contains a valid value in this slot
+            unsafe {
+                self._tab
+                    .get::<u64>(SyncStats::VT_OUTPUTS_DECRYPTED, Some(0))
+                    .unwrap()
+            }
+        }
+        #[inline]
+        pub fn blocks_per_sec(&self) -> u32 {
+            // Safety:
+            // Created from valid Table for this object
+            // which contains a valid value in this slot
+            unsafe {
+                self._tab
+                    .get::<u32>(SyncStats::VT_BLOCKS_PER_SEC, Some(0))
+                    .unwrap()
+            }
+        }
+        #[inline]
+        pub fn outputs_per_sec(&self) -> u32 {
+            // Safety:
+            // Created from valid Table for this object
+            // which contains a valid value in this slot
+            unsafe {
+                self._tab
+                    .get::<u32>(SyncStats::VT_OUTPUTS_PER_SEC, Some(0))
+                    .unwrap()
+            }
+        }
+        #[inline]
+        pub fn eta_sec(&self) -> u32 {
+            // Safety:
+            // Created from valid Table for this object
+            // which contains a valid value in this slot
+            unsafe {
+                self._tab
+                    .get::<u32>(SyncStats::VT_ETA_SEC, Some(0))
+                    .unwrap()
+            }
+        }
+        #[inline]
+        pub fn decrypt_ms(&self) -> u64 {
+            // Safety:
+            // Created from valid Table for this object
+            // which contains a valid value in this slot
+            unsafe {
+                self._tab
+                    .get::<u64>(SyncStats::VT_DECRYPT_MS, Some(0))
+                    .unwrap()
+            }
+        }
+        #[inline]
+        pub fn hash_us(&self) -> Option<flatbuffers::Vector<'a, u64>> {
+            // Safety:
+            // Created from valid Table for this object
+            // which contains a valid value in this slot
+            unsafe {
+                self._tab
+                    .get::<flatbuffers::ForwardsUOffset<flatbuffers::Vector<'a, u64>>>(
+                        SyncStats::VT_HASH_US,
+                        None,
+                    )
+            }
+        }
+        #[inline]
+        pub fn commits(&self) -> u32 {
+            // Safety:
+            // Created from valid Table for this object
+            // which contains a valid value in this slot
+            unsafe {
+                self._tab
+                    .get::<u32>(SyncStats::VT_COMMITS, Some(0))
+                    .unwrap()
+            }
+        }
+        #[inline]
+        pub fn commit_ms(&self) -> u64 {
+            // Safety:
+            // Created from valid Table for this object
+            // which contains a valid value in this slot
+            unsafe {
+                self._tab
+                    .get::<u64>(SyncStats::VT_COMMIT_MS, Some(0))
+                    .unwrap()
+            }
+        }
+        #[inline]
+        pub fn commit_max_ms(&self) -> u32 {
+            // Safety:
+            // Created from valid Table for this object
+            // which contains a valid value in this slot
+            unsafe {
+                self._tab
+                    .get::<u32>(SyncStats::VT_COMMIT_MAX_MS, Some(0))
+                    .unwrap()
+            }
+        }
+        #[inline]
+        pub fn commit_histogram(&self) -> Option<flatbuffers::Vector<'a, u32>> {
+            // Safety:
+            // Created from valid Table for this object
+            // which contains a valid value in this slot
+            unsafe {
+                self._tab
+                    .get::<flatbuffers::ForwardsUOffset<flatbuffers::Vector<'a, u32>>>(
+                        SyncStats::VT_COMMIT_HISTOGRAM,
+                        None,
+                    )
+            }
+        }
+        #[inline]
+        pub fn reorgs(&self) -> u32 {
+            // Safety:
+            // Created from valid Table for this object
+            // which contains a valid value in this slot
+            unsafe {
+                self._tab
+                    .get::<u32>(SyncStats::VT_REORGS, Some(0))
+                    .unwrap()
+            }
+        }
+        #[inline]
+        pub fn block_queue(&self) -> u32 {
+            // Safety:
+            // Created from valid Table for this object
+            // which contains a valid value in this slot
+            unsafe {
+                self._tab
+                    .get::<u32>(SyncStats::VT_BLOCK_QUEUE, Some(0))
+                    .unwrap()
+            }
+        }
+        #[inline]
+        pub fn checkpoint_queue(&self) -> u32 {
+            // Safety:
+            // Created from valid Table for this object
+            // which contains a valid value in this slot
+            unsafe {
+                self._tab
+                    .get::<u32>(SyncStats::VT_CHECKPOINT_QUEUE, Some(0))
+                    .unwrap()
+            }
+        }
+    }
+
+    impl flatbuffers::Verifiable for SyncStats<'_> {
+        #[inline]
+        fn run_verifier(
+            v: &mut flatbuffers::Verifier,
+            pos: usize,
+        ) -> Result<(), flatbuffers::InvalidFlatbuffer> {
+            use self::flatbuffers::Verifiable;
+            v.visit_table(pos)?
+                .visit_field::<u32>("start_height", Self::VT_START_HEIGHT, false)?
+                .visit_field::<u32>("end_height", Self::VT_END_HEIGHT, false)?
+                .visit_field::<u32>("height", Self::VT_HEIGHT, false)?
+                .visit_field::<u64>("elapsed_ms", Self::VT_ELAPSED_MS, false)?
+                .visit_field::<u64>("blocks_downloaded", Self::VT_BLOCKS_DOWNLOADED, false)?
+                .visit_field::<u64>("outputs_downloaded", Self::VT_OUTPUTS_DOWNLOADED, false)?
+                .visit_field::<u64>("blocks_decrypted", Self::VT_BLOCKS_DECRYPTED, false)?
+                .visit_field::<u64>("outputs_decrypted", Self::VT_OUTPUTS_DECRYPTED, false)?
+                .visit_field::<u32>("blocks_per_sec", Self::VT_BLOCKS_PER_SEC, false)?
+                .visit_field::<u32>("outputs_per_sec", Self::VT_OUTPUTS_PER_SEC, false)?
+                .visit_field::<u32>("eta_sec", Self::VT_ETA_SEC, false)?
+                .visit_field::<u64>("decrypt_ms", Self::VT_DECRYPT_MS, false)?
+                .visit_field::<flatbuffers::ForwardsUOffset<flatbuffers::Vector<'_, u64>>>(
+                    "hash_us",
+                    Self::VT_HASH_US,
+                    false,
+                )?
+                .visit_field::<u32>("commits", Self::VT_COMMITS, false)?
+                .visit_field::<u64>("commit_ms", Self::VT_COMMIT_MS, false)?
+                .visit_field::<u32>("commit_max_ms", Self::VT_COMMIT_MAX_MS, false)?
+                .visit_field::<flatbuffers::ForwardsUOffset<flatbuffers::Vector<'_, u32>>>(
+                    "commit_histogram",
+                    Self::VT_COMMIT_HISTOGRAM,
+                    false,
+                )?
+                .visit_field::<u32>("reorgs", Self::VT_REORGS, false)?
+                .visit_field::<u32>("block_queue", Self::VT_BLOCK_QUEUE, false)?
+                .visit_field::<u32>("checkpoint_queue", Self::VT_CHECKPOINT_QUEUE, false)?
+                .finish();
+            Ok(())
+        }
+    }
+    pub struct SyncStatsArgs<'a> {
+        pub start_height: u32,
+        pub end_height: u32,
+        pub height: u32,
+        pub elapsed_ms: u64,
+        pub blocks_downloaded: u64,
+        pub outputs_downloaded: u64,
+        pub blocks_decrypted: u64,
+        pub outputs_decrypted: u64,
+        pub blocks_per_sec: u32,
+        pub outputs_per_sec: u32,
+        pub eta_sec: u32,
+        pub decrypt_ms: u64,
+        pub hash_us: Option<flatbuffers::WIPOffset<flatbuffers::Vector<'a, u64>>>,
+        pub commits: u32,
+        pub commit_ms: u64,
+        pub commit_max_ms: u32,
+        pub commit_histogram: Option<flatbuffers::WIPOffset<flatbuffers::Vector<'a, u32>>>,
+        pub reorgs: u32,
+        pub block_queue: u32,
+        pub checkpoint_queue: u32,
+    }
+    impl<'a> Default for SyncStatsArgs<'a> {
+        #[inline]
+        fn default() -> Self {
+            SyncStatsArgs {
+                start_height: 0,
+                end_height: 0,
+                height: 0,
+                elapsed_ms: 0,
+                blocks_downloaded: 0,
+                outputs_downloaded: 0,
+                blocks_decrypted: 0,
+                outputs_decrypted: 0,
+                blocks_per_sec: 0,
+                outputs_per_sec: 0,
+                eta_sec: 0,
+                decrypt_ms: 0,
+                hash_us: None,
+                commits: 0,
+                commit_ms: 0,
+                commit_max_ms: 0,
+                commit_histogram: None,
+                reorgs: 0,
+                block_queue: 0,
+                checkpoint_queue: 0,
+            }
+        }
+    }
+
+    pub struct SyncStatsBuilder<'a: 'b, 'b, A: flatbuffers::Allocator + 'a> {
+        fbb_: &'b mut flatbuffers::FlatBufferBuilder<'a, A>,
+        start_: flatbuffers::WIPOffset<flatbuffers::TableUnfinishedWIPOffset>,
+    }
+    impl<'a: 'b, 'b, A: flatbuffers::Allocator + 'a> SyncStatsBuilder<'a, 'b, A> {
+        #[inline]
+        pub fn add_start_height(&mut self, start_height: u32) {
+            self.fbb_.push_slot::<u32>(SyncStats::VT_START_HEIGHT, start_height, 0);
+        }
+        #[inline]
+        pub fn add_end_height(&mut self, end_height: u32) {
+            self.fbb_.push_slot::<u32>(SyncStats::VT_END_HEIGHT, end_height, 0);
+        }
+        #[inline]
+        pub fn add_height(&mut self, height: u32) {
+            self.fbb_.push_slot::<u32>(SyncStats::VT_HEIGHT, height, 0);
+        }
+        #[inline]
+        pub fn add_elapsed_ms(&mut self, elapsed_ms: u64) {
+            self.fbb_.push_slot::<u64>(SyncStats::VT_ELAPSED_MS, elapsed_ms, 0);
+        }
+        #[inline]
+        pub fn add_blocks_downloaded(&mut self, blocks_downloaded: u64) {
+            self.fbb_.push_slot::<u64>(SyncStats::VT_BLOCKS_DOWNLOADED, blocks_downloaded, 0);
+        }
+        #[inline]
+        pub fn add_outputs_downloaded(&mut self, outputs_downloaded: u64) {
+            self.fbb_.push_slot::<u64>(SyncStats::VT_OUTPUTS_DOWNLOADED, outputs_downloaded, 0);
+        }
+        #[inline]
+        pub fn add_blocks_decrypted(&mut self, blocks_decrypted: u64) {
+            self.fbb_.push_slot::<u64>(SyncStats::VT_BLOCKS_DECRYPTED, blocks_decrypted, 0);
+        }
+        #[inline]
+        pub fn add_outputs_decrypted(&mut self, outputs_decrypted: u64) {
+            self.fbb_.push_slot::<u64>(SyncStats::VT_OUTPUTS_DECRYPTED, outputs_decrypted, 0);
+        }
+        #[inline]
+        pub fn add_blocks_per_sec(&mut self, blocks_per_sec: u32) {
+            self.fbb_.push_slot::<u32>(SyncStats::VT_BLOCKS_PER_SEC, blocks_per_sec, 0);
+        }
+        #[inline]
+        pub fn add_outputs_per_sec(&mut self, outputs_per_sec: u32) {
+            self.fbb_.push_slot::<u32>(SyncStats::VT_OUTPUTS_PER_SEC, outputs_per_sec, 0);
+        }
+        #[inline]
+        pub fn add_eta_sec(&mut self, eta_sec: u32) {
+            self.fbb_.push_slot::<u32>(SyncStats::VT_ETA_SEC, eta_sec, 0);
+        }
+        #[inline]
+        pub fn add_decrypt_ms(&mut self, decrypt_ms: u64) {
+            self.fbb_.push_slot::<u64>(SyncStats::VT_DECRYPT_MS, decrypt_ms, 0);
+        }
+        #[inline]
+        pub fn add_hash_us(&mut self, hash_us: flatbuffers::WIPOffset<flatbuffers::Vector<'b, u64>>) {
+            self.fbb_
+                .push_slot_always::<flatbuffers::WIPOffset<_>>(SyncStats::VT_HASH_US, hash_us);
+        }
+        #[inline]
+        pub fn add_commits(&mut self, commits: u32) {
+            self.fbb_.push_slot::<u32>(SyncStats::VT_COMMITS, commits, 0);
+        }
+        #[inline]
+        pub fn add_commit_ms(&mut self, commit_ms: u64) {
+            self.fbb_.push_slot::<u64>(SyncStats::VT_COMMIT_MS, commit_ms, 0);
+        }
+        #[inline]
+        pub fn add_commit_max_ms(&mut self, commit_max_ms: u32) {
+            self.fbb_.push_slot::<u32>(SyncStats::VT_COMMIT_MAX_MS, commit_max_ms, 0);
+        }
+        #[inline]
+        pub fn add_commit_histogram(&mut self, commit_histogram: flatbuffers::WIPOffset<flatbuffers::Vector<'b, u32>>) {
+            self.fbb_
+                .push_slot_always::<flatbuffers::WIPOffset<_>>(SyncStats::VT_COMMIT_HISTOGRAM, commit_histogram);
+        }
+        #[inline]
+        pub fn add_reorgs(&mut self, reorgs: u32) {
+            self.fbb_.push_slot::<u32>(SyncStats::VT_REORGS, reorgs, 0);
+        }
+        #[inline]
+        pub fn add_block_queue(&mut self, block_queue: u32) {
+            self.fbb_.push_slot::<u32>(SyncStats::VT_BLOCK_QUEUE, block_queue, 0);
+        }
+        #[inline]
+        pub fn add_checkpoint_queue(&mut self, checkpoint_queue: u32) {
+            self.fbb_.push_slot::<u32>(SyncStats::VT_CHECKPOINT_QUEUE, checkpoint_queue, 0);
+        }
+        #[inline]
+        pub fn new(
+            _fbb: &'b mut flatbuffers::FlatBufferBuilder<'a, A>,
+        ) -> SyncStatsBuilder<'a, 'b, A> {
+            let start = _fbb.start_table();
+            SyncStatsBuilder {
+                fbb_: _fbb,
+                start_: start,
+            }
+        }
+        #[inline]
+        pub fn finish(self) -> flatbuffers::WIPOffset<SyncStats<'a>> {
+            let o = self.fbb_.end_table(self.start_);
+            flatbuffers::WIPOffset::new(o.value())
+        }
+    }
+
+    impl core::fmt::Debug for SyncStats<'_> {
+        fn fmt(&self, f: &mut core::fmt::Formatter<'_>) -> core::fmt::Result {
+            let mut ds = f.debug_struct("SyncStats");
+            ds.field("start_height", &self.start_height());
+            ds.field("end_height", &self.end_height());
+            ds.field("height", &self.height());
+            ds.field("elapsed_ms", &self.elapsed_ms());
+            ds.field("blocks_downloaded", &self.blocks_downloaded());
+            ds.field("outputs_downloaded", &self.outputs_downloaded());
+            ds.field("blocks_decrypted", &self.blocks_decrypted());
+            ds.field("outputs_decrypted", &self.outputs_decrypted());
+            ds.field("blocks_per_sec", &self.blocks_per_sec());
+            ds.field("outputs_per_sec", &self.outputs_per_sec());
+            ds.field("eta_sec", &self.eta_sec());
+            ds.field("decrypt_ms", &self.decrypt_ms());
+            ds.field("hash_us", &self.hash_us());
+            ds.field("commits", &self.commits());
+            ds.field("commit_ms", &self.commit_ms());
+            ds.field("commit_max_ms", &self.commit_max_ms());
+            ds.field("commit_histogram", &self.commit_histogram());
+            ds.field("reorgs", &self.reorgs());
+            ds.field("block_queue", &self.block_queue());
+            ds.field("checkpoint_queue", &self.checkpoint_queue());
+            ds.finish()
+        }
+    }
+    #[non_exhaustive]
+    #[derive(Serialize, Deserialize, Debug, Clone, PartialEq)]
+    pub struct SyncStatsT {
+        pub start_height: u32,
+        pub end_height: u32,
+        pub height: u32,
+        pub elapsed_ms: u64,
+        pub blocks_downloaded: u64,
+        pub outputs_downloaded: u64,
+        pub blocks_decrypted: u64,
+        pub outputs_decrypted: u64,
+        pub blocks_per_sec: u32,
+        pub outputs_per_sec: u32,
+        pub eta_sec: u32,
+        pub decrypt_ms: u64,
+        pub hash_us: Option<Vec<u64>>,
+        pub commits: u32,
+        pub commit_ms: u64,
+        pub commit_max_ms: u32,
+        pub commit_histogram: Option<Vec<u32>>,
+        pub reorgs: u32,
+        pub block_queue: u32,
+        pub checkpoint_queue: u32,
+    }
+    impl Default for SyncStatsT {
+        fn default() -> Self {
+            Self {
+                start_height: 0,
+                end_height: 0,
+                height: 0,
+                elapsed_ms: 0,
+                blocks_downloaded: 0,
+                outputs_downloaded: 0,
+                blocks_decrypted: 0,
+                outputs_decrypted: 0,
+                blocks_per_sec: 0,
+                outputs_per_sec: 0,
+                eta_sec: 0,
+                decrypt_ms: 0,
+                hash_us: None,
+                commits: 0,
+                commit_ms: 0,
+                commit_max_ms: 0,
+                commit_histogram: None,
+                reorgs: 0,
+                block_queue: 0,
+                checkpoint_queue: 0,
+            }
+        }
+    }
+    impl SyncStatsT {
+        pub fn pack<'b, A: flatbuffers::Allocator + 'b>(
+            &self,
+            _fbb: &mut flatbuffers::FlatBufferBuilder<'b, A>,
+        ) -> flatbuffers::WIPOffset<SyncStats<'b>> {
+            let start_height = self.start_height;
+            let end_height = self.end_height;
+            let height = self.height;
+            let elapsed_ms = self.elapsed_ms;
+            let blocks_downloaded = self.blocks_downloaded;
+            let outputs_downloaded = self.outputs_downloaded;
+            let blocks_decrypted = self.blocks_decrypted;
+            let outputs_decrypted = self.outputs_decrypted;
+            let blocks_per_sec = self.blocks_per_sec;
+            let outputs_per_sec = self.outputs_per_sec;
+            let eta_sec = self.eta_sec;
+            let decrypt_ms = self.decrypt_ms;
+            let hash_us = self.hash_us.as_ref().map(|x| _fbb.create_vector(x));
+            let commits = self.commits;
+            let commit_ms = self.commit_ms;
+            let commit_max_ms = self.commit_max_ms;
+            let commit_histogram = self.commit_histogram.as_ref().map(|x| _fbb.create_vector(x));
+            let reorgs = self.reorgs;
+            let block_queue = self.block_queue;
+            let checkpoint_queue = self.checkpoint_queue;
+            SyncStats::create(
+                _fbb,
+                &SyncStatsArgs {
+                    start_height,
+                    end_height,
+                    height,
+                    elapsed_ms,
+                    blocks_downloaded,
+                    outputs_downloaded,
+                    blocks_decrypted,
+                    outputs_decrypted,
+                    blocks_per_sec,
+                    outputs_per_sec,
+                    eta_sec,
+                    decrypt_ms,
+                    hash_us,
+                    commits,
+                    commit_ms,
+                    commit_max_ms,
+                    commit_histogram,
+                    reorgs,
+                    block_queue,
+                    checkpoint_queue,
+                },
+            )
+        }
+    }
 } // pub mod fb
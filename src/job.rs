@@ -0,0 +1,250 @@
+use std::{
+    collections::HashMap,
+    ffi::{c_char, CStr},
+    future::Future,
+    panic::{catch_unwind, AssertUnwindSafe},
+    sync::{
+        atomic::{AtomicU32, AtomicU8, Ordering},
+        Arc,
+    },
+};
+
+use anyhow::Result;
+use lazy_static::lazy_static;
+use parking_lot::Mutex;
+use tokio::sync::Notify;
+
+use crate::{
+    coin::{CoinDef, COINS},
+    data::fb::PaymentRequest,
+    ffi::{map_result, map_result_bytes, with_fb_builder, CParam, CResult},
+    txdetails::retrieve_tx_details,
+    utils::pay::prepare_payment,
+    warp::sync::{transparent_scan, warp_synchronize},
+};
+
+// Background jobs submitted through the c_*_async functions
+//
+// A job runs on a snapshot of the CoinDef taken at submission, so
+// it does not hold the coin lock and the other c_* calls of
+// the same coin do not wait for it
+
+pub const JOB_RUNNING: u8 = 0;
+pub const JOB_DONE: u8 = 1;
+pub const JOB_FAILED: u8 = 2;
+pub const JOB_CANCELLED: u8 = 3;
+
+/// Called with (job, status, progress) when a job reports progress
+/// and once it finishes
+pub type JobCallback = extern "C" fn(u32, u8, u32);
+
+struct JobState {
+    id: u32,
+    status: AtomicU8,
+    progress: AtomicU32,
+    result: Mutex<Option<Result<Vec<u8>>>>,
+    cancel: Notify,
+    callback: Option<JobCallback>,
+}
+
+impl JobState {
+    fn notify(&self) {
+        if let Some(callback) = self.callback {
+            callback(
+                self.id,
+                self.status.load(Ordering::Acquire),
+                self.progress.load(Ordering::Relaxed),
+            );
+        }
+    }
+
+    fn finish(&self, status: u8, res: Result<Vec<u8>>) {
+        *self.result.lock() = Some(res);
+        self.status.store(status, Ordering::Release);
+        self.notify();
+    }
+}
+
+lazy_static! {
+    static ref JOBS: Mutex<HashMap<u32, Arc<JobState>>> = Mutex::new(HashMap::new());
+}
+
+static NEXT_JOB: AtomicU32 = AtomicU32::new(1);
+
+tokio::task_local! {
+    static CURRENT_JOB: Arc<JobState>;
+}
+
+/// Report the progress of the job running the current task.
+/// Does nothing outside of a job
+pub fn report_progress(progress: u32) {
+    let _ = CURRENT_JOB.try_with(|job| {
+        job.progress.store(progress, Ordering::Relaxed);
+        job.notify();
+    });
+}
+
+/// Run `f` on a snapshot of the coin in the background and
+/// return the job id
+pub fn submit<F, Fut>(coin: u8, callback: Option<JobCallback>, f: F) -> u32
+where
+    F: FnOnce(CoinDef) -> Fut + Send + 'static,
+    Fut: Future<Output = Result<Vec<u8>>>,
+{
+    let coin = COINS[coin as usize].lock().clone();
+    let runtime = coin.runtime.0.clone().unwrap();
+    let id = NEXT_JOB.fetch_add(1, Ordering::Relaxed);
+    let job = Arc::new(JobState {
+        id,
+        status: AtomicU8::new(JOB_RUNNING),
+        progress: AtomicU32::new(0),
+        result: Mutex::new(None),
+        cancel: Notify::new(),
+        callback,
+    });
+    JOBS.lock().insert(id, job.clone());
+    // The futures of the wallet functions are not Send, so they
+    // are driven on a blocking thread, as the c_* calls do
+    let handle = runtime.handle().clone();
+    runtime.spawn_blocking(move || {
+        let j = job.clone();
+        let r = catch_unwind(AssertUnwindSafe(|| {
+            handle.block_on(CURRENT_JOB.scope(j.clone(), async move {
+                tokio::select! {
+                    res = f(coin) => {
+                        let status = if res.is_ok() { JOB_DONE } else { JOB_FAILED };
+                        j.finish(status, res);
+                    }
+                    _ = j.cancel.notified() => {
+                        j.finish(JOB_CANCELLED, Err(anyhow::anyhow!("Cancelled")));
+                    }
+                }
+            }))
+        }));
+        // a job that panicked must still finish, or it runs forever
+        if r.is_err() && job.status.load(Ordering::Acquire) == JOB_RUNNING {
+            job.finish(JOB_FAILED, Err(anyhow::anyhow!("Job {id} panicked")));
+        }
+    });
+    id
+}
+
+fn get_job(job: u32) -> Result<Arc<JobState>> {
+    JOBS.lock()
+        .get(&job)
+        .cloned()
+        .ok_or(anyhow::anyhow!("Unknown job {job}"))
+}
+
+#[no_mangle]
+pub extern "C" fn c_job_status(job: u32) -> CResult<u8> {
+    map_result(get_job(job).map(|j| j.status.load(Ordering::Acquire)))
+}
+
+#[no_mangle]
+pub extern "C" fn c_job_progress(job: u32) -> CResult<u32> {
+    map_result(get_job(job).map(|j| j.progress.load(Ordering::Relaxed)))
+}
+
+/// The job stops at its next await point
+#[no_mangle]
+pub extern "C" fn c_job_cancel(job: u32) -> CResult<u8> {
+    let res = || {
+        let job = get_job(job)?;
+        job.cancel.notify_one();
+        Ok::<_, anyhow::Error>(0)
+    };
+    map_result(res())
+}
+
+/// Take the result of a finished job and release it.
+/// The bytes are empty for jobs that do not return data
+#[no_mangle]
+pub extern "C" fn c_job_result(job: u32) -> CResult<*const u8> {
+    let res = || {
+        let j = get_job(job)?;
+        if j.status.load(Ordering::Acquire) == JOB_RUNNING {
+            anyhow::bail!("Job {job} is still running");
+        }
+        JOBS.lock().remove(&job);
+        // another thread may have taken it in the meantime
+        j.result
+            .lock()
+            .take()
+            .ok_or(anyhow::anyhow!("Result of job {job} already taken"))?
+    };
+    map_result_bytes(res())
+}
+
+#[no_mangle]
+pub extern "C" fn c_warp_synchronize_async(
+    coin: u8,
+    end_height: u32,
+    callback: Option<JobCallback>,
+) -> u32 {
+    submit(coin, callback, move |coin| async move {
+        warp_synchronize(&coin, end_height).await?;
+        Ok(vec![])
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn c_transparent_scan_async(
+    coin: u8,
+    account: u32,
+    end_height: u32,
+    callback: Option<JobCallback>,
+) -> u32 {
+    submit(coin, callback, move |coin| async move {
+        let mut connection = coin.connection()?;
+        let mut client = coin.connect_lwd()?;
+        transparent_scan(
+            &coin,
+            &coin.network,
+            &mut connection,
+            &mut client,
+            account,
+            end_height,
+        )
+        .await?;
+        Ok(vec![])
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn c_retrieve_tx_details_async(
+    coin: u8,
+    callback: Option<JobCallback>,
+) -> u32 {
+    submit(coin, callback, move |coin| async move {
+        let connection = coin.connection()?;
+        retrieve_tx_details(&coin, &coin.network, &connection).await?;
+        Ok(vec![])
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn c_prepare_payment_async(
+    coin: u8,
+    account: u32,
+    payment: CParam,
+    redirect: *mut c_char,
+    callback: Option<JobCallback>,
+) -> u32 {
+    // copy the arguments, the caller may release them before the job runs
+    let payment = unsafe { std::slice::from_raw_parts(payment.value, payment.len as usize) };
+    let payment = flatbuffers::root::<PaymentRequest>(payment)
+        .map(|p| p.unpack())
+        .map_err(anyhow::Error::from);
+    let redirect = unsafe { CStr::from_ptr(redirect).to_string_lossy().to_string() };
+    submit(coin, callback, move |coin| async move {
+        let payment = payment?;
+        let summary = prepare_payment(&coin, account, &payment, &redirect).await?;
+        let data = with_fb_builder(|builder| {
+            let o = summary.pack(builder);
+            builder.finish(o, None);
+            builder.finished_data().to_vec()
+        });
+        Ok(data)
+    })
+}
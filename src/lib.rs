@@ -11,6 +11,7 @@ pub mod cli;
 pub mod coin;
 pub mod db;
 pub mod ffi;
+pub mod job;
 mod keys;
 pub mod lwd;
 pub mod network;
@@ -1,6 +1,7 @@
 use std::time::Instant;
 
 use anyhow::Result;
+use rayon::prelude::*;
 use rpc::{
     BlockId, BlockRange, CompactBlock, Empty, GetAddressUtxosArg, RawTransaction,
     TransparentAddressBlockFilter, TreeState, TxFilter,
@@ -21,7 +22,7 @@ use crate::{
     types::CheckpointHeight,
     utils::ContextExt as _,
     warp::{legacy::CommitmentTreeFrontier, OutPoint, TransparentTx, TxOut2, UTXO},
-    Client,
+    Client, Hash,
 };
 
 use warp_macros::c_export;
@@ -113,6 +114,17 @@ pub async fn get_compact_block_range(
     client: &mut Client,
     start: u32,
     end: u32,
+) -> Result<Streaming<CompactBlock>> {
+    get_compact_block_range_filtered(client, start, end, 0).await
+}
+
+/// Blocks where the server replaces the outputs of the transactions
+/// above `spam_filter_threshold` outputs by a Bridge. 0 disables the filter
+pub async fn get_compact_block_range_filtered(
+    client: &mut Client,
+    start: u32,
+    end: u32,
+    spam_filter_threshold: u32,
 ) -> Result<Streaming<CompactBlock>> {
     let req = || {
         Request::new(BlockRange {
@@ -124,7 +136,7 @@ pub async fn get_compact_block_range(
                 height: end as u64,
                 hash: vec![],
             }),
-            spam_filter_threshold: 0,
+            spam_filter_threshold: spam_filter_threshold as u64,
         })
     };
     let blocks = client.get_block_range(req()).await?.into_inner();
@@ -160,49 +172,69 @@ pub async fn get_transparent(
         }))
         .await?
         .into_inner();
-    let mut ttxs = vec![];
+    let mut raw_txs = vec![];
     while let Some(raw_tx) = txs.message().await? {
-        let height = raw_tx.height as u32;
-        let raw_tx = raw_tx.data;
-        let branch_id = BranchId::for_height(network, BlockHeight::from_u32(height));
-        let tx = Transaction::read(&*raw_tx, branch_id)?;
-        let transparent_bundle = tx.transparent_bundle().unwrap();
-        let mut vins = vec![];
-        for vin in transparent_bundle.vin.iter() {
-            let prev_out = crate::warp::OutPoint {
-                txid: vin.prevout.hash().clone(),
-                vout: vin.prevout.n(),
-            };
-            vins.push(prev_out);
-        }
-        let mut vouts = vec![];
-        for (vout, txout) in transparent_bundle.vout.iter().enumerate() {
-            if let Some(address) = txout.recipient_address() {
-                if address == taddr {
-                    let out = crate::warp::TxOut {
-                        address: txout.recipient_address(),
-                        value: txout.value.into(),
-                        vout: vout as u32,
-                    };
-                    vouts.push(out);
-                }
+        raw_txs.push(raw_tx);
+    }
+
+    // parsing is CPU bound, keep it off the async workers
+    let network = *network;
+    tokio::task::spawn_blocking(move || {
+        raw_txs
+            .par_iter()
+            .map(|raw_tx| {
+                parse_transparent_tx(&network, account, external, addr_index, &taddr, raw_tx)
+            })
+            .collect::<Result<Vec<_>>>()
+    })
+    .await?
+}
+
+fn parse_transparent_tx(
+    network: &Network,
+    account: u32,
+    external: u32,
+    addr_index: u32,
+    taddr: &TransparentAddress,
+    raw_tx: &RawTransaction,
+) -> Result<TransparentTx> {
+    let height = raw_tx.height as u32;
+    let branch_id = BranchId::for_height(network, BlockHeight::from_u32(height));
+    let tx = Transaction::read(&*raw_tx.data, branch_id)?;
+    let transparent_bundle = tx.transparent_bundle().unwrap();
+    let mut vins = vec![];
+    for vin in transparent_bundle.vin.iter() {
+        let prev_out = crate::warp::OutPoint {
+            txid: vin.prevout.hash().clone(),
+            vout: vin.prevout.n(),
+        };
+        vins.push(prev_out);
+    }
+    let mut vouts = vec![];
+    for (vout, txout) in transparent_bundle.vout.iter().enumerate() {
+        if let Some(address) = txout.recipient_address() {
+            if &address == taddr {
+                let out = crate::warp::TxOut {
+                    address: txout.recipient_address(),
+                    value: txout.value.into(),
+                    vout: vout as u32,
+                };
+                vouts.push(out);
             }
         }
-        let ttx = TransparentTx {
-            account,
-            height,
-            external,
-            addr_index,
-            address: taddr.clone(),
-            timestamp: 0,
-            txid: tx.txid().as_ref().clone().try_into().unwrap(),
-            vins,
-            vouts,
-        };
-        ttxs.push(ttx);
     }
-
-    Ok(ttxs)
+    let ttx = TransparentTx {
+        account,
+        height,
+        external,
+        addr_index,
+        address: taddr.clone(),
+        timestamp: 0,
+        txid: tx.txid().as_ref().clone().try_into().unwrap(),
+        vins,
+        vouts,
+    };
+    Ok(ttx)
 }
 
 pub async fn broadcast(client: &mut Client, height: u32, tx: &TransactionBytesT) -> Result<String> {
@@ -223,34 +255,53 @@ pub fn get_txin_coins(coin: &CoinDef, network: Network, ops: Vec<OutPoint>) -> R
             let mut client = coin.connect_lwd()?;
             let mut txouts = vec![];
             for op in ops {
-                let tx = client
-                    .get_transaction(Request::new(TxFilter {
-                        block: None,
-                        index: 0,
-                        hash: op.txid.to_vec(),
-                    }))
-                    .await
-                    .with_file_line(|| "get_transaction")?
-                    .into_inner();
-                let data = &*tx.data;
-                let tx = Transaction::read(data, BranchId::Nu5)?;
-                let tx_data = tx.into_data();
-                let b = tx_data
-                    .transparent_bundle()
-                    .ok_or(anyhow::anyhow!("No T bundle"))?;
-                let txout = &b.vout[op.vout as usize];
-                let txout = TxOut2 {
-                    address: txout.recipient_address().map(|o| o.encode(&network)),
-                    value: txout.value.into(),
-                    vout: op.vout,
-                };
-                txouts.push(txout);
+                let mut txout = get_tx_outputs(&network, &mut client, &op.txid, &[op.vout]).await?;
+                txouts.push(txout.pop().unwrap());
             }
             Ok(txouts)
         })
     })
 }
 
+/// The outputs `vouts` of the transaction `txid`
+pub async fn get_tx_outputs(
+    network: &Network,
+    client: &mut Client,
+    txid: &Hash,
+    vouts: &[u32],
+) -> Result<Vec<TxOut2>> {
+    let tx = client
+        .get_transaction(Request::new(TxFilter {
+            block: None,
+            index: 0,
+            hash: txid.to_vec(),
+        }))
+        .await
+        .with_file_line(|| "get_transaction")?
+        .into_inner();
+    let data = &*tx.data;
+    let tx = Transaction::read(data, BranchId::Nu5)?;
+    let tx_data = tx.into_data();
+    let b = tx_data
+        .transparent_bundle()
+        .ok_or(anyhow::anyhow!("No T bundle"))?;
+    let txouts = vouts
+        .iter()
+        .map(|&vout| {
+            let txout = b
+                .vout
+                .get(vout as usize)
+                .ok_or(anyhow::anyhow!("No output {vout}"))?;
+            Ok(TxOut2 {
+                address: txout.recipient_address().map(|o| o.encode(network)),
+                value: txout.value.into(),
+                vout,
+            })
+        })
+        .collect::<Result<Vec<_>>>()?;
+    Ok(txouts)
+}
+
 pub async fn get_transaction(
     network: &Network,
     client: &mut Client,
@@ -1,3 +1,5 @@
+use std::sync::Arc;
+
 use fee::FeeManager;
 use fpdec::Decimal;
 use orchard::circuit::ProvingKey;
@@ -282,7 +284,8 @@ impl std::ops::Sub for PoolBalance {
 }
 
 lazy_static::lazy_static! {
-    pub static ref PROVER: Mutex<Option<LocalTxProver>> = Mutex::new(LocalTxProver::with_default_location());
+    pub static ref PROVER: Mutex<Option<Arc<LocalTxProver>>> =
+        Mutex::new(LocalTxProver::with_default_location().map(Arc::new));
     pub static ref ORCHARD_PROVER: ProvingKey = ProvingKey::build();
 }
 
@@ -312,6 +315,34 @@ pub fn make_payment(
         let fee = pb.fee_manager.fee();
         utx.add_to_change(fee as i64)?;
     }
+    pb.load_witnesses(connection, &mut utx)?;
     let utx = pb.finalize(utx, redirect)?;
     Ok(utx)
 }
+
+/// Split a payment to many recipients into transactions of
+/// at most `max_recipients` outputs
+pub fn make_batch_payment(
+    network: &Network,
+    connection: &Connection,
+    account: u32,
+    payment: &PaymentRequestT,
+    max_recipients: usize,
+    s_tree: &CommitmentTreeFrontier,
+    o_tree: &CommitmentTreeFrontier,
+    redirect: Option<String>,
+) -> Result<Vec<UnsignedTransaction>> {
+    let mut pb = PaymentBuilder::new(
+        network,
+        connection,
+        account,
+        CheckpointHeight(payment.height),
+        fb_unwrap!(payment.recipients),
+        PoolMask(payment.src_pools),
+        s_tree,
+        o_tree,
+    )?;
+    pb.add_account_funds(&connection)?;
+    pb.set_use_change(payment.use_change)?;
+    pb.prepare_batch(connection, max_recipients, payment.sender_pay_fees, redirect)
+}
@@ -1,4 +1,4 @@
-use std::{collections::HashMap, path::Path};
+use std::{collections::HashMap, path::Path, sync::Arc};
 
 use crate::{
     data::fb::{IdNoteT, TransactionBytesT},
@@ -9,8 +9,10 @@ use crate::{
         hasher::{empty_roots, OrchardHasher, SaplingHasher},
         MERKLE_DEPTH,
     },
+    Hash,
 };
 use anyhow::Result;
+use parking_lot::Mutex;
 use sapling_crypto::{note_encryption::Zip212Enforcement, PaymentAddress};
 use secp256k1::SecretKey;
 use zcash_client_backend::encoding::AddressCodec as _;
@@ -26,7 +28,7 @@ use orchard::{
     tree::MerkleHashOrchard,
     Address,
 };
-use rand::{CryptoRng, RngCore};
+use rand::{rngs::StdRng, CryptoRng, RngCore, SeedableRng};
 use rusqlite::Connection;
 use zcash_primitives::{
     consensus::{BlockHeight, BranchId},
@@ -248,16 +250,16 @@ impl UnsignedTransaction {
         }
 
         let transparent_bundle = transparent_builder.build();
-        let prover = PROVER.lock();
-        let prover = prover
-            .as_ref()
+        // clone the prover out of the lock so that concurrent builds
+        // do not wait for each other
+        let prover = PROVER
+            .lock()
+            .clone()
             .ok_or(anyhow::anyhow!("Sapling prover not initialized"))?;
         let sapling_bundle = sapling_builder
             .build::<LocalTxProver, LocalTxProver, _, _>(&mut rng)
             .unwrap()
             .map(|pair| pair.0);
-        let sapling_bundle =
-            sapling_bundle.map(|sb| sb.create_proofs(prover, prover, &mut rng, ()));
 
         let has_orchard = self.tx_notes.iter().any(|n| match n.note {
             InputNote::Orchard { .. } => true,
@@ -272,6 +274,24 @@ impl UnsignedTransaction {
             orchard_bundle = orchard_builder.build(&mut rng).unwrap().map(|pair| pair.0);
         }
 
+        // The proofs are not covered by the txid and the sighash,
+        // so the Sapling and Orchard bundles are proven side by side
+        let mut sapling_rng = StdRng::from_rng(&mut rng)?;
+        let mut orchard_rng = StdRng::from_rng(&mut rng)?;
+        let (sapling_bundle, orchard_proven) = rayon::join(
+            || {
+                sapling_bundle
+                    .map(|sb| sb.create_proofs(&*prover, &*prover, &mut sapling_rng, ()))
+            },
+            || {
+                orchard_bundle
+                    .as_ref()
+                    .map(|ob| ob.clone().create_proof(&ORCHARD_PROVER, &mut orchard_rng))
+                    .transpose()
+            },
+        );
+        let orchard_proven = orchard_proven.map_err(|e| anyhow::anyhow!("{e:?}"))?;
+
         let consensus_branch_id = BranchId::for_height(network, BlockHeight::from_u32(self.height));
         let version = TxVersion::suggested_for_branch(consensus_branch_id);
 
@@ -309,12 +329,11 @@ impl UnsignedTransaction {
                 .unwrap()
         });
 
-        let orchard_bundle = unauthed_tx.orchard_bundle().map(|ob| {
+        let orchard_bundle = orchard_proven.map(|ob| {
             let sk = ai.orchard.as_ref().and_then(|oi| oi.sk);
             let sak = sk.map(|sk| SpendAuthorizingKey::from(&sk));
             let sak = [sak].into_iter().flatten().collect::<Vec<_>>();
-            let proven = ob.clone().create_proof(&ORCHARD_PROVER, &mut rng).unwrap();
-            proven.apply_signatures(&mut rng, sig_hash, &sak).unwrap()
+            ob.apply_signatures(&mut rng, sig_hash, &sak).unwrap()
         });
 
         let tx_data: TransactionData<zcash_primitives::transaction::Authorized> =
@@ -342,10 +361,38 @@ impl UnsignedTransaction {
     }
 }
 
+lazy_static::lazy_static! {
+    // checksum of the parameters loaded by init_sapling_prover
+    static ref PROVER_PARAMS: Mutex<Option<Hash>> = Mutex::new(None);
+}
+
+fn params_checksum(spend: &[u8], output: &[u8]) -> Hash {
+    let h = blake2b_simd::Params::new()
+        .hash_length(32)
+        .to_state()
+        .update(spend)
+        .update(output)
+        .finalize();
+    h.as_bytes().try_into().unwrap()
+}
+
+/// Build the Orchard proving key in the background, so that
+/// the first transaction does not pay for it
+fn warm_up_orchard_prover() {
+    rayon::spawn(|| lazy_static::initialize(&ORCHARD_PROVER));
+}
+
 #[c_export]
 pub fn init_sapling_prover(spend: &[u8], output: &[u8]) -> Result<()> {
-    let prover = LocalTxProver::from_bytes(spend, output);
-    *PROVER.lock() = Some(prover);
+    let checksum = params_checksum(spend, output);
+    let mut params = PROVER_PARAMS.lock();
+    // the app passes the same parameters every time it starts a wallet
+    if params.as_ref() != Some(&checksum) || PROVER.lock().is_none() {
+        let prover = LocalTxProver::from_bytes(spend, output);
+        *PROVER.lock() = Some(Arc::new(prover));
+        *params = Some(checksum);
+    }
+    warm_up_orchard_prover();
     Ok(())
 }
 
@@ -354,6 +401,8 @@ pub fn init_sapling_prover_with_location(directory: &Path) -> Result<()> {
         &directory.join("sapling-spend.params"),
         &directory.join("sapling-output.params"),
     );
-    *PROVER.lock() = Some(prover);
+    *PROVER.lock() = Some(Arc::new(prover));
+    *PROVER_PARAMS.lock() = None;
+    warm_up_orchard_prover();
     Ok(())
 }
@@ -1,6 +1,6 @@
 use super::{
-    fee::FeeManager, AdjustableUnsignedTransaction, Error, ExtendedRecipient, OutputNote,
-    PaymentBuilder, Result, TxInput, TxOutput, UnsignedTransaction,
+    fee::FeeManager, AdjustableUnsignedTransaction, Error, ExtendedRecipient, InputNote,
+    OutputNote, PaymentBuilder, Result, TxInput, TxOutput, UnsignedTransaction,
 };
 use fpdec::{Dec, Decimal};
 use rusqlite::Connection;
@@ -11,7 +11,8 @@ use crate::{
     data::fb::RecipientT,
     db::{
         account::get_account_info,
-        notes::{list_received_notes, list_utxos},
+        notes::{list_spendable_notes, list_utxos},
+        witnesses::get_note_witness,
     },
     fb_unwrap,
     network::Network,
@@ -33,7 +34,8 @@ use crate::{
     + sapling/orchard commitment tree (you get these from lwd with `get_tree_state`)
     The builder records the *outputs* but has no funds yet
     2. add funds to use; either directly with `add_utxos`
-    or by using the notes that the account contains with `add_account_funds`
+    or by using the notes that the account contains with `add_account_funds`.
+    The notes are added without their witnesses
     3. call `set_use_change` with true/false to indicate if the transaction
     should have a change output or not. Fees depends on the number and types
     of inputs/outputs, therefore having a change output may affect the fees
@@ -45,6 +47,7 @@ use crate::{
     Fees are calculated based on ZIP-317 and Outputs are not modified.
     But, we may run out of Input funds. In this case, Change MAY BE negative!
     4. prepare returns an AdjustableUnsignedTransaction.
+    Call `load_witnesses` to read the witnesses of the notes it selected.
     Inputs and fees are frozen, but you can move funds from the Change
     to the *first* output/recipient by calling `add_to_change`.
     This allows you to adjust the amount paid without modifying the rest
@@ -62,6 +65,8 @@ use crate::{
     received by the recipient by -fees.
     Note that if we created the transaction differently, we would have
     a change output that increases the fees unnecessarily.
+    Alternatively, `prepare_batch` plans several transactions for
+    a long list of recipients from the same funds.
     5. `finalize` the AdjustableUnsignedTransaction into a
     UnsignedTransaction. This checks the change output and creates
     an output if needed
@@ -128,7 +133,7 @@ impl PaymentBuilder {
             vec![]
         };
         let sapling_inputs = if account_pools & 2 != 0 && !has_tex {
-            list_received_notes(
+            list_spendable_notes(
                 connection,
                 self.account,
                 CheckpointHeight(self.height),
@@ -138,7 +143,7 @@ impl PaymentBuilder {
             vec![]
         };
         let orchard_inputs = if account_pools & 4 != 0 && !has_tex {
-            list_received_notes(
+            list_spendable_notes(
                 connection,
                 self.account,
                 CheckpointHeight(self.height),
@@ -365,8 +370,68 @@ impl PaymentBuilder {
         Ok(transaction)
     }
 
+    /// Read the witnesses of the notes selected by `prepare`
+    pub fn load_witnesses(
+        &self,
+        connection: &Connection,
+        utx: &mut AdjustableUnsignedTransaction,
+    ) -> Result<()> {
+        for n in utx.tx_notes.iter_mut() {
+            match &mut n.note {
+                InputNote::Sapling { witness, .. } | InputNote::Orchard { witness, .. } => {
+                    *witness = get_note_witness(connection, self.account, n.id, self.height)?;
+                }
+                InputNote::Transparent { .. } => {}
+            }
+        }
+        Ok(())
+    }
+
+    /// Plan transactions of at most `max_recipients` recipients each
+    /// for all the recipients, in one pass over the funds.
+    /// The inputs of a transaction are not used again by the next ones
+    pub fn prepare_batch(
+        &mut self,
+        connection: &Connection,
+        max_recipients: usize,
+        sender_pay_fees: bool,
+        message: Option<String>,
+    ) -> Result<Vec<UnsignedTransaction>> {
+        let recipients = std::mem::take(&mut self.outputs);
+        let mut utxs = vec![];
+        for chunk in recipients.chunks(max_recipients.max(1)) {
+            self.outputs = chunk.to_vec();
+            self.fee_manager = FeeManager::default();
+            self.fee = 0;
+            self.used = [false; 3];
+            let mut utx = self.prepare()?;
+            if !sender_pay_fees {
+                let fee = self.fee_manager.fee();
+                utx.add_to_change(fee as i64)?;
+            }
+            self.load_witnesses(connection, &mut utx)?;
+            for i in 0..3 {
+                self.inputs[i].retain(|inp| {
+                    !utx.tx_notes
+                        .iter()
+                        .any(|n| n.pool == inp.pool && n.id == inp.id)
+                });
+            }
+            utxs.push(self.finalize_ref(utx, message.clone())?);
+        }
+        Ok(utxs)
+    }
+
     pub fn finalize(
         self,
+        utx: AdjustableUnsignedTransaction,
+        message: Option<String>,
+    ) -> Result<UnsignedTransaction> {
+        self.finalize_ref(utx, message)
+    }
+
+    fn finalize_ref(
+        &self,
         mut utx: AdjustableUnsignedTransaction,
         message: Option<String>,
     ) -> Result<UnsignedTransaction> {
@@ -406,7 +471,7 @@ impl PaymentBuilder {
             ],
             tx_notes: utx.tx_notes,
             tx_outputs: utx.tx_outputs,
-            fees: self.fee_manager,
+            fees: self.fee_manager.clone(),
             message,
         };
 
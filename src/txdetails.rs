@@ -1,17 +1,26 @@
-use std::io::{Read, Write};
+use std::{
+    collections::HashMap,
+    io::{Read, Write},
+    sync::Arc,
+};
 
 use anyhow::Result;
 use flate2::{read::ZlibDecoder, write::ZlibEncoder, Compression};
 use orchard::{keys::Scope, note_encryption::OrchardDomain, Address};
 use parking_lot::Mutex;
+use rayon::prelude::*;
 use rusqlite::Connection;
 use sapling_crypto::{note_encryption::SaplingDomain, PaymentAddress};
 use serde::{Deserialize, Deserializer, Serialize, Serializer};
+use tokio::sync::Semaphore;
 use zcash_client_backend::encoding::AddressCodec as _;
 use zcash_note_encryption::{try_note_decryption, try_output_recovery_with_ovk};
 use zcash_primitives::{
     memo::Memo,
-    transaction::{components::sapling::zip212_enforcement, Transaction as ZTransaction},
+    transaction::{
+        components::sapling::zip212_enforcement, Authorized, Transaction as ZTransaction,
+        TransactionData,
+    },
 };
 
 use crate::{
@@ -19,7 +28,7 @@ use crate::{
     coin::CoinDef,
     data::fb::{
         InputShieldedT, InputTransparentT, OutputShieldedT, OutputTransparentT, ShieldedMessageT,
-        TransactionInfoExtendedT, UserMemoT,
+        TransactionInfoExtendedT, TransparentAddressT, UserMemoT,
     },
     db::{
         account::{get_account_info, list_account_transparent_addresses},
@@ -28,13 +37,13 @@ use crate::{
         tx::{get_tx, list_new_txids, store_tx_details, update_tx_primary_address_memo},
     },
     fb_unwrap,
-    lwd::{get_transaction, get_txin_coins},
+    lwd::{get_transaction, get_tx_outputs, get_txin_coins},
     network::Network,
-    types::{Addresses, PoolMask},
+    types::{AccountInfo, Addresses, PoolMask},
     utils::ua::ua_of_orchard,
     warp::{
         sync::{FullPlainNote, PlainNote, ReceivedTx, TransparentNote},
-        OutPoint, TxOut2,
+        OutPoint, TxOut2, STXO,
     },
     Hash,
 };
@@ -134,244 +143,320 @@ pub struct TransactionDetails {
     pub oouts: Vec<ShieldedOutput>,
 }
 
-pub fn analyze_raw_transaction(
-    coin: &CoinDef,
-    network: &Network,
-    connection: &Connection,
-    account: u32,
-    height: u32,
-    timestamp: u32,
-    tx: ZTransaction,
-) -> Result<TransactionDetails> {
-    let ai = get_account_info(network, connection, account)?;
-    let txid: Hash = tx.txid().as_ref().clone();
-    let data = tx.into_data();
-    let zip212_enforcement = zip212_enforcement(network, height.into());
-    let stxos = list_pending_stxos(connection, account)?;
-    let account_addresses = list_account_transparent_addresses(connection, account)?;
-
-    let mut tins = vec![];
-    let mut touts = vec![];
-    if let Some(b) = data.transparent_bundle() {
-        for vin in b.vin.iter() {
-            // transparent inputs do not come with an address, so we have
-            // to lookup if we know them from our utxos
-            let prev_utxo = stxos
-                .iter()
-                .find(|&utxo| &utxo.txid == vin.prevout.hash() && utxo.vout == vin.prevout.n());
-            let note = prev_utxo.map(|n| TransparentNote {
-                id: 0,
-                address: n.address.clone(),
-                value: n.value,
-            });
-            let tin = TransparentInput {
-                out_point: OutPoint {
-                    txid: vin.prevout.hash().clone(),
-                    vout: vin.prevout.n(),
-                },
-                coin: TxOut2::default(),
-                note,
-            };
-            tins.push(tin);
-        }
+/// Account data used to analyze its transactions, loaded once per account
+pub struct TxAnalyzer {
+    pub account: u32,
+    pub ai: AccountInfo,
+    pub addresses: Addresses,
+    stxos: Vec<STXO>,
+    account_addresses: Vec<TransparentAddressT>,
+}
 
-        for (n, vout) in b.vout.iter().enumerate() {
-            let address = vout.recipient_address().map(|a| a.encode(network));
-            let note = address.as_ref().and_then(|a| {
-                let note = account_addresses
-                    .iter()
-                    .find(|&ta| fb_unwrap!(ta.address) == a);
-                note
-            });
-            let value = vout.value.into();
-            let note = note.map(|n| TransparentNote {
-                id: 0,
-                address: n.address.clone().unwrap(),
-                value,
-            });
-            let tout = TransparentOutput {
-                coin: TxOut2 {
-                    address,
-                    value,
-                    vout: n as u32,
-                },
-                note,
-            };
-            touts.push(tout);
-        }
+impl TxAnalyzer {
+    pub fn load(network: &Network, connection: &Connection, account: u32) -> Result<Self> {
+        let ai = get_account_info(network, connection, account)?;
+        let addresses = ai.to_addresses(network);
+        let stxos = list_pending_stxos(connection, account)?;
+        let account_addresses = list_account_transparent_addresses(connection, account)?;
+        Ok(Self {
+            account,
+            ai,
+            addresses,
+            stxos,
+            account_addresses,
+        })
     }
 
-    let mut sins = vec![];
-    let mut souts = vec![];
-    if let Some(b) = data.sapling_bundle() {
-        if let Some(si) = ai.sapling.as_ref() {
-            let ivk = sapling_crypto::keys::PreparedIncomingViewingKey::new(&si.vk.fvk().vk.ivk());
-            let ovk = &si.vk.fvk().ovk;
-            for sin in b.shielded_spends() {
-                let spend = get_note_by_nf(connection, account, &sin.nullifier().0)?;
-                sins.push(ShieldedInput {
-                    note: spend,
-                    nf: sin.nullifier().0.clone(),
-                });
+    /// Trial decrypt the shielded outputs. Does not touch the database
+    /// and can run on the CPU pool
+    pub fn decrypt_outputs(
+        &self,
+        network: &Network,
+        height: u32,
+        data: &TransactionData<Authorized>,
+    ) -> (Vec<ShieldedOutput>, Vec<ShieldedOutput>) {
+        let zip212_enforcement = zip212_enforcement(network, height.into());
+        let mut souts = vec![];
+        if let Some(b) = data.sapling_bundle() {
+            if let Some(si) = self.ai.sapling.as_ref() {
+                let ivk =
+                    sapling_crypto::keys::PreparedIncomingViewingKey::new(&si.vk.fvk().vk.ivk());
+                let ovk = &si.vk.fvk().ovk;
+                for sout in b.shielded_outputs() {
+                    let domain = SaplingDomain::new(zip212_enforcement);
+                    let fnote = try_note_decryption(&domain, &ivk, sout)
+                        .map(|(n, p, m)| (n, p, m, true))
+                        .or_else(|| {
+                            try_output_recovery_with_ovk(
+                                &domain,
+                                ovk,
+                                sout,
+                                sout.cv(),
+                                sout.out_ciphertext(),
+                            )
+                            .map(|(n, p, m)| (n, p, m, false))
+                        })
+                        .map(|(n, p, m, incoming)| FullPlainNote {
+                            note: PlainNote {
+                                id: 0,
+                                address: p.to_bytes(),
+                                value: n.value().inner(),
+                                rcm: n.rcm().to_bytes(),
+                                rho: None,
+                            },
+                            memo: CompressedMemo(m.as_slice().to_vec()),
+                            incoming,
+                        });
+                    let cmx = sout.cmu().to_bytes();
+                    let output = ShieldedOutput { cmx, note: fnote };
+                    souts.push(output);
+                }
             }
-            for sout in b.shielded_outputs() {
-                let domain = SaplingDomain::new(zip212_enforcement);
-                let fnote = try_note_decryption(&domain, &ivk, sout)
-                    .map(|(n, p, m)| (n, p, m, true))
-                    .or_else(|| {
-                        try_output_recovery_with_ovk(
-                            &domain,
-                            ovk,
-                            sout,
-                            sout.cv(),
-                            sout.out_ciphertext(),
-                        )
-                        .map(|(n, p, m)| (n, p, m, false))
-                    })
-                    .map(|(n, p, m, incoming)| FullPlainNote {
-                        note: PlainNote {
-                            id: 0,
-                            address: p.to_bytes(),
-                            value: n.value().inner(),
-                            rcm: n.rcm().to_bytes(),
-                            rho: None,
-                        },
-                        memo: CompressedMemo(m.as_slice().to_vec()),
-                        incoming,
-                    });
-                let cmx = sout.cmu().to_bytes();
-                let output = ShieldedOutput { cmx, note: fnote };
-                souts.push(output);
+        }
+        let mut oouts = vec![];
+        if let Some(b) = data.orchard_bundle() {
+            if let Some(orchard) = self.ai.orchard.as_ref() {
+                let ivk = orchard::keys::PreparedIncomingViewingKey::new(
+                    &orchard.vk.to_ivk(Scope::External),
+                );
+                let ovk = &orchard.vk.to_ovk(Scope::External);
+                for a in b.actions() {
+                    let domain = OrchardDomain::for_rho(&a.rho());
+                    let fnote = try_note_decryption(&domain, &ivk, a)
+                        .map(|(n, p, m)| (n, p, m, true))
+                        .or_else(|| {
+                            try_output_recovery_with_ovk(
+                                &domain,
+                                ovk,
+                                a,
+                                a.cv_net(),
+                                &a.encrypted_note().out_ciphertext,
+                            )
+                            .map(|(n, p, m)| (n, p, m, false))
+                        })
+                        .map(|(n, addr, m, incoming)| FullPlainNote {
+                            note: PlainNote {
+                                id: 0,
+                                address: addr.to_raw_address_bytes(),
+                                value: n.value().inner(),
+                                rcm: n.rseed().as_bytes().clone(),
+                                rho: Some(a.nullifier().to_bytes()),
+                            },
+                            memo: CompressedMemo(m.to_vec()),
+                            incoming,
+                        });
+                    let cmx = a.cmx();
+                    let cmx = cmx.to_bytes();
+                    let output = ShieldedOutput { cmx, note: fnote };
+                    oouts.push(output);
+                }
             }
         }
+        (souts, oouts)
     }
-    let mut oins = vec![];
-    let mut oouts = vec![];
-    if let Some(b) = data.orchard_bundle() {
-        if let Some(orchard) = ai.orchard.as_ref() {
-            let ivk =
-                orchard::keys::PreparedIncomingViewingKey::new(&orchard.vk.to_ivk(Scope::External));
-            let ovk = &orchard.vk.to_ovk(Scope::External);
-            for a in b.actions() {
-                let spend = get_note_by_nf(connection, account, &a.nullifier().to_bytes())?;
-                oins.push(ShieldedInput {
-                    note: spend,
-                    nf: a.nullifier().to_bytes(),
+
+    /// Match the inputs and transparent outputs against the account
+    /// and compute the net value, given the decrypted outputs.
+    /// The coins of the transparent inputs are filled by `fill_txin_coins`
+    pub fn analyze_decrypted(
+        &self,
+        network: &Network,
+        connection: &Connection,
+        height: u32,
+        timestamp: u32,
+        txid: Hash,
+        data: &TransactionData<Authorized>,
+        souts: Vec<ShieldedOutput>,
+        oouts: Vec<ShieldedOutput>,
+    ) -> Result<TransactionDetails> {
+        let account = self.account;
+        let mut tins = vec![];
+        let mut touts = vec![];
+        if let Some(b) = data.transparent_bundle() {
+            for vin in b.vin.iter() {
+                // transparent inputs do not come with an address, so we have
+                // to lookup if we know them from our utxos
+                let prev_utxo = self.stxos.iter().find(|&utxo| {
+                    &utxo.txid == vin.prevout.hash() && utxo.vout == vin.prevout.n()
                 });
+                let note = prev_utxo.map(|n| TransparentNote {
+                    id: 0,
+                    address: n.address.clone(),
+                    value: n.value,
+                });
+                let tin = TransparentInput {
+                    out_point: OutPoint {
+                        txid: vin.prevout.hash().clone(),
+                        vout: vin.prevout.n(),
+                    },
+                    coin: TxOut2::default(),
+                    note,
+                };
+                tins.push(tin);
+            }
 
-                let domain = OrchardDomain::for_rho(&a.rho());
-                let fnote = try_note_decryption(&domain, &ivk, a)
-                    .map(|(n, p, m)| (n, p, m, true))
-                    .or_else(|| {
-                        try_output_recovery_with_ovk(
-                            &domain,
-                            ovk,
-                            a,
-                            a.cv_net(),
-                            &a.encrypted_note().out_ciphertext,
-                        )
-                        .map(|(n, p, m)| (n, p, m, false))
-                    })
-                    .map(|(n, addr, m, incoming)| FullPlainNote {
-                        note: PlainNote {
-                            id: 0,
-                            address: addr.to_raw_address_bytes(),
-                            value: n.value().inner(),
-                            rcm: n.rseed().as_bytes().clone(),
-                            rho: Some(a.nullifier().to_bytes()),
-                        },
-                        memo: CompressedMemo(m.to_vec()),
-                        incoming,
+            for (n, vout) in b.vout.iter().enumerate() {
+                let address = vout.recipient_address().map(|a| a.encode(network));
+                let note = address.as_ref().and_then(|a| {
+                    let note = self
+                        .account_addresses
+                        .iter()
+                        .find(|&ta| fb_unwrap!(ta.address) == a);
+                    note
+                });
+                let value = vout.value.into();
+                let note = note.map(|n| TransparentNote {
+                    id: 0,
+                    address: n.address.clone().unwrap(),
+                    value,
+                });
+                let tout = TransparentOutput {
+                    coin: TxOut2 {
+                        address,
+                        value,
+                        vout: n as u32,
+                    },
+                    note,
+                };
+                touts.push(tout);
+            }
+        }
+
+        let mut sins = vec![];
+        if let Some(b) = data.sapling_bundle() {
+            if self.ai.sapling.is_some() {
+                for sin in b.shielded_spends() {
+                    let spend = get_note_by_nf(connection, account, &sin.nullifier().0)?;
+                    sins.push(ShieldedInput {
+                        note: spend,
+                        nf: sin.nullifier().0.clone(),
+                    });
+                }
+            }
+        }
+        let mut oins = vec![];
+        if let Some(b) = data.orchard_bundle() {
+            if self.ai.orchard.is_some() {
+                for a in b.actions() {
+                    let spend = get_note_by_nf(connection, account, &a.nullifier().to_bytes())?;
+                    oins.push(ShieldedInput {
+                        note: spend,
+                        nf: a.nullifier().to_bytes(),
                     });
-                let cmx = a.cmx();
-                let cmx = cmx.to_bytes();
-                let output = ShieldedOutput { cmx, note: fnote };
-                oouts.push(output);
+                }
             }
         }
+
+        let tin_value = tins
+            .iter()
+            .map(|tin| {
+                tin.note
+                    .as_ref()
+                    .map(|n| n.value as i64)
+                    .unwrap_or_default()
+            })
+            .sum::<i64>();
+        let tout_value = touts
+            .iter()
+            .map(|tout| {
+                tout.note
+                    .as_ref()
+                    .map(|n| n.value as i64)
+                    .unwrap_or_default()
+            })
+            .sum::<i64>();
+        let sin_value = sins
+            .iter()
+            .map(|sin| {
+                sin.note
+                    .as_ref()
+                    .map(|n| n.value as i64)
+                    .unwrap_or_default()
+            })
+            .sum::<i64>();
+        let sout_value = souts
+            .iter()
+            .filter_map(|sout| {
+                sout.note
+                    .as_ref()
+                    .map(|n| if n.incoming { n.note.value as i64 } else { 0 })
+            })
+            .sum::<i64>();
+        let oin_value = oins
+            .iter()
+            .map(|sin| {
+                sin.note
+                    .as_ref()
+                    .map(|n| n.value as i64)
+                    .unwrap_or_default()
+            })
+            .sum::<i64>();
+        let oout_value = oouts
+            .iter()
+            .map(|sout| {
+                sout.note
+                    .as_ref()
+                    .map(|n| if n.incoming { n.note.value as i64 } else { 0 })
+                    .unwrap_or_default()
+            })
+            .sum::<i64>();
+        let value = (tout_value + sout_value + oout_value) - (tin_value + sin_value + oin_value);
+        tracing::info!(
+            "{tin_value} {tout_value} {sin_value} {sout_value} {oin_value} {oout_value} = {value}"
+        );
+        let tx = TransactionDetails {
+            height,
+            timestamp,
+            txid,
+            tins,
+            touts,
+            sins,
+            souts,
+            oins,
+            oouts,
+            value,
+        };
+        Ok(tx)
     }
+}
 
-    let ops = tins
+pub fn analyze_raw_transaction(
+    coin: &CoinDef,
+    network: &Network,
+    connection: &Connection,
+    account: u32,
+    height: u32,
+    timestamp: u32,
+    tx: ZTransaction,
+) -> Result<TransactionDetails> {
+    let analyzer = TxAnalyzer::load(network, connection, account)?;
+    let txid: Hash = tx.txid().as_ref().clone();
+    let data = tx.into_data();
+    let (souts, oouts) = analyzer.decrypt_outputs(network, height, &data);
+    let mut tx = analyzer.analyze_decrypted(
+        network, connection, height, timestamp, txid, &data, souts, oouts,
+    )?;
+    fill_txin_coins(coin, network, &mut tx)?;
+    Ok(tx)
+}
+
+/// Lookup the previous outputs spent by the transparent inputs
+pub fn fill_txin_coins(coin: &CoinDef, network: &Network, tx: &mut TransactionDetails) -> Result<()> {
+    let ops = tx
+        .tins
         .iter()
         .map(|tin| tin.out_point.clone())
         .collect::<Vec<_>>();
     let txouts = get_txin_coins(coin, *network, ops)?;
-    for (tin, txout) in tins.iter_mut().zip(txouts.into_iter()) {
+    for (tin, txout) in tx.tins.iter_mut().zip(txouts.into_iter()) {
         tin.coin = txout;
     }
-
-    let tin_value = tins
-        .iter()
-        .map(|tin| {
-            tin.note
-                .as_ref()
-                .map(|n| n.value as i64)
-                .unwrap_or_default()
-        })
-        .sum::<i64>();
-    let tout_value = touts
-        .iter()
-        .map(|tout| {
-            tout.note
-                .as_ref()
-                .map(|n| n.value as i64)
-                .unwrap_or_default()
-        })
-        .sum::<i64>();
-    let sin_value = sins
-        .iter()
-        .map(|sin| {
-            sin.note
-                .as_ref()
-                .map(|n| n.value as i64)
-                .unwrap_or_default()
-        })
-        .sum::<i64>();
-    let sout_value = souts
-        .iter()
-        .filter_map(|sout| {
-            sout.note
-                .as_ref()
-                .map(|n| if n.incoming { n.note.value as i64 } else { 0 })
-        })
-        .sum::<i64>();
-    let oin_value = oins
-        .iter()
-        .map(|sin| {
-            sin.note
-                .as_ref()
-                .map(|n| n.value as i64)
-                .unwrap_or_default()
-        })
-        .sum::<i64>();
-    let oout_value = oouts
-        .iter()
-        .map(|sout| {
-            sout.note
-                .as_ref()
-                .map(|n| if n.incoming { n.note.value as i64 } else { 0 })
-                .unwrap_or_default()
-        })
-        .sum::<i64>();
-    let value = (tout_value + sout_value + oout_value) - (tin_value + sin_value + oin_value);
-    tracing::info!(
-        "{tin_value} {tout_value} {sin_value} {sout_value} {oin_value} {oout_value} = {value}"
-    );
-    let tx = TransactionDetails {
-        height,
-        timestamp,
-        txid,
-        tins,
-        touts,
-        sins,
-        souts,
-        oins,
-        oouts,
-        value,
-    };
-    Ok(tx)
+    Ok(())
 }
 
+// Transactions fetched, analyzed and stored per round
+const TX_DETAILS_BATCH: usize = 200;
+
 #[c_export]
 pub async fn retrieve_tx_details(
     coin: &CoinDef,
@@ -380,27 +465,108 @@ pub async fn retrieve_tx_details(
 ) -> Result<()> {
     let connection = Mutex::new(connection);
     let txids = list_new_txids(&connection.lock())?;
-    let mut client = coin.connect_lwd()?;
-    for (id_tx, account, timestamp, txid) in txids {
-        let ai = get_account_info(network, &connection.lock(), account)?;
-        let account_addrs = ai.to_addresses(network);
-        let rtx = get_tx(&connection.lock(), id_tx)?;
-        let (height, tx) = get_transaction(network, &mut client, &txid).await?;
-        let txd = analyze_raw_transaction(
-            coin,
-            network,
-            &connection.lock(),
-            account,
-            height,
-            timestamp,
-            tx,
-        )?;
-        let tx_bin = bincode::serialize(&txd)?;
-        store_tx_details(&connection.lock(), id_tx, account, height, &txid, &tx_bin)?;
-        let (tx_address, tx_memo) =
-            get_tx_primary_address_memo(network, &account_addrs, &rtx, &txd)?;
-        update_tx_primary_address_memo(network, &connection.lock(), id_tx, tx_address, tx_memo)?;
-        decode_tx_details(network, &connection.lock(), account, id_tx, &txd)?;
+    let client = coin.connect_lwd()?;
+    let semaphore = Arc::new(Semaphore::new(coin.download_concurrency()));
+    let mut analyzers = HashMap::<u32, TxAnalyzer>::new();
+    for batch in txids.chunks(TX_DETAILS_BATCH) {
+        let handles = batch
+            .iter()
+            .map(|(_, _, _, txid)| {
+                let network = *network;
+                let mut client = client.clone();
+                let semaphore = semaphore.clone();
+                let txid = *txid;
+                tokio::spawn(async move {
+                    let _permit = semaphore.acquire_owned().await?;
+                    get_transaction(&network, &mut client, &txid).await
+                })
+            })
+            .collect::<Vec<_>>();
+        let mut txs = vec![];
+        for handle in handles {
+            let (height, tx) = handle.await??;
+            txs.push((height, tx.into_data()));
+        }
+
+        // the coins of the transparent inputs, fetched concurrently
+        // before the db transaction
+        let mut prevouts = HashMap::<Hash, Vec<u32>>::new();
+        for (_, data) in txs.iter() {
+            if let Some(b) = data.transparent_bundle() {
+                for vin in b.vin.iter() {
+                    let vouts = prevouts.entry(vin.prevout.hash().clone()).or_default();
+                    if !vouts.contains(&vin.prevout.n()) {
+                        vouts.push(vin.prevout.n());
+                    }
+                }
+            }
+        }
+        let handles = prevouts
+            .into_iter()
+            .map(|(txid, vouts)| {
+                let network = *network;
+                let mut client = client.clone();
+                let semaphore = semaphore.clone();
+                tokio::spawn(async move {
+                    let _permit = semaphore.acquire_owned().await?;
+                    let txouts = get_tx_outputs(&network, &mut client, &txid, &vouts).await?;
+                    Ok::<_, anyhow::Error>((txid, vouts, txouts))
+                })
+            })
+            .collect::<Vec<_>>();
+        let mut coins = HashMap::<(Hash, u32), TxOut2>::new();
+        for handle in handles {
+            let (txid, vouts, txouts) = handle.await??;
+            for (vout, txout) in vouts.into_iter().zip(txouts.into_iter()) {
+                coins.insert((txid, vout), txout);
+            }
+        }
+
+        {
+            let connection = connection.lock();
+            for (_, account, _, _) in batch.iter() {
+                if !analyzers.contains_key(account) {
+                    let analyzer = TxAnalyzer::load(network, &connection, *account)?;
+                    analyzers.insert(*account, analyzer);
+                }
+            }
+        }
+
+        // trial decryption is the expensive part
+        let outputs = tokio::task::block_in_place(|| {
+            batch
+                .par_iter()
+                .zip(txs.par_iter())
+                .map(|((_, account, _, _), (height, data))| {
+                    analyzers[account].decrypt_outputs(network, *height, data)
+                })
+                .collect::<Vec<_>>()
+        });
+
+        let connection = connection.lock();
+        let db_tx = connection.unchecked_transaction()?;
+        for (((id_tx, account, timestamp, txid), (height, data)), (souts, oouts)) in
+            batch.iter().zip(txs.iter()).zip(outputs.into_iter())
+        {
+            let analyzer = &analyzers[account];
+            let rtx = get_tx(&db_tx, *id_tx)?;
+            let mut txd = analyzer.analyze_decrypted(
+                network, &db_tx, *height, *timestamp, *txid, data, souts, oouts,
+            )?;
+            for tin in txd.tins.iter_mut() {
+                let op = &tin.out_point;
+                if let Some(txout) = coins.get(&(op.txid, op.vout)) {
+                    tin.coin = txout.clone();
+                }
+            }
+            let tx_bin = bincode::serialize(&txd)?;
+            store_tx_details(&db_tx, *id_tx, *account, *height, txid, &tx_bin)?;
+            let (tx_address, tx_memo) =
+                get_tx_primary_address_memo(network, &analyzer.addresses, &rtx, &txd)?;
+            update_tx_primary_address_memo(network, &db_tx, *id_tx, tx_address, tx_memo)?;
+            decode_tx_details_with(network, &db_tx, &analyzer.ai, *account, *id_tx, &txd)?;
+        }
+        db_tx.commit()?;
     }
     Ok(())
 }
@@ -412,8 +578,19 @@ pub fn decode_tx_details(
     id_tx: u32,
     tx: &TransactionDetails,
 ) -> Result<()> {
-    let mut authenticated = false;
     let ai = get_account_info(network, connection, account)?;
+    decode_tx_details_with(network, connection, &ai, account, id_tx, tx)
+}
+
+fn decode_tx_details_with(
+    network: &Network,
+    connection: &Connection,
+    ai: &AccountInfo,
+    account: u32,
+    id_tx: u32,
+    tx: &TransactionDetails,
+) -> Result<()> {
+    let mut authenticated = false;
     let account_address = ai.to_address(network, PoolMask(7)).unwrap();
     let mut spend_address = None;
     if let Some(taddr) = ai.transparent.as_ref().map(|ti| ti.addr) {
@@ -104,23 +104,31 @@ macro_rules! fb_unwrap {
 }
 
 #[macro_export]
-macro_rules! fb_vec_to_bytes {
-    ($vs: ident, $T: ident) => {{
-        let mut builder = FlatBufferBuilder::new();
+macro_rules! fb_vec_pack {
+    ($builder: ident, $vs: ident, $T: ident) => {{
         let mut os = vec![];
         for v in $vs.iter() {
-            let o = v.pack(&mut builder);
-            builder.push(o);
+            let o = v.pack($builder);
+            $builder.push(o);
             os.push(o);
         }
-        builder.start_vector::<WIPOffset<$T>>($vs.len());
+        $builder.start_vector::<flatbuffers::WIPOffset<$T>>($vs.len());
         for o in os {
-            builder.push(o);
+            $builder.push(o);
         }
-        let o = builder.end_vector::<WIPOffset<$T>>($vs.len());
-        builder.finish(o, None);
-        let data = builder.finished_data();
-        Ok::<_, anyhow::Error>(data.to_vec())
+        let o = $builder.end_vector::<flatbuffers::WIPOffset<$T>>($vs.len());
+        $builder.finish(o, None);
+    }};
+}
+
+#[macro_export]
+macro_rules! fb_vec_to_bytes {
+    ($vs: ident, $T: ident) => {{
+        $crate::ffi::with_fb_builder(|builder| {
+            $crate::fb_vec_pack!(builder, $vs, $T);
+            let data = builder.finished_data();
+            Ok::<_, anyhow::Error>(data.to_vec())
+        })
     }};
 }
 
@@ -155,6 +163,18 @@ impl ConfigT {
         if other.regtest {
             self.regtest = other.regtest;
         }
+        if other.download_concurrency > 0 {
+            self.download_concurrency = other.download_concurrency;
+        }
+        if other.memory_limit > 0 {
+            self.memory_limit = other.memory_limit;
+        }
+        if other.spam_filter_threshold > 0 {
+            self.spam_filter_threshold = other.spam_filter_threshold;
+        }
+        if other.spam_refetch {
+            self.spam_refetch = other.spam_refetch;
+        }
     }
 }
 
@@ -1,24 +1,72 @@
+use std::{
+    collections::HashMap,
+    sync::{
+        atomic::{AtomicU32, Ordering},
+        Arc,
+    },
+};
+
 use anyhow::Result;
-use raptorq::{Decoder, Encoder, EncodingPacket, ObjectTransmissionInformation};
+use lazy_static::lazy_static;
+use parking_lot::Mutex;
+use raptorq::{
+    Decoder, Encoder, EncodingPacket, ObjectTransmissionInformation, SourceBlockEncoder,
+};
+use rayon::prelude::*;
 
-use crate::data::fb::{PacketT, Packets, PacketsT};
+use crate::data::fb::{Packet, PacketT, Packets, PacketsT};
 use crate::fb_unwrap;
 use warp_macros::c_export;
 
 const QR_DATA_SIZE: u16 = 256;
 
+fn to_packet(p: &EncodingPacket, length: usize) -> PacketT {
+    PacketT {
+        data: Some(p.serialize()),
+        len: length as u32,
+    }
+}
+
+fn new_encoder(data: &[u8]) -> Encoder {
+    let config = ObjectTransmissionInformation::with_defaults(data.len() as u64, QR_DATA_SIZE);
+    Encoder::new(data, config)
+}
+
+// Packets come from scanned frames, check them before raptorq
+// does, it panics on a packet of another shape
+fn decode_packet(
+    data: &[u8],
+    config: &ObjectTransmissionInformation,
+) -> Result<EncodingPacket> {
+    // payload id (source block, symbol id) then a full symbol
+    if data.len() != 4 + QR_DATA_SIZE as usize {
+        anyhow::bail!("Invalid packet size {}", data.len());
+    }
+    let packet = EncodingPacket::deserialize(data);
+    if packet.payload_id().source_block_number() as u32 >= config.source_blocks() as u32 {
+        anyhow::bail!("Invalid packet source block");
+    }
+    Ok(packet)
+}
+
 #[c_export]
 pub fn split(data: &[u8], threshold: u32) -> Result<Vec<PacketT>> {
     let length = data.len();
-    let config = ObjectTransmissionInformation::with_defaults(length as u64, QR_DATA_SIZE);
-    let encoder = Encoder::new(data, config);
-    let packets = encoder.get_encoded_packets(threshold);
+    let encoder = new_encoder(data);
+    // same order as Encoder::get_encoded_packets, block by block
+    let packets = encoder
+        .get_block_encoders()
+        .par_iter()
+        .map(|block| {
+            let mut packets = block.source_packets();
+            packets.extend(block.repair_packets(0, threshold));
+            packets
+        })
+        .collect::<Vec<_>>();
     let packets = packets
         .iter()
-        .map(|p| PacketT {
-            data: Some(p.serialize()),
-            len: length as u32,
-        })
+        .flatten()
+        .map(|p| to_packet(p, length))
         .collect::<Vec<_>>();
     Ok(packets)
 }
@@ -31,11 +79,14 @@ pub fn merge(parts: &PacketsT) -> Result<Vec<u8>> {
     }
     let length = packets.first().unwrap().len;
     tracing::info!("{length}");
+    if length == 0 {
+        anyhow::bail!("Invalid packet length");
+    }
     let config = ObjectTransmissionInformation::with_defaults(length as u64, QR_DATA_SIZE);
     let packets = fb_unwrap!(parts.packets)
         .iter()
-        .map(|p| EncodingPacket::deserialize(fb_unwrap!(p.data)))
-        .collect::<Vec<_>>();
+        .map(|p| decode_packet(fb_unwrap!(p.data), &config))
+        .collect::<Result<Vec<_>>>()?;
     let mut decoder = Decoder::new(config);
     for packet in packets {
         decoder.decode(packet);
@@ -43,3 +94,196 @@ pub fn merge(parts: &PacketsT) -> Result<Vec<u8>> {
     let data = decoder.get_result();
     Ok(data.unwrap_or_default())
 }
+
+// Sessions for animated QR codes
+//
+// A split session keeps the encoder of the data and hands out packets
+// on demand: the source packets first, then repair packets generated
+// as they are requested. The packets cycle over the source blocks so
+// that any run of frames covers all of them.
+// A merge session takes the scanned packets one at a time and
+// completes as soon as the decoder has enough of them
+
+struct SplitSession {
+    length: usize,
+    encoder: Encoder,
+    // packets handed out per source block
+    sent: Vec<u32>,
+    next_block: usize,
+}
+
+struct MergeSession {
+    decoder: Option<Decoder>,
+    config: Option<ObjectTransmissionInformation>,
+    length: u32,
+    packets: u32,
+    result: Option<Vec<u8>>,
+}
+
+// Every session has its own lock, the registries are only locked
+// to find a session, so one session encoding its repair packets
+// does not block the others
+lazy_static! {
+    static ref SPLIT_SESSIONS: Mutex<HashMap<u32, Arc<Mutex<SplitSession>>>> =
+        Mutex::new(HashMap::new());
+    static ref MERGE_SESSIONS: Mutex<HashMap<u32, Arc<Mutex<MergeSession>>>> =
+        Mutex::new(HashMap::new());
+}
+
+fn get_session<S>(
+    sessions: &Mutex<HashMap<u32, Arc<Mutex<S>>>>,
+    id: u32,
+) -> Option<Arc<Mutex<S>>> {
+    sessions.lock().get(&id).cloned()
+}
+
+static NEXT_SESSION: AtomicU32 = AtomicU32::new(1);
+
+// The `count` next packets of a block, source packets first
+fn block_packets(block: &SourceBlockEncoder, sent: u32, count: u32) -> Vec<EncodingPacket> {
+    let source = block.source_packets();
+    let n_source = source.len() as u32;
+    let mut packets = source
+        .into_iter()
+        .skip(sent as usize)
+        .take(count as usize)
+        .collect::<Vec<_>>();
+    let repairs = count - packets.len() as u32;
+    if repairs > 0 {
+        let first_repair = sent.saturating_sub(n_source);
+        packets.extend(block.repair_packets(first_repair, repairs));
+    }
+    packets
+}
+
+/// Start splitting `data` and return the session id
+#[c_export]
+pub fn new_split_session(data: &[u8]) -> Result<u32> {
+    let encoder = new_encoder(data);
+    let blocks = encoder.get_block_encoders().len();
+    let id = NEXT_SESSION.fetch_add(1, Ordering::Relaxed);
+    SPLIT_SESSIONS.lock().insert(
+        id,
+        Arc::new(Mutex::new(SplitSession {
+            length: data.len(),
+            encoder,
+            sent: vec![0; blocks],
+            next_block: 0,
+        })),
+    );
+    Ok(id)
+}
+
+/// The next `count` packets of a split session
+#[c_export]
+pub fn next_split_packets(session: u32, count: u32) -> Result<Vec<PacketT>> {
+    let s = get_session(&SPLIT_SESSIONS, session)
+        .ok_or(anyhow::anyhow!("Unknown split session {session}"))?;
+    let mut s = s.lock();
+    let s = &mut *s;
+    let blocks = s.sent.len();
+    if blocks == 0 {
+        return Ok(vec![]);
+    }
+    let mut wanted = vec![0u32; blocks];
+    let mut order = Vec::with_capacity(count as usize);
+    for _ in 0..count {
+        wanted[s.next_block] += 1;
+        order.push(s.next_block);
+        s.next_block = (s.next_block + 1) % blocks;
+    }
+    // repair symbols are the expensive part, generate them
+    // for the blocks in parallel
+    let mut packets = s
+        .encoder
+        .get_block_encoders()
+        .par_iter()
+        .zip(s.sent.par_iter())
+        .zip(wanted.par_iter())
+        .map(|((block, &sent), &count)| block_packets(block, sent, count).into_iter())
+        .collect::<Vec<_>>();
+    for (sent, count) in s.sent.iter_mut().zip(wanted.iter()) {
+        *sent += count;
+    }
+    let length = s.length;
+    let packets = order
+        .into_iter()
+        .map(|b| to_packet(&packets[b].next().unwrap(), length))
+        .collect::<Vec<_>>();
+    Ok(packets)
+}
+
+#[c_export]
+pub fn close_split_session(session: u32) -> Result<()> {
+    SPLIT_SESSIONS.lock().remove(&session);
+    Ok(())
+}
+
+#[c_export]
+pub fn new_merge_session() -> Result<u32> {
+    let id = NEXT_SESSION.fetch_add(1, Ordering::Relaxed);
+    MERGE_SESSIONS.lock().insert(
+        id,
+        Arc::new(Mutex::new(MergeSession {
+            decoder: None,
+            config: None,
+            length: 0,
+            packets: 0,
+            result: None,
+        })),
+    );
+    Ok(id)
+}
+
+/// Add a scanned packet, returns true once the data is complete.
+/// Duplicate packets and packets after completion are ignored
+#[c_export]
+pub fn add_merge_packet(session: u32, packet: &PacketT) -> Result<bool> {
+    let s = get_session(&MERGE_SESSIONS, session)
+        .ok_or(anyhow::anyhow!("Unknown merge session {session}"))?;
+    let mut s = s.lock();
+    let s = &mut *s;
+    if s.result.is_some() {
+        return Ok(true);
+    }
+    if s.config.is_none() {
+        if packet.len == 0 {
+            anyhow::bail!("Invalid packet length");
+        }
+        let config = ObjectTransmissionInformation::with_defaults(packet.len as u64, QR_DATA_SIZE);
+        s.length = packet.len;
+        s.config = Some(config);
+    } else if packet.len != s.length {
+        anyhow::bail!("Packet of another transfer");
+    }
+    let config = s.config.as_ref().unwrap();
+    let packet = decode_packet(fb_unwrap!(packet.data), config)?;
+    let decoder = s.decoder.get_or_insert_with(|| Decoder::new(config.clone()));
+    s.packets += 1;
+    if let Some(data) = decoder.decode(packet) {
+        tracing::info!("Merged {} bytes from {} packets", data.len(), s.packets);
+        s.result = Some(data);
+        // the decoder state is no longer needed
+        s.decoder = None;
+    }
+    Ok(s.result.is_some())
+}
+
+/// Take the data of a complete merge session and release it
+#[c_export]
+pub fn take_merge_result(session: u32) -> Result<Vec<u8>> {
+    let s = get_session(&MERGE_SESSIONS, session)
+        .ok_or(anyhow::anyhow!("Unknown merge session {session}"))?;
+    let result = s.lock().result.take();
+    let Some(result) = result else {
+        anyhow::bail!("Merge session {session} is not complete");
+    };
+    MERGE_SESSIONS.lock().remove(&session);
+    Ok(result)
+}
+
+#[c_export]
+pub fn close_merge_session(session: u32) -> Result<()> {
+    MERGE_SESSIONS.lock().remove(&session);
+    Ok(())
+}
@@ -1,15 +1,17 @@
 use anyhow::Result;
+use flatbuffers::ForwardsUOffset;
 use rand::rngs::OsRng;
+use rayon::prelude::*;
 use rusqlite::Connection;
 use zcash_protocol::memo::{Memo, MemoBytes};
 
 use crate::{
-    account::contacts::commit_unsaved_contacts, coin::CoinDef, data::fb::{
+    account::contacts::commit_unsaved_contacts, coin::{CoinDef, COINS}, data::fb::{
         PaymentRequest, PaymentRequestT, RecipientT, TransactionBytes, TransactionBytesT,
         TransactionSummary, TransactionSummaryT,
     }, db::{
         account::get_account_info, chain::snap_to_checkpoint, notes::mark_notes_unconfirmed_spent,
-    }, fb_unwrap, lwd::{broadcast, get_last_height, get_tree_state}, network::Network, pay::{make_payment, UnsignedTransaction}, Client, PooledSQLConnection, EXPIRATION_HEIGHT_DELTA
+    }, fb_unwrap, fb_vec_to_bytes, ffi::{map_result_bytes, CParam, CResult}, lwd::{broadcast, get_last_height, get_tree_state}, network::Network, pay::{make_batch_payment, make_payment, UnsignedTransaction}, Client, PooledSQLConnection, EXPIRATION_HEIGHT_DELTA
 };
 
 use warp_macros::c_export;
@@ -41,6 +43,26 @@ pub async fn prepare_payment_inner(
     tracing::info!("{:?}", payment);
     let cp_height = snap_to_checkpoint(&connection, payment.height)?;
     let (s_tree, o_tree) = get_tree_state(client, cp_height).await?;
+    let payment = normalize_payment(payment, cp_height.0)?;
+    let redirect = if redirect.is_empty() {
+        None
+    } else {
+        Some(redirect.to_string())
+    };
+    let unsigned_tx = make_payment(
+        network,
+        &connection,
+        account,
+        &payment,
+        &s_tree,
+        &o_tree,
+        redirect,
+    )?;
+    let summary = unsigned_tx.to_summary()?;
+    Ok(summary)
+}
+
+fn normalize_payment(payment: &PaymentRequestT, height: u32) -> Result<PaymentRequestT> {
     let recipients = payment
         .recipients
         .as_ref()
@@ -53,25 +75,41 @@ pub async fn prepare_payment_inner(
         src_pools: payment.src_pools,
         sender_pay_fees: payment.sender_pay_fees,
         use_change: payment.use_change,
-        height: cp_height.0,
+        height,
         expiration: payment.expiration,
     };
-    let redirect = if redirect.is_empty() {
-        None
-    } else {
-        Some(redirect.to_string())
-    };
-    let unsigned_tx = make_payment(
-        network,
+    Ok(payment)
+}
+
+/// Like prepare_payment, for payouts to many recipients:
+/// returns one transaction per group of `max_recipients`
+#[c_export]
+pub async fn prepare_batch_payment(
+    coin: &CoinDef,
+    account: u32,
+    payment: &PaymentRequestT,
+    max_recipients: u32,
+) -> Result<Vec<TransactionSummaryT>> {
+    let connection = coin.connection()?;
+    let mut client = coin.connect_lwd()?;
+    let cp_height = snap_to_checkpoint(&connection, payment.height)?;
+    let (s_tree, o_tree) = get_tree_state(&mut client, cp_height).await?;
+    let payment = normalize_payment(payment, cp_height.0)?;
+    let unsigned_txs = make_batch_payment(
+        &coin.network,
         &connection,
         account,
         &payment,
+        max_recipients as usize,
         &s_tree,
         &o_tree,
-        redirect,
+        None,
     )?;
-    let summary = unsigned_tx.to_summary()?;
-    Ok(summary)
+    let summaries = unsigned_txs
+        .iter()
+        .map(|utx| utx.to_summary())
+        .collect::<Result<Vec<_>>>()?;
+    Ok(summaries)
 }
 
 #[c_export]
@@ -131,6 +169,46 @@ pub fn sign(
     Ok(txb)
 }
 
+/// Sign several transactions, e.g. the result of prepare_batch_payment,
+/// in parallel. Each one gets its own connection from the pool
+pub fn sign_batch(
+    coin: &CoinDef,
+    summaries: &[TransactionSummaryT],
+    expiration_height: u32,
+) -> Result<Vec<TransactionBytesT>> {
+    summaries
+        .par_iter()
+        .map(|summary| {
+            let connection = coin.connection()?;
+            sign(&coin.network, &connection, summary, expiration_height)
+        })
+        .collect()
+}
+
+/// `summaries` is a vector of TransactionSummary, as returned by
+/// c_prepare_batch_payment. Returns a vector of TransactionBytes
+#[no_mangle]
+pub extern "C" fn c_sign_batch(
+    coin: u8,
+    summaries: CParam,
+    expiration_height: u32,
+) -> CResult<*const u8> {
+    let res = || {
+        let summaries =
+            unsafe { std::slice::from_raw_parts(summaries.value, summaries.len as usize) };
+        let summaries =
+            flatbuffers::root::<flatbuffers::Vector<ForwardsUOffset<TransactionSummary>>>(
+                summaries,
+            )?;
+        let summaries = summaries.iter().map(|s| s.unpack()).collect::<Vec<_>>();
+        // sign on a snapshot, the proofs take a while
+        let coin = COINS[coin as usize].lock().clone();
+        let txbs = sign_batch(&coin, &summaries, expiration_height)?;
+        fb_vec_to_bytes!(txbs, TransactionBytes)
+    };
+    map_result_bytes(res())
+}
+
 #[c_export]
 pub async fn tx_broadcast(
     connection: &Connection,
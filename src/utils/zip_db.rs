@@ -1,13 +1,15 @@
 use std::{
     fs::{self, File},
-    io::{Cursor, Read as _, Write as _},
-    path::PathBuf,
+    io::{BufReader, BufWriter, Read, Write as _},
+    path::{Path, PathBuf},
     str::FromStr as _,
+    sync::atomic::{AtomicU64, Ordering},
     time,
 };
 
 use age::{secrecy::ExposeSecret as _, Decryptor};
 use anyhow::Result;
+use rayon::prelude::*;
 use zip::write::FileOptions;
 
 use crate::data::fb::{AGEKeysT, ZipDbConfig, ZipDbConfigT};
@@ -16,6 +18,67 @@ use rusqlite::{backup::Backup, Connection};
 
 use warp_macros::c_export;
 
+// Bytes processed / expected by the current encrypt or decrypt
+static PROGRESS_DONE: AtomicU64 = AtomicU64::new(0);
+static PROGRESS_TOTAL: AtomicU64 = AtomicU64::new(0);
+
+fn reset_progress(total: u64) {
+    PROGRESS_DONE.store(0, Ordering::Relaxed);
+    PROGRESS_TOTAL.store(total, Ordering::Relaxed);
+}
+
+struct ProgressReader<R> {
+    inner: R,
+}
+
+impl<R: Read> Read for ProgressReader<R> {
+    fn read(&mut self, buf: &mut [u8]) -> std::io::Result<usize> {
+        let n = self.inner.read(buf)?;
+        PROGRESS_DONE.fetch_add(n as u64, Ordering::Relaxed);
+        Ok(n)
+    }
+}
+
+/// Progress in percent of the running encrypt/decrypt_zip_database_files
+#[c_export]
+pub fn get_zip_database_progress() -> Result<u32> {
+    let total = PROGRESS_TOTAL.load(Ordering::Relaxed);
+    let done = PROGRESS_DONE.load(Ordering::Relaxed);
+    let p = if total == 0 {
+        0
+    } else {
+        done.min(total) * 100 / total
+    };
+    Ok(p as u32)
+}
+
+// Backup the database and compress it into a single file archive
+// in the tmp directory. Returns the path of the archive
+fn backup_and_compress(directory: &Path, zip_directory: &Path, db_name: &str) -> Result<PathBuf> {
+    let backup_path = zip_directory.join(db_name);
+    {
+        let p = directory.join(db_name);
+        tracing::info!("Backup {:?}...", p);
+        let src = Connection::open(p)?;
+        let mut dst = Connection::open(&backup_path)?;
+        let backup = Backup::new(&src, &mut dst)?;
+        backup.run_to_completion(100, time::Duration::from_millis(10), None)?;
+    }
+    tracing::info!("Zipping {db_name}...");
+    let zip_path = zip_directory.join(format!("{db_name}.zip"));
+    {
+        let mut zip_writer = zip::ZipWriter::new(BufWriter::new(File::create(&zip_path)?));
+        zip_writer.start_file(db_name, FileOptions::<()>::default())?;
+        let mut f = ProgressReader {
+            inner: BufReader::new(File::open(&backup_path)?),
+        };
+        std::io::copy(&mut f, &mut zip_writer)?;
+        zip_writer.finish()?.flush()?;
+    }
+    fs::remove_file(&backup_path)?;
+    Ok(zip_path)
+}
+
 #[c_export]
 pub fn encrypt_zip_database_files(zip_db_config: &ZipDbConfigT) -> Result<()> {
     let ZipDbConfigT {
@@ -30,47 +93,67 @@ pub fn encrypt_zip_database_files(zip_db_config: &ZipDbConfigT) -> Result<()> {
     zip_directory.push(".tmp");
     let _ = fs::create_dir(zip_directory.clone());
 
-    let zip_data = vec![];
-    let buff = Cursor::new(zip_data);
-    let mut zip_writer = zip::ZipWriter::new(buff);
-
     let files = fb_unwrap!(file_list);
-    for db_name in files.iter() {
-        {
-            let p = directory.join(db_name);
-            tracing::info!("Backup {:?}...", p);
-            let src = Connection::open(p)?;
-            let mut dst = Connection::open(zip_directory.join(&db_name))?;
-            let backup = Backup::new(&src, &mut dst)?;
-            backup.run_to_completion(100, time::Duration::from_millis(10), None)?;
-        }
-        tracing::info!("Zipping {db_name}...");
-        {
-            zip_writer.start_file(&db_name, FileOptions::<()>::default())?;
-            let mut f = File::open(zip_directory.join(db_name))?;
-            let mut buffer = Vec::new();
-            f.read_to_end(&mut buffer)?;
-            zip_writer.write_all(&*buffer)?;
-        }
-    }
-    let buffer = zip_writer.finish()?;
-    let zip_data = buffer.into_inner();
-
     let target_path = fb_unwrap!(target_path);
     let public_key = fb_unwrap!(public_key);
-    tracing::info!("Encrypting {target_path}...");
     let public_key = age::x25519::Recipient::from_str(public_key).map_err(anyhow::Error::msg)?;
 
-    let mut encrypted_file = File::create(target_path)?;
-    {
-        let encryptor = age::Encryptor::with_recipients(vec![Box::new(public_key)]).unwrap();
-        let mut writer = encryptor.wrap_output(&mut encrypted_file)?;
-        writer.write_all(&*zip_data)?;
-        writer.finish()?;
+    let total = files
+        .iter()
+        .map(|db_name| fs::metadata(directory.join(db_name)).map(|m| m.len()).unwrap_or(0))
+        .sum::<u64>();
+    // the size of the archives is not known yet, assume they
+    // are as large as the databases until they are written
+    reset_progress(2 * total);
+
+    // Databases are compressed in parallel to disk
+    let zip_paths = files
+        .par_iter()
+        .map(|db_name| backup_and_compress(&directory, &zip_directory, db_name))
+        .collect::<Result<Vec<_>>>();
+    let r = zip_paths.and_then(|zip_paths| {
+        let compressed = zip_paths
+            .iter()
+            .map(|p| fs::metadata(p).map(|m| m.len()).unwrap_or(0))
+            .sum::<u64>();
+        PROGRESS_TOTAL.store(total + compressed, Ordering::Relaxed);
+        encrypt_archives(&zip_paths, target_path, public_key)
+    });
+    remove_tmp_files(&zip_directory, files);
+    r
+}
+
+// Stream the archives through the encryptor without recompression
+fn encrypt_archives(
+    zip_paths: &[PathBuf],
+    target_path: &str,
+    public_key: age::x25519::Recipient,
+) -> Result<()> {
+    tracing::info!("Encrypting {target_path}...");
+    let encrypted_file = BufWriter::new(File::create(target_path)?);
+    let encryptor = age::Encryptor::with_recipients(vec![Box::new(public_key)]).unwrap();
+    let writer = encryptor.wrap_output(encrypted_file)?;
+    let mut zip_writer = zip::ZipWriter::new_stream(writer);
+    for zip_path in zip_paths.iter() {
+        let f = File::open(zip_path)?;
+        let len = f.metadata()?.len();
+        let mut archive = zip::ZipArchive::new(BufReader::new(f))?;
+        zip_writer.raw_copy_file(archive.by_index_raw(0)?)?;
+        PROGRESS_DONE.fetch_add(len, Ordering::Relaxed);
     }
+    let writer = zip_writer.finish()?.into_inner();
+    writer.finish()?.flush()?;
     Ok(())
 }
 
+// Backups and archives left in the tmp directory, also after a failure
+fn remove_tmp_files(zip_directory: &Path, files: &[String]) {
+    for db_name in files.iter() {
+        let _ = fs::remove_file(zip_directory.join(db_name));
+        let _ = fs::remove_file(zip_directory.join(format!("{db_name}.zip")));
+    }
+}
+
 #[c_export]
 pub fn decrypt_zip_database_files(
     file_path: &str,
@@ -78,36 +161,34 @@ pub fn decrypt_zip_database_files(
     secret_key: &str,
 ) -> Result<()> {
     let key = age::x25519::Identity::from_str(secret_key).map_err(anyhow::Error::msg)?;
-    let mut encrypted_data = Vec::new();
-    {
-        let mut f = File::open(file_path)?;
-        f.read_to_end(&mut encrypted_data)?;
-    }
-    let mut zip_data = vec![];
-    {
-        let Decryptor::Recipients(decryptor) =
-            Decryptor::new(&*encrypted_data).map_err(anyhow::Error::msg)?
-        else {
-            unreachable!()
-        };
+    let f = File::open(file_path)?;
+    reset_progress(f.metadata()?.len());
+    let encrypted_data = ProgressReader {
+        inner: BufReader::new(f),
+    };
+    let Decryptor::Recipients(decryptor) =
+        Decryptor::new(encrypted_data).map_err(anyhow::Error::msg)?
+    else {
+        anyhow::bail!("Database backup is not encrypted with a key");
+    };
 
-        let key = &key as &dyn age::Identity;
-        let mut reader = decryptor
-            .decrypt(std::iter::once(key))
-            .map_err(anyhow::Error::msg)?;
-        reader.read_to_end(&mut zip_data)?;
-    }
+    let key = &key as &dyn age::Identity;
+    let mut reader = decryptor
+        .decrypt(std::iter::once(key))
+        .map_err(anyhow::Error::msg)?;
 
+    // The archive is read sequentially from the decrypted stream
     let target_directory = PathBuf::from(target_directory);
-    let zip_data = Cursor::new(&*zip_data);
-    let mut zip_reader = zip::ZipArchive::new(zip_data)?;
-    let file_names: Vec<_> = zip_reader.file_names().map(|s| s.to_string()).collect();
-    for file_name in file_names {
-        let mut zip_file = zip_reader.by_name(&file_name)?;
-        let out_path = target_directory.join(file_name);
+    while let Some(mut zip_file) = zip::read::read_zipfile_from_stream(&mut reader)? {
+        // an entry must not write outside of the target directory
+        let name = zip_file
+            .enclosed_name()
+            .ok_or(anyhow::anyhow!("Invalid file name {} in backup", zip_file.name()))?;
+        let out_path = target_directory.join(name);
         tracing::info!("Unpack to {}", out_path.display());
-        let mut out_file = File::create(&out_path)?;
+        let mut out_file = BufWriter::new(File::create(&out_path)?);
         std::io::copy(&mut zip_file, &mut out_file)?;
+        out_file.flush()?;
     }
     Ok(())
 }
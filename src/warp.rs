@@ -49,15 +49,17 @@ pub trait Hasher: std::fmt::Debug + Default {
     fn empty(&self) -> Hash;
     fn combine(&self, depth: u8, l: &Hash, r: &Hash) -> Hash;
     fn parallel_combine(&self, depth: u8, layer: &[Hash], pairs: usize) -> Vec<Hash>;
+    // appends the parent nodes of the first `pairs` pairs of `layer` to `out`
     fn parallel_combine_opt(
         &self,
         depth: u8,
         layer: &[Option<Hash>],
         pairs: usize,
-    ) -> Vec<Option<Hash>>;
+        out: &mut Vec<Option<Hash>>,
+    );
 }
 
-#[derive(Clone, Default, Serialize, Deserialize, Debug)]
+#[derive(Clone, Default, Serialize, Deserialize, PartialEq, Eq, Hash, Debug)]
 pub struct OutPoint {
     #[serde(with = "serde_bytes")]
     pub txid: Hash,
@@ -115,11 +117,22 @@ pub struct UTXO {
     pub value: u64,
 }
 
+impl UTXO {
+    pub fn outpoint(&self) -> OutPoint {
+        OutPoint {
+            txid: self.txid,
+            vout: self.vout,
+        }
+    }
+}
+
 #[derive(Debug)]
 pub struct TransparentSK {
     pub address: String,
     pub sk: SecretKey,
 }
 
-pub use decrypter::{try_orchard_decrypt, try_sapling_decrypt};
+pub use decrypter::{
+    try_orchard_decrypt, try_sapling_decrypt, OrchardDecryptKey, SaplingDecryptKey,
+};
 use zcash_primitives::legacy::TransparentAddress;
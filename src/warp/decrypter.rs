@@ -1,5 +1,3 @@
-use std::sync::mpsc::Sender;
-
 use crate::{
     lwd::rpc::{CompactOrchardAction, CompactSaplingOutput},
     network::Network,
@@ -7,16 +5,23 @@ use crate::{
         sync::{ReceivedNote, ReceivedTx},
         Witness,
     },
+    Hash,
 };
 
 use anyhow::Result;
-use blake2b_simd::Params;
+use blake2b_simd::{
+    many::{hash_many, HashManyJob},
+    Params,
+};
 use chacha20::{
     cipher::{KeyIvInit, StreamCipher, StreamCipherSeek},
     ChaCha20,
 };
-use group::{ff::PrimeField as _, Curve as _, GroupEncoding};
-use halo2_proofs::pasta::{pallas::Point, Fq};
+use group::{
+    ff::PrimeField as _, prime::PrimeCurveAffine as _, Curve as _, Group as _, GroupEncoding,
+};
+use halo2_proofs::pasta::{pallas::Point, EpAffine, Fq};
+use jubjub::{ExtendedNielsPoint, ExtendedPoint};
 use orchard::{
     keys::IncomingViewingKey,
     note::{ExtractedNoteCommitment, Rho},
@@ -26,46 +31,186 @@ use sapling_crypto::{
     note_encryption::{plaintext_version_is_valid, SaplingDomain, KDF_SAPLING_PERSONALIZATION},
     SaplingIvk,
 };
+use subtle::{ConditionallySelectable, ConstantTimeEq as _};
 use zcash_note_encryption::COMPACT_NOTE_SIZE;
 use zcash_primitives::transaction::components::sapling::zip212_enforcement;
 
+// Key agreements use fixed 4-bit windows
+// The IVK of every account is recoded into its digits once per chunk,
+// and the multiples 0..15 of an EPK are computed once per output and
+// shared by all the accounts. The digits are looked up in constant
+// time, like the double-and-add they replace
+const WINDOW_SIZE: usize = 16;
+
+type Digits = [u8; 64];
+
+// little endian 4-bit digits of a little endian scalar repr
+fn scalar_digits(repr: &[u8; 32]) -> Digits {
+    let mut digits = [0u8; 64];
+    for (i, b) in repr.iter().enumerate() {
+        digits[2 * i] = b & 0x0F;
+        digits[2 * i + 1] = b >> 4;
+    }
+    digits
+}
+
+fn select<T: ConditionallySelectable>(table: &[T; WINDOW_SIZE], digit: u8) -> T {
+    let mut r = table[0];
+    for (i, p) in table.iter().enumerate().skip(1) {
+        r.conditional_assign(p, (i as u8).ct_eq(&digit));
+    }
+    r
+}
+
+fn jubjub_table(p: &ExtendedPoint) -> [ExtendedNielsPoint; WINDOW_SIZE] {
+    let p_niels = p.to_niels();
+    let mut table = [ExtendedNielsPoint::identity(); WINDOW_SIZE];
+    let mut acc = ExtendedPoint::identity();
+    for t in table.iter_mut().skip(1) {
+        acc += &p_niels;
+        *t = acc.to_niels();
+    }
+    table
+}
+
+fn jubjub_mul(table: &[ExtendedNielsPoint; WINDOW_SIZE], digits: &Digits) -> ExtendedPoint {
+    // a jubjub scalar has 252 bits, the top digit is always 0
+    let mut acc = ExtendedPoint::identity();
+    for &d in digits[..63].iter().rev() {
+        acc = acc.double().double().double().double();
+        acc += select(table, d);
+    }
+    acc
+}
+
+fn pallas_table(p: &Point) -> [Point; WINDOW_SIZE] {
+    let mut table = [Point::identity(); WINDOW_SIZE];
+    for i in 1..WINDOW_SIZE {
+        table[i] = table[i - 1] + p;
+    }
+    table
+}
+
+fn pallas_mul(table: &[Point; WINDOW_SIZE], digits: &Digits) -> Point {
+    let mut acc = Point::identity();
+    for &d in digits.iter().rev() {
+        acc = acc.double().double().double().double();
+        acc += select(table, d);
+    }
+    acc
+}
+
+// Decryption keys are prepared once per chunk instead of once per output
+pub struct SaplingDecryptKey {
+    ivk_digits: Digits,
+    pivk: sapling_crypto::keys::PreparedIncomingViewingKey,
+}
+
+impl SaplingDecryptKey {
+    pub fn new(ivk: &SaplingIvk) -> Self {
+        Self {
+            ivk_digits: scalar_digits(&ivk.to_repr()),
+            pivk: sapling_crypto::keys::PreparedIncomingViewingKey::new(ivk),
+        }
+    }
+}
+
+pub struct OrchardDecryptKey {
+    ivk_digits: Digits,
+    pivk: orchard::keys::PreparedIncomingViewingKey,
+}
+
+impl OrchardDecryptKey {
+    pub fn new(ivk: &IncomingViewingKey) -> Self {
+        let bb = ivk.to_bytes();
+        let ivk_fq = Fq::from_repr(bb[32..64].try_into().unwrap()).unwrap();
+        Self {
+            ivk_digits: scalar_digits(&ivk_fq.to_repr()),
+            pivk: orchard::keys::PreparedIncomingViewingKey::new(ivk),
+        }
+    }
+}
+
+// Run the KDF of every account in one pass
+// blake2b_simd hashes the jobs in SIMD lanes (AVX2 when available)
+fn kdf_many(personal: &[u8], ka_epks: &[[u8; 64]]) -> Vec<Hash> {
+    let mut params = Params::new();
+    params.hash_length(32).personal(personal);
+    let mut jobs = ka_epks
+        .iter()
+        .map(|ka_epk| HashManyJob::new(&params, ka_epk))
+        .collect::<Vec<_>>();
+    hash_many(jobs.iter_mut());
+    jobs.iter()
+        .map(|job| job.to_hash().as_bytes().try_into().unwrap())
+        .collect()
+}
+
+fn ka_epk(ka: &[u8; 32], epk: &[u8]) -> [u8; 64] {
+    let mut ka_epk = [0u8; 64];
+    ka_epk[0..32].copy_from_slice(ka);
+    ka_epk[32..64].copy_from_slice(epk);
+    ka_epk
+}
+
+fn decrypt_compact(key: &Hash, enc: &[u8]) -> [u8; COMPACT_NOTE_SIZE] {
+    let mut plaintext = [0; COMPACT_NOTE_SIZE];
+    plaintext.copy_from_slice(enc);
+    let mut keystream = ChaCha20::new(key[..].into(), [0u8; 12][..].into());
+    keystream.seek(64);
+    keystream.apply_keystream(&mut plaintext);
+    plaintext
+}
+
 pub fn try_sapling_decrypt(
     network: &Network,
-    ivks: &[(u32, SaplingIvk)],
+    ivks: &[(u32, SaplingDecryptKey)],
     height: u32,
     timestamp: u32,
     ivtx: u32,
     vout: u32,
     co: &CompactSaplingOutput,
-    sender: &mut Sender<ReceivedNote>,
+    notes: &mut Vec<ReceivedNote>,
 ) -> Result<()> {
+    if ivks.is_empty() {
+        return Ok(());
+    }
     let epkb = &*co.epk;
-    let epk = jubjub::AffinePoint::from_bytes(epkb.try_into().unwrap()).unwrap();
     let enc = &co.ciphertext;
-    let epk = epk.mul_by_cofactor().to_niels();
+    // a malformed output cannot be ours, skip it
+    let Ok(epk_bytes) = <[u8; 32]>::try_from(epkb) else {
+        return Ok(());
+    };
+    let epk = jubjub::AffinePoint::from_bytes(epk_bytes);
+    if bool::from(epk.is_none()) || enc.len() != COMPACT_NOTE_SIZE {
+        return Ok(());
+    }
+    let epk = epk.unwrap().mul_by_cofactor();
     let zip212_enforcement = zip212_enforcement(network, height.into());
-    for (account, ivk) in ivks {
-        let ka = epk.multiply_bits(&ivk.to_repr()).to_affine();
-        let key = Params::new()
-            .hash_length(32)
-            .personal(KDF_SAPLING_PERSONALIZATION)
-            .to_state()
-            .update(&ka.to_bytes())
-            .update(epkb)
-            .finalize();
-        let mut plaintext = [0; COMPACT_NOTE_SIZE];
-        plaintext.copy_from_slice(enc);
-        let mut keystream = ChaCha20::new(key.as_ref().into(), [0u8; 12][..].into());
-        keystream.seek(64);
-        keystream.apply_keystream(&mut plaintext);
+
+    // shared table and inversion for the key agreements of all the accounts
+    let table = jubjub_table(&epk);
+    let kas = ivks
+        .iter()
+        .map(|(_, key)| jubjub_mul(&table, &key.ivk_digits))
+        .collect::<Vec<_>>();
+    let mut kas_affine = vec![jubjub::AffinePoint::identity(); kas.len()];
+    ExtendedPoint::batch_normalize(&kas, &mut kas_affine);
+    let ka_epks = kas_affine
+        .iter()
+        .map(|ka| ka_epk(&ka.to_bytes(), epkb))
+        .collect::<Vec<_>>();
+    let keys = kdf_many(KDF_SAPLING_PERSONALIZATION, &ka_epks);
+
+    let d = SaplingDomain::new(zip212_enforcement);
+    for ((account, ivk), key) in ivks.iter().zip(keys.iter()) {
+        let plaintext = decrypt_compact(key, enc);
         if (plaintext[0] == 0x01 || plaintext[0] == 0x02)
             && plaintext_version_is_valid(zip212_enforcement, plaintext[0])
         {
             use zcash_note_encryption::Domain;
-            let pivk = sapling_crypto::keys::PreparedIncomingViewingKey::new(&ivk);
-            let d = SaplingDomain::new(zip212_enforcement);
             if let Some((note, recipient)) =
-                d.parse_note_plaintext_without_memo_ivk(&pivk, &plaintext)
+                d.parse_note_plaintext_without_memo_ivk(&ivk.pivk, &plaintext)
             {
                 let cmx = note.cmu();
                 if &cmx.to_bytes() == &*co.cmu {
@@ -94,7 +239,7 @@ pub fn try_sapling_decrypt(
                         nf: [0u8; 32],
                         spent: None,
                     };
-                    sender.send(note)?;
+                    notes.push(note);
                 }
             }
         }
@@ -106,45 +251,56 @@ const KDF_ORCHARD_PERSONALIZATION: &[u8; 16] = b"Zcash_OrchardKDF";
 
 pub fn try_orchard_decrypt(
     network: &Network,
-    ivks: &[(u32, IncomingViewingKey)],
+    ivks: &[(u32, OrchardDecryptKey)],
     height: u32,
     timestamp: u32,
     ivtx: u32,
     vout: u32,
     ca: &CompactOrchardAction,
-    sender: &mut Sender<ReceivedNote>,
+    notes: &mut Vec<ReceivedNote>,
 ) -> Result<()> {
+    if ivks.is_empty() {
+        return Ok(());
+    }
+    // a malformed action cannot be ours, skip it
+    let (Ok(epk_bytes), Ok(nf_bytes)) = (
+        <[u8; 32]>::try_from(&*ca.ephemeral_key),
+        <[u8; 32]>::try_from(&*ca.nullifier),
+    ) else {
+        return Ok(());
+    };
+    let epk = Point::from_bytes(&epk_bytes);
+    let rho = Rho::from_bytes(&nf_bytes);
+    if bool::from(epk.is_none() | rho.is_none()) || ca.ciphertext.len() != COMPACT_NOTE_SIZE {
+        return Ok(());
+    }
+    let (epk, rho) = (epk.unwrap(), rho.unwrap());
     let zip212_enforcement = zip212_enforcement(network, height.into());
-    for (account, ivk) in ivks {
-        let bb = ivk.to_bytes();
-        let ivk_fq = Fq::from_repr(bb[32..64].try_into().unwrap()).unwrap();
 
-        let epk = Point::from_bytes(&ca.ephemeral_key.clone().try_into().unwrap())
-            .unwrap()
-            .to_affine();
-        let ka = epk * ivk_fq;
-        let key = Params::new()
-            .hash_length(32)
-            .personal(KDF_ORCHARD_PERSONALIZATION)
-            .to_state()
-            .update(&ka.to_bytes())
-            .update(&ca.ephemeral_key)
-            .finalize();
-        let mut plaintext = [0; COMPACT_NOTE_SIZE];
-        plaintext.copy_from_slice(&ca.ciphertext);
-        let mut keystream = ChaCha20::new(key.as_ref().into(), [0u8; 12][..].into());
-        keystream.seek(64);
-        keystream.apply_keystream(&mut plaintext);
+    // shared table and inversion for the key agreements of all the accounts
+    let table = pallas_table(&epk);
+    let kas = ivks
+        .iter()
+        .map(|(_, key)| pallas_mul(&table, &key.ivk_digits))
+        .collect::<Vec<_>>();
+    let mut kas_affine = vec![EpAffine::identity(); kas.len()];
+    Point::batch_normalize(&kas, &mut kas_affine);
+    let ka_epks = kas_affine
+        .iter()
+        .map(|ka| ka_epk(&ka.to_bytes(), &ca.ephemeral_key))
+        .collect::<Vec<_>>();
+    let keys = kdf_many(KDF_ORCHARD_PERSONALIZATION, &ka_epks);
+
+    let d = OrchardDomain::for_rho(&rho);
+    for ((account, ivk), key) in ivks.iter().zip(keys.iter()) {
+        let plaintext = decrypt_compact(key, &ca.ciphertext);
 
         if (plaintext[0] == 0x01 || plaintext[0] == 0x02)
             && plaintext_version_is_valid(zip212_enforcement, plaintext[0])
         {
             use zcash_note_encryption::Domain;
-            let pivk = orchard::keys::PreparedIncomingViewingKey::new(&ivk);
-            let rho = Rho::from_bytes(&ca.nullifier.clone().try_into().unwrap()).unwrap();
-            let d = OrchardDomain::for_rho(&rho);
             if let Some((note, recipient)) =
-                d.parse_note_plaintext_without_memo_ivk(&pivk, &plaintext)
+                d.parse_note_plaintext_without_memo_ivk(&ivk.pivk, &plaintext)
             {
                 let cmx = ExtractedNoteCommitment::from(note.commitment());
                 let value = note.value().inner();
@@ -173,10 +329,38 @@ pub fn try_orchard_decrypt(
                         nf: [0u8; 32],
                         spent: None,
                     };
-                    sender.send(note)?;
+                    notes.push(note);
                 }
             }
         }
     }
     Ok(())
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use group::{ff::Field as _, Group as _};
+    use rand::rngs::OsRng;
+
+    #[test]
+    fn jubjub_windowed_mul() {
+        for _ in 0..20 {
+            let p = ExtendedPoint::random(OsRng);
+            let s = jubjub::Fr::random(OsRng);
+            let expected = p.to_niels().multiply_bits(&s.to_repr());
+            let table = jubjub_table(&p);
+            assert_eq!(jubjub_mul(&table, &scalar_digits(&s.to_repr())), expected);
+        }
+    }
+
+    #[test]
+    fn pallas_windowed_mul() {
+        for _ in 0..20 {
+            let p = Point::random(OsRng);
+            let s = Fq::random(OsRng);
+            let table = pallas_table(&p);
+            assert_eq!(pallas_mul(&table, &scalar_digits(&s.to_repr())), p * s);
+        }
+    }
+}
@@ -1,4 +1,4 @@
-use halo2_proofs::pasta::pallas::Point;
+use halo2_proofs::pasta::pallas::{Affine, Point};
 use jubjub::Fr;
 
 use super::{AuthPath, Hash, Hasher, MERKLE_DEPTH};
@@ -24,14 +24,24 @@ impl Hasher for SaplingHasher {
         depth: u8,
         layer: &[Option<Hash>],
         pairs: usize,
-    ) -> Vec<Option<Hash>> {
-        super::sapling::parallel_hash_opt(depth, layer, pairs)
+        out: &mut Vec<Option<Hash>>,
+    ) {
+        super::sapling::parallel_hash_opt(depth, layer, pairs, out)
     }
 }
 
 #[derive(Debug)]
 pub struct OrchardHasher {
     pub(crate) q: Point,
+    // (Q + S[depth]) + Q, for every depth
+    pub(crate) prefixes: Vec<Affine>,
+}
+
+// Pairs hashed per batch normalization. Bounds the number of
+// projective points alive at once while keeping enough batches
+// per layer for every worker
+pub(crate) fn batch_size(pairs: usize) -> usize {
+    (pairs / (rayon::current_num_threads() * 4)).clamp(16, 4096)
 }
 
 pub fn empty_roots<H: Hasher>(h: &H) -> AuthPath {
@@ -1,6 +1,11 @@
-use std::{sync::Arc, time::Duration};
+use std::{
+    collections::{HashMap, HashSet},
+    sync::Arc,
+    time::Duration,
+};
 
 use anyhow::Result;
+use rayon::prelude::*;
 use rusqlite::Connection;
 use tokio::sync::Mutex;
 use tokio::{
@@ -13,23 +18,64 @@ use zcash_protocol::consensus::{BlockHeight, BranchId};
 
 use crate::{
     coin::CoinDef,
-    db::mempool::{clear_unconfirmed_tx, store_unconfirmed_tx},
-    lwd::rpc::{Empty, RawTransaction},
+    data::fb::UnconfirmedTxT,
+    db::account::list_accounts,
+    fb_unwrap,
+    lwd::{
+        get_last_height,
+        rpc::{Empty, RawTransaction},
+    },
     network::Network,
-    txdetails::analyze_raw_transaction,
+    txdetails::TxAnalyzer,
     utils::ContextExt,
+    Hash,
 };
 
 use crate::coin::COINS;
 use warp_macros::c_export;
 
-use super::sync::ReceivedTx;
+// Interval between checks for a new block when the mempool stream
+// ended before the chain tip moved
+const BLOCK_POLL_SEC: u64 = 2;
 
 #[derive(Clone, Debug)]
 pub enum MempoolMsg {
+    // The accounts changed
     Account(u32),
 }
 
+/// Values of the unconfirmed txs per account, kept in memory
+/// and reset when a new block is mined
+#[derive(Default, Debug)]
+pub struct UnconfirmedTxs {
+    txs: Vec<(Hash, Vec<(u32, i64)>)>,
+}
+
+impl UnconfirmedTxs {
+    fn clear(&mut self) {
+        self.txs.clear();
+    }
+
+    fn add(&mut self, txid: Hash, values: Vec<(u32, i64)>) {
+        if !values.is_empty() {
+            self.txs.push((txid, values));
+        }
+    }
+
+    pub fn txids(&self) -> HashSet<Hash> {
+        self.txs.iter().map(|(txid, _)| *txid).collect()
+    }
+
+    fn of_account(&self, account: u32) -> impl Iterator<Item = (&Hash, i64)> {
+        self.txs.iter().flat_map(move |(txid, values)| {
+            values
+                .iter()
+                .filter(move |(a, _)| *a == account)
+                .map(move |(_, v)| (txid, *v))
+        })
+    }
+}
+
 pub struct Mempool {}
 
 impl Mempool {
@@ -42,31 +88,37 @@ impl Mempool {
                 let c = coin.clone();
                 let rx = rx.clone();
                 async move {
-                    let mut account = 0;
                     let mut client = c.connect_lwd()?;
                     let connection = c.connection()?;
+                    let mut rx = rx.lock().await;
+                    // values of the txs of the previous stream, the server
+                    // sends them again after a new block if they are still pending
+                    let mut known = HashMap::<Hash, Vec<(u32, i64)>>::new();
                     'outer: loop {
-                        tracing::info!("mempool open");
-                        clear_unconfirmed_tx(&connection)?;
+                        let height = get_last_height(&mut client).await?;
+                        tracing::info!("mempool open @{height}");
+                        // pending spends and new accounts
+                        let mut analyzers = load_analyzers(&c, &connection)?;
+                        c.unconfirmed.lock().clear();
+                        let mut current = HashMap::<Hash, Vec<(u32, i64)>>::new();
                         let mut mempool = client
                             .get_mempool_stream(Request::new(Empty {}))
                             .await
                             .with_file_line(|| "get_mempool_stream")?
                             .into_inner();
-                        let mut rx = rx.lock().await;
                         loop {
                             tokio::select! {
                                 msg = rx.recv() => {
                                     if let Some(msg) = msg {
                                         tracing::info!("Recv {:?}", msg);
                                         match msg {
-                                            MempoolMsg::Account(new_account) => {
-                                                if new_account != account {
-                                                    account = new_account;
-                                                    break; // need to request the mempool again
-                                                }
+                                            MempoolMsg::Account(_) => {
+                                                analyzers = load_analyzers(&c, &connection)?;
+                                                // the cached values predate the new accounts,
+                                                // parse the txs again on the next stream
+                                                known.clear();
+                                                current.clear();
                                             }
-                                        // change of servers?
                                         }
                                     }
                                     else {
@@ -78,11 +130,15 @@ impl Mempool {
                                     let tx = tx?;
                                     if let Some(tx) = tx {
                                         tracing::info!("{}", tx.height);
-                                        if account == 0 { continue }
-                                        let tx = parse_raw_tx(&c, &c.network, &connection, account, &tx).unwrap();
-                                        if tx.value != 0 {
-                                            store_unconfirmed_tx(&connection, &tx)?;
-                                        }
+                                        let (txid, values) = match parse_raw_tx(&c.network, &connection, &analyzers, &known, &tx) {
+                                            Ok(r) => r,
+                                            Err(e) => {
+                                                tracing::warn!("mempool tx: {e}");
+                                                continue;
+                                            }
+                                        };
+                                        c.unconfirmed.lock().add(txid, values.clone());
+                                        current.insert(txid, values);
                                     }
                                     else {
                                         break;
@@ -91,9 +147,12 @@ impl Mempool {
                             }
                         }
                         tracing::info!("mempool close");
-                        tracing::info!("Sleeping before new block");
-                        clear_unconfirmed_tx(&connection)?;
-                        tokio::time::sleep(Duration::from_secs(5)).await;
+                        known = current;
+                        // the server ends the stream when a block is mined,
+                        // reopen as soon as the tip moves
+                        while get_last_height(&mut client).await? <= height {
+                            tokio::time::sleep(Duration::from_secs(BLOCK_POLL_SEC)).await;
+                        }
                     }
                 }
             };
@@ -114,29 +173,69 @@ impl Mempool {
     }
 }
 
+fn load_analyzers(coin: &CoinDef, connection: &Connection) -> Result<Vec<TxAnalyzer>> {
+    let accounts = list_accounts(coin, connection)?;
+    let analyzers = fb_unwrap!(accounts.items)
+        .iter()
+        .map(|a| TxAnalyzer::load(&coin.network, connection, a.id))
+        .collect::<Result<Vec<_>>>()?;
+    Ok(analyzers)
+}
+
+// Net value of the tx for every account it involves
 fn parse_raw_tx(
-    coin: &CoinDef,
     network: &Network,
     connection: &Connection,
-    account: u32,
+    analyzers: &[TxAnalyzer],
+    known: &HashMap<Hash, Vec<(u32, i64)>>,
     raw_tx: &RawTransaction,
-) -> Result<ReceivedTx> {
+) -> Result<(Hash, Vec<(u32, i64)>)> {
     let height = raw_tx.height as u32;
     let raw_tx = &*raw_tx.data;
     let branch_id = BranchId::for_height(network, BlockHeight::from_u32(height));
     let tx = Transaction::read(raw_tx, branch_id)?;
-    let txid = tx.txid();
-    let txd = analyze_raw_transaction(coin, network, connection, account, height, 0, tx)?;
-    let tx = ReceivedTx {
-        id: 0,
-        account,
-        height,
-        txid: txid.clone().try_into().unwrap(),
-        timestamp: 0,
-        ivtx: 0,
-        value: txd.value,
-    };
-    Ok(tx)
+    let txid: Hash = tx.txid().as_ref().clone();
+    if let Some(values) = known.get(&txid) {
+        return Ok((txid, values.clone()));
+    }
+    let data = tx.into_data();
+    let outputs = tokio::task::block_in_place(|| {
+        analyzers
+            .par_iter()
+            .map(|a| a.decrypt_outputs(network, height, &data))
+            .collect::<Vec<_>>()
+    });
+    let mut values = vec![];
+    for (analyzer, (souts, oouts)) in analyzers.iter().zip(outputs.into_iter()) {
+        let txd = analyzer.analyze_decrypted(
+            network, connection, height, 0, txid, &data, souts, oouts,
+        )?;
+        if txd.value != 0 {
+            values.push((analyzer.account, txd.value));
+        }
+    }
+    Ok((txid, values))
+}
+
+#[c_export]
+pub fn list_unconfirmed_txs(coin: &CoinDef, account: u32) -> Result<Vec<UnconfirmedTxT>> {
+    let unconfirmed = coin.unconfirmed.lock();
+    let txs = unconfirmed
+        .of_account(account)
+        .map(|(txid, value)| UnconfirmedTxT {
+            account,
+            txid: Some(txid.to_vec()),
+            value,
+        })
+        .collect::<Vec<_>>();
+    Ok(txs)
+}
+
+#[c_export]
+pub fn get_unconfirmed_balance(coin: &CoinDef, account: u32) -> Result<i64> {
+    let unconfirmed = coin.unconfirmed.lock();
+    let balance = unconfirmed.of_account(account).map(|(_, v)| v).sum::<i64>();
+    Ok(balance)
 }
 
 #[c_export]
@@ -1,54 +1,167 @@
-use super::{hasher::OrchardHasher, Hash, Hasher};
-use group::{ff::PrimeField as _, prime::PrimeCurveAffine as _, Curve as _};
+use super::{
+    hasher::{batch_size, OrchardHasher},
+    Hash, Hasher,
+};
+use group::{
+    ff::{Field as _, PrimeField as _},
+    prime::PrimeCurveAffine as _,
+    Curve as _,
+};
 use halo2_gadgets::sinsemilla::primitives::SINSEMILLA_S;
 use halo2_proofs::{
     arithmetic::{CurveAffine as _, CurveExt as _},
     pasta::{
-        pallas::{self, Affine, Point},
-        Ep, EpAffine, Fp, Fq,
+        pallas::{Affine, Point},
+        EpAffine, Fp, Fq,
     },
 };
+use lazy_static::lazy_static;
 use rayon::prelude::*;
 
+use super::MERKLE_DEPTH;
+
+lazy_static! {
+    // SINSEMILLA_S validated once instead of for every chunk
+    static ref S_TABLE: Vec<Affine> = SINSEMILLA_S
+        .iter()
+        .map(|&(s_x, s_y)| Affine::from_xy(s_x, s_y).unwrap())
+        .collect();
+}
+
+// Below this number of pairs, the shared inversions do not pay off
+// and we hash in projective coordinates
+const MIN_BATCH_AFFINE: usize = 64;
+
+// we have 255*2/10 = 51 chunks
+fn chunk_indices(left: &Hash, right: &Hash) -> [u16; 51] {
+    // Shift right by 1 bit and overwrite the 256th bit of left
+    let mut left = *left;
+    let mut right = *right;
+    left[31] |= (right[0] & 1) << 7; // move the first bit of right into 256th of left
+    for i in 0..32 {
+        // move by 1 bit to fill the missing 256th bit of left
+        let carry = if i < 31 { (right[i + 1] & 1) << 7 } else { 0 };
+        right[i] = right[i] >> 1 | carry;
+    }
+
+    let mut chunks = [0u16; 51];
+    let mut bit_offset = 0;
+    let mut byte_offset = 0;
+    for c in chunks.iter_mut() {
+        let v = if byte_offset < 31 {
+            left[byte_offset] as u16 | (left[byte_offset + 1] as u16) << 8
+        } else if byte_offset == 31 {
+            left[31] as u16 | (right[0] as u16) << 8
+        } else {
+            right[byte_offset - 32] as u16 | (right[byte_offset - 31] as u16) << 8
+        };
+        *c = v >> bit_offset & 0x03FF; // keep 10 bits
+        bit_offset += 10;
+        if bit_offset >= 8 {
+            byte_offset += bit_offset / 8;
+            bit_offset %= 8;
+        }
+    }
+    chunks
+}
+
+// Montgomery's trick: one field inversion for the whole slice
+// Returns false (and leaves values unusable) if any of them is zero
+fn batch_invert(values: &mut [Fp], scratch: &mut Vec<Fp>) -> bool {
+    scratch.clear();
+    let mut acc = Fp::one();
+    for v in values.iter() {
+        scratch.push(acc);
+        acc *= v;
+    }
+    let inv = acc.invert();
+    if bool::from(inv.is_none()) {
+        return false;
+    }
+    let mut inv = inv.unwrap();
+    for (v, p) in values.iter_mut().zip(scratch.iter()).rev() {
+        let vi = *v;
+        *v = inv * p;
+        inv *= vi;
+    }
+    true
+}
+
+fn x_coordinate(p: &EpAffine) -> Fp {
+    p.coordinates().map(|c| *c.x()).unwrap_or_else(Fp::zero)
+}
+
 impl OrchardHasher {
     fn node_combine_inner(&self, depth: u8, left: &Hash, right: &Hash) -> Point {
-        let mut acc = self.q;
-        let (s_x, s_y) = SINSEMILLA_S[depth as usize];
-        let s_chunk = Affine::from_xy(s_x, s_y).unwrap();
-        acc = (acc + s_chunk) + acc; // TODO Bail if + gives point at infinity? Shouldn't happen if data was validated
-
-        // Shift right by 1 bit and overwrite the 256th bit of left
-        let mut left = *left;
-        let mut right = *right;
-        left[31] |= (right[0] & 1) << 7; // move the first bit of right into 256th of left
-        for i in 0..32 {
-            // move by 1 bit to fill the missing 256th bit of left
-            let carry = if i < 31 { (right[i + 1] & 1) << 7 } else { 0 };
-            right[i] = right[i] >> 1 | carry;
+        let mut acc = self.prefixes[depth as usize].to_curve();
+        for v in chunk_indices(left, right) {
+            let s_chunk = S_TABLE[v as usize];
+            acc = (acc + s_chunk) + acc; // TODO Bail if + gives point at infinity? Shouldn't happen if data was validated
         }
+        acc
+    }
 
-        // we have 255*2/10 = 51 chunks
-        let mut bit_offset = 0;
-        let mut byte_offset = 0;
-        for _ in 0..51 {
-            let mut v = if byte_offset < 31 {
-                left[byte_offset] as u16 | (left[byte_offset + 1] as u16) << 8
-            } else if byte_offset == 31 {
-                left[31] as u16 | (right[0] as u16) << 8
-            } else {
-                right[byte_offset - 32] as u16 | (right[byte_offset - 31] as u16) << 8
-            };
-            v = v >> bit_offset & 0x03FF; // keep 10 bits
-            let (s_x, s_y) = SINSEMILLA_S[v as usize];
-            let s_chunk = Affine::from_xy(s_x, s_y).unwrap();
-            acc = (acc + s_chunk) + acc;
-            bit_offset += 10;
-            if bit_offset >= 8 {
-                byte_offset += bit_offset / 8;
-                bit_offset %= 8;
+    // Hash a batch of pairs in lockstep, in affine coordinates
+    // Every step (A + S) + A is two incomplete additions whose
+    // inversions are shared by all the lanes
+    // Returns None on an exceptional case (x1 == x2), the caller
+    // then uses the complete projective formulas
+    fn node_combine_batch_affine(&self, depth: u8, pairs: &[(&Hash, &Hash)]) -> Option<Vec<Fp>> {
+        let n = pairs.len();
+        let prefix = self.prefixes[depth as usize].coordinates().unwrap();
+        let chunks = pairs
+            .iter()
+            .map(|(l, r)| chunk_indices(l, r))
+            .collect::<Vec<_>>();
+        let mut xs = vec![*prefix.x(); n];
+        let mut ys = vec![*prefix.y(); n];
+        let mut lambdas = vec![Fp::zero(); n];
+        let mut xrs = vec![Fp::zero(); n];
+        let mut dens = vec![Fp::zero(); n];
+        let mut scratch = Vec::with_capacity(n);
+        for k in 0..51 {
+            // R = A + S
+            for i in 0..n {
+                let (s_x, _) = SINSEMILLA_S[chunks[i][k] as usize];
+                dens[i] = xs[i] - s_x;
+            }
+            if !batch_invert(&mut dens, &mut scratch) {
+                return None;
+            }
+            for i in 0..n {
+                let (s_x, s_y) = SINSEMILLA_S[chunks[i][k] as usize];
+                let lambda = (ys[i] - s_y) * dens[i];
+                lambdas[i] = lambda;
+                xrs[i] = lambda.square() - xs[i] - s_x;
+                dens[i] = xs[i] - xrs[i];
+            }
+            if !batch_invert(&mut dens, &mut scratch) {
+                return None;
+            }
+            // A + R, without computing the y of R
+            for i in 0..n {
+                let lambda = ys[i].double() * dens[i] - lambdas[i];
+                let x = lambda.square() - xrs[i] - xs[i];
+                ys[i] = lambda * (xs[i] - x) - ys[i];
+                xs[i] = x;
             }
         }
-        acc
+        Some(xs)
+    }
+
+    fn node_combine_batch(&self, depth: u8, pairs: &[(&Hash, &Hash)]) -> Vec<Fp> {
+        if pairs.len() >= MIN_BATCH_AFFINE {
+            if let Some(xs) = self.node_combine_batch_affine(depth, pairs) {
+                return xs;
+            }
+        }
+        let hash_extended = pairs
+            .iter()
+            .map(|(l, r)| self.node_combine_inner(depth, l, r))
+            .collect::<Vec<_>>();
+        let mut hash_affine = vec![EpAffine::identity(); hash_extended.len()];
+        Point::batch_normalize(&hash_extended, &mut hash_affine);
+        hash_affine.iter().map(x_coordinate).collect()
     }
 }
 
@@ -57,7 +170,14 @@ impl Default for OrchardHasher {
         let q = Point::hash_to_curve(halo2_gadgets::sinsemilla::primitives::Q_PERSONALIZATION)(
             halo2_gadgets::sinsemilla::merkle::MERKLE_CRH_PERSONALIZATION.as_bytes(),
         );
-        Self { q }
+        // the first chunk is the depth and does not depend on the nodes
+        let prefixes = (0..MERKLE_DEPTH as usize)
+            .map(|depth| {
+                let s_chunk = S_TABLE[depth];
+                ((q + s_chunk) + q).to_affine()
+            })
+            .collect();
+        Self { q, prefixes }
     }
 }
 
@@ -68,28 +188,21 @@ impl Hasher for OrchardHasher {
 
     fn combine(&self, depth: u8, l: &crate::Hash, r: &crate::Hash) -> crate::Hash {
         let acc = self.node_combine_inner(depth, l, r);
-        let p = acc
-            .to_affine()
-            .coordinates()
-            .map(|c| *c.x())
-            .unwrap_or_else(Fp::zero);
-        p.to_repr()
+        x_coordinate(&acc.to_affine()).to_repr()
     }
 
     fn parallel_combine(&self, depth: u8, layer: &[crate::Hash], pairs: usize) -> Vec<crate::Hash> {
-        let hash_extended: Vec<_> = (0..pairs)
-            .into_par_iter()
-            .map(|i| self.node_combine_inner(depth, &layer[2 * i], &layer[2 * i + 1]))
-            .collect();
-        let mut hash_affine = vec![EpAffine::identity(); hash_extended.len()];
-        Point::batch_normalize(&hash_extended, &mut hash_affine);
-        hash_affine
-            .iter()
-            .map(|p| {
-                p.coordinates()
-                    .map(|c| *c.x())
-                    .unwrap_or_else(pallas::Base::zero)
-                    .to_repr()
+        let batch_size = batch_size(pairs);
+        layer[..2 * pairs]
+            .par_chunks(2 * batch_size)
+            .flat_map_iter(|batch| {
+                let pairs = batch
+                    .chunks_exact(2)
+                    .map(|p| (&p[0], &p[1]))
+                    .collect::<Vec<_>>();
+                self.node_combine_batch(depth, &pairs)
+                    .into_iter()
+                    .map(|x| x.to_repr())
             })
             .collect()
     }
@@ -99,31 +212,107 @@ impl Hasher for OrchardHasher {
         depth: u8,
         layer: &[Option<Hash>],
         pairs: usize,
-    ) -> Vec<Option<Hash>> {
-        let hash_extended: Vec<Option<Ep>> = (0..pairs)
-            .into_par_iter()
-            .map(|i| match (&layer[2 * i], &layer[2 * i + 1]) {
-                (Some(l), Some(r)) => Some(self.node_combine_inner(depth, l, r)),
+        out: &mut Vec<Option<Hash>>,
+    ) {
+        let start = out.len();
+        out.resize(start + pairs, None);
+        let batch_size = batch_size(pairs);
+        out[start..]
+            .par_chunks_mut(batch_size)
+            .enumerate()
+            .for_each(|(ib, hashes)| {
+                let offset = ib * batch_size;
+                let layer = &layer[2 * offset..2 * (offset + hashes.len())];
+                let pairs = layer
+                    .chunks_exact(2)
+                    .filter_map(|p| match (&p[0], &p[1]) {
+                        (Some(l), Some(r)) => Some((l, r)),
+                        _ => None,
+                    })
+                    .collect::<Vec<_>>();
+                let xs = self.node_combine_batch(depth, &pairs);
+                let mut h_cursor = xs.iter();
+                for (h, p) in hashes.iter_mut().zip(layer.chunks_exact(2)) {
+                    *h = match (&p[0], &p[1]) {
+                        (Some(_), Some(_)) => Some(h_cursor.next().unwrap().to_repr()),
+                        _ => None,
+                    };
+                }
+            });
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use group::ff::{Field as _, PrimeField as _};
+    use rand::rngs::OsRng;
+
+    fn random_nodes(n: usize) -> Vec<Hash> {
+        (0..n).map(|_| Fp::random(OsRng).to_repr()).collect()
+    }
+
+    #[test]
+    fn batch_affine_matches_combine() {
+        let h = OrchardHasher::default();
+        for n in [1, 2, MIN_BATCH_AFFINE - 1, MIN_BATCH_AFFINE, 3 * MIN_BATCH_AFFINE + 5] {
+            let layer = random_nodes(2 * n);
+            let pairs = layer
+                .chunks_exact(2)
+                .map(|p| (&p[0], &p[1]))
+                .collect::<Vec<_>>();
+            for depth in [0u8, 7, MERKLE_DEPTH - 1] {
+                let expected = pairs
+                    .iter()
+                    .map(|(l, r)| h.combine(depth, l, r))
+                    .collect::<Vec<_>>();
+                let affine = h
+                    .node_combine_batch_affine(depth, &pairs)
+                    .unwrap()
+                    .iter()
+                    .map(|x| x.to_repr())
+                    .collect::<Vec<_>>();
+                assert_eq!(affine, expected, "affine n={n} depth={depth}");
+                let batch = h
+                    .node_combine_batch(depth, &pairs)
+                    .iter()
+                    .map(|x| x.to_repr())
+                    .collect::<Vec<_>>();
+                assert_eq!(batch, expected, "batch n={n} depth={depth}");
+                assert_eq!(h.parallel_combine(depth, &layer, n), expected);
+            }
+        }
+    }
+
+    #[test]
+    fn batch_affine_empty_roots() {
+        // identical lanes, as in an empty subtree
+        let h = OrchardHasher::default();
+        let empty = h.empty();
+        let pairs = vec![(&empty, &empty); 2 * MIN_BATCH_AFFINE];
+        let xs = h.node_combine_batch(0, &pairs);
+        let expected = h.combine(0, &empty, &empty);
+        assert!(xs.iter().all(|x| x.to_repr() == expected));
+    }
+
+    #[test]
+    fn batch_affine_opt_matches_combine() {
+        let h = OrchardHasher::default();
+        let n = 2 * MIN_BATCH_AFFINE + 3;
+        let layer = random_nodes(2 * n)
+            .into_iter()
+            .enumerate()
+            .map(|(i, node)| if i % 7 == 3 { None } else { Some(node) })
+            .collect::<Vec<_>>();
+        let mut out = vec![];
+        h.parallel_combine_opt(5, &layer, n, &mut out);
+        assert_eq!(out.len(), n);
+        for (h_out, p) in out.iter().zip(layer.chunks_exact(2)) {
+            let expected = match (&p[0], &p[1]) {
+                (Some(l), Some(r)) => Some(h.combine(5, l, r)),
                 _ => None,
-            })
-            .collect();
-        let ext = hash_extended.iter().flatten().cloned().collect::<Vec<_>>();
-        let mut hash_affine = vec![EpAffine::identity(); ext.len()];
-        Point::batch_normalize(&ext, &mut hash_affine);
-        let mut h_cursor = hash_affine.iter();
-        hash_extended
-            .iter()
-            .map(|n| {
-                n.map(|_| {
-                    h_cursor
-                        .next()
-                        .unwrap()
-                        .coordinates()
-                        .map(|c| *c.x())
-                        .unwrap_or_else(pallas::Base::zero)
-                        .to_repr()
-                })
-            })
-            .collect::<Vec<_>>()
+            };
+            assert_eq!(*h_out, expected);
+        }
     }
 }
@@ -1,4 +1,4 @@
-use crate::Hash;
+use crate::{warp::hasher::batch_size, Hash};
 use group::{ff::PrimeField as _, Curve as _, GroupEncoding as _};
 use jubjub::{AffinePoint, ExtendedNielsPoint, ExtendedPoint, Fr, SubgroupPoint};
 use lazy_static::lazy_static;
@@ -29,9 +29,7 @@ fn accumulate_scalar(acc: &mut Fr, cur: &mut Fr, x: u8) {
     *acc += tmp;
 }
 
-fn accumulate_generator(acc: &Fr, idx_generator: u32) -> ExtendedPoint {
-    let acc_bytes = acc.to_repr();
-
+fn accumulate_generator(acc_bytes: &[u8; 32], idx_generator: u32) -> ExtendedPoint {
     let mut tmp = ExtendedPoint::identity();
     for (i, &j) in acc_bytes.iter().enumerate() {
         let offset = (idx_generator * 32 + i as u32) * 256 + j as u32;
@@ -48,7 +46,39 @@ pub fn hash_combine(depth: u8, left: &[u8; 32], right: &[u8; 32]) -> [u8; 32] {
 }
 
 pub fn hash_combine_inner(depth: u8, left: &[u8; 32], right: &[u8; 32]) -> ExtendedPoint {
+    let scalars = hash_scalars(depth, left, right);
     let mut hash = ExtendedPoint::identity();
+    for (idx_generator, acc_bytes) in scalars.iter().enumerate() {
+        hash += accumulate_generator(acc_bytes, idx_generator as u32);
+    }
+    hash
+}
+
+// Hash a batch of pairs in lockstep
+// Every lane reads the same 256 entry window of GENERATORS_EXP
+// before moving to the next one. The window stays in cache instead of
+// having each hash walk the whole table (~4 MB)
+fn hash_combine_batch(depth: u8, pairs: &[(&Hash, &Hash)]) -> Vec<ExtendedPoint> {
+    let scalars = pairs
+        .iter()
+        .map(|(l, r)| hash_scalars(depth, l, r))
+        .collect::<Vec<_>>();
+    let mut hashes = vec![ExtendedPoint::identity(); pairs.len()];
+    for idx_generator in 0..3 {
+        for i in 0..32 {
+            let offset = (idx_generator * 32 + i) * 256;
+            let window = &GENERATORS_EXP[offset..offset + 256];
+            for (hash, s) in hashes.iter_mut().zip(scalars.iter()) {
+                *hash += window[s[idx_generator][i] as usize];
+            }
+        }
+    }
+    hashes
+}
+
+// Scalars of the 3 generator segments, as little endian bytes
+fn hash_scalars(depth: u8, left: &[u8; 32], right: &[u8; 32]) -> [[u8; 32]; 3] {
+    let mut scalars = [[0u8; 32]; 3];
     let mut acc = Fr::zero();
     let mut cur = Fr::one();
 
@@ -92,7 +122,7 @@ pub fn hash_combine_inner(depth: u8, left: &[u8; 32], right: &[u8; 32]) -> Exten
         accumulate_scalar(&mut acc, &mut cur, v as u8);
 
         if (i + 3) % PEDERSEN_HASH_CHUNKS_PER_GENERATOR as u32 == 0 {
-            hash += accumulate_generator(&acc, idx_generator);
+            scalars[idx_generator] = acc.to_repr();
             idx_generator += 1;
             acc = Fr::zero();
             cur = Fr::one();
@@ -105,15 +135,22 @@ pub fn hash_combine_inner(depth: u8, left: &[u8; 32], right: &[u8; 32]) -> Exten
             bit_offset %= 8;
         }
     }
-    hash += accumulate_generator(&acc, idx_generator);
+    scalars[idx_generator] = acc.to_repr();
 
-    hash
+    scalars
 }
 
 pub fn parallel_hash(depth: u8, layer: &[[u8; 32]], pairs: usize) -> Vec<[u8; 32]> {
-    let hash_extended: Vec<_> = (0..pairs)
-        .into_par_iter()
-        .map(|i| hash_combine_inner(depth, &layer[2 * i], &layer[2 * i + 1]))
+    let batch_size = batch_size(pairs);
+    let hash_extended: Vec<_> = layer[..2 * pairs]
+        .par_chunks(2 * batch_size)
+        .flat_map_iter(|batch| {
+            let pairs = batch
+                .chunks_exact(2)
+                .map(|p| (&p[0], &p[1]))
+                .collect::<Vec<_>>();
+            hash_combine_batch(depth, &pairs)
+        })
         .collect();
     hash_normalize(&hash_extended)
 }
@@ -124,33 +161,44 @@ fn hash_normalize(extended: &[ExtendedPoint]) -> Vec<[u8; 32]> {
     hash_affine.iter().map(|p| p.get_u().to_repr()).collect()
 }
 
-pub fn parallel_hash_opt(depth: u8, layer: &[Option<Hash>], pairs: usize) -> Vec<Option<Hash>> {
-    let hash_extended: Vec<Option<ExtendedPoint>> = (0..pairs)
-        .into_par_iter()
-        .map(|i| {
-            let l = &layer[2 * i];
-            let r = &layer[2 * i + 1];
-            match (l, r) {
-                (Some(l), Some(r)) => Some(hash_combine_inner(depth, l, r)),
-                _ => None,
+pub fn parallel_hash_opt(
+    depth: u8,
+    layer: &[Option<Hash>],
+    pairs: usize,
+    out: &mut Vec<Option<Hash>>,
+) {
+    let start = out.len();
+    out.resize(start + pairs, None);
+    let batch_size = batch_size(pairs);
+    out[start..]
+        .par_chunks_mut(batch_size)
+        .enumerate()
+        .for_each(|(ib, hashes)| {
+            let offset = ib * batch_size;
+            let layer = &layer[2 * offset..2 * (offset + hashes.len())];
+            let pairs = layer
+                .chunks_exact(2)
+                .filter_map(|p| match (&p[0], &p[1]) {
+                    (Some(l), Some(r)) => Some((l, r)),
+                    _ => None,
+                })
+                .collect::<Vec<_>>();
+
+            let ext = hash_combine_batch(depth, &pairs);
+            let mut hash_affine = vec![AffinePoint::identity(); ext.len()];
+            ExtendedPoint::batch_normalize(&ext, &mut hash_affine);
+            let mut h_cursor = hash_affine.iter();
+
+            for (h, p) in hashes.iter_mut().zip(layer.chunks_exact(2)) {
+                *h = match (&p[0], &p[1]) {
+                    (Some(_), Some(_)) => {
+                        let ep = h_cursor.next().unwrap();
+                        Some(ep.get_u().to_repr())
+                    }
+                    _ => None,
+                };
             }
-        })
-        .collect();
-
-    let ext = hash_extended.iter().flatten().cloned().collect::<Vec<_>>();
-    let mut hash_affine = vec![AffinePoint::identity(); ext.len()];
-    ExtendedPoint::batch_normalize(&ext, &mut hash_affine);
-    let mut h_cursor = hash_affine.iter();
-
-    hash_extended
-        .iter()
-        .map(|n| {
-            n.map(|_| {
-                let ep = h_cursor.next().unwrap();
-                ep.get_u().to_repr()
-            })
-        })
-        .collect::<Vec<_>>()
+        });
 }
 
 fn read_generators_bin() -> Vec<ExtendedNielsPoint> {
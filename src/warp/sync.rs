@@ -1,26 +1,34 @@
 use std::{
+    collections::{HashSet, VecDeque},
     fs::File,
-    io::{BufReader, BufWriter, Read, Write},
+    io::BufWriter,
+    sync::Arc,
 };
 
 use crate::{
     coin::{connect_lwd, CoinDef},
     db::{
-        account::{list_account_transparent_addresses, list_accounts},
+        account::{list_account_transparent_addresses, list_accounts, TransparentDerPath},
         account_manager::extend_transparent_addresses,
-        chain::{get_block_header, get_sync_height, rewind_checkpoint, store_block},
+        chain::{
+            get_block_header, get_stored_tree_state, get_sync_height, rewind_checkpoint,
+            store_block,
+        },
         notes::{
-            mark_shielded_spent, recover_expired_spends, store_received_note,
+            has_pending_spends, mark_shielded_spent, recover_expired_spends, store_received_note,
             update_account_balances, update_tx_timestamp,
         },
         tx::{
             add_tx_value, copy_block_times_from_tx, drop_transparent_data,
             list_unknown_height_timestamps, store_block_time, update_tx_time, update_tx_values,
         },
+        tune_for_sync,
     },
     fb_unwrap,
+    job::report_progress,
     lwd::{
-        get_compact_block, get_compact_block_range, get_transparent, get_tree_state,
+        get_compact_block, get_compact_block_range, get_compact_block_range_filtered,
+        get_tree_state,
         rpc::CompactBlock,
     },
     network::Network,
@@ -29,39 +37,48 @@ use crate::{
     utils::chain::{get_activation_height, reset_chain},
     warp::{
         hasher::{OrchardHasher, SaplingHasher},
-        BlockHeader,
+        BlockHeader, Edge,
     },
     Client, Hash,
 };
 use anyhow::Result;
 use header::BlockHeaderStore;
-use lazy_static::lazy_static;
-use prost::Message;
+use prost::Message as _;
 use rusqlite::Connection;
 use serde::{Deserialize, Serialize};
 use serde_with::serde_as;
 use shielded::Synchronizer;
-use std::sync::Arc;
+use stats::SyncStats;
+use std::time::Instant;
 use thiserror::Error;
-use tokio::sync::{
-    mpsc::{channel, Sender},
-    Semaphore,
+use tokio::{
+    sync::{
+        mpsc::{channel, Receiver, Sender},
+        oneshot,
+    },
+    task::JoinHandle,
 };
 use tonic::transport::Channel;
 use tracing::info;
 use transparent::TransparentSync;
+use warp_file::{for_each_legacy_block, WarpFile, WarpFileWriter};
 use zcash_keys::encoding::AddressCodec;
 use zcash_primitives::legacy::TransparentAddress;
-use zip::unstable::{LittleEndianReadExt, LittleEndianWriteExt};
 
 use super::Witness;
 
 use warp_macros::c_export;
 
+#[cfg(feature = "bench")]
+pub mod bench;
 pub mod builder;
 mod header;
 mod shielded;
+pub mod scheduler;
+pub mod snapshot;
+pub mod stats;
 mod transparent;
+mod warp_file;
 
 #[derive(Error, Debug)]
 pub enum SyncError {
@@ -139,7 +156,7 @@ pub struct FullPlainNote {
     pub incoming: bool,
 }
 
-#[derive(Serialize, Deserialize, Debug)]
+#[derive(Clone, Serialize, Deserialize, Debug)]
 pub struct ReceivedNote {
     pub is_new: bool,
     pub id: u32,
@@ -171,216 +188,689 @@ pub async fn download_warp_blocks(
     tracing::info!("warp url {warp_url}");
     let mut client = connect_lwd(warp_url).await?;
     let dest = File::create(dest)?;
-    let mut dest = BufWriter::new(dest);
+    let mut dest = WarpFileWriter::new(BufWriter::new(dest))?;
     let start = get_activation_height(network)?;
     let mut blocks = get_compact_block_range(&mut client, start + 1, end - 1).await?;
     while let Some(block) = blocks.message().await? {
-        let v = block.encode_to_vec();
-        dest.write_u32_le(v.len() as u32)?;
-        dest.write_all(&*v)?;
+        dest.write_block(&block)?;
     }
+    dest.finish()?;
     Ok(())
 }
 
 pub trait CompactBlockSource: Clone {
+    // when true, every chunk is committed as its own checkpoint
+    // otherwise, only the end of the range is
     fn chunked(&self) -> bool;
 
-    fn run(self, start: u32, end: u32, sender: Sender<CompactBlock>) -> Result<()>;
+    // sends the blocks in (start, end] in order, the task ends with
+    // the error that stopped the stream, if any. The stream may end
+    // before `end` (a warp file stops below its end height), the
+    // blocks received are committed when the task succeeds
+    fn run(self, start: u32, end: u32, sender: Sender<CompactBlock>)
+        -> Result<JoinHandle<Result<()>>>;
 }
 
 #[derive(Clone)]
 pub struct LWDCompactBlockSource {
-    channel: Channel,
+    channels: Vec<Channel>,
+    concurrency: usize,
+    spam_filter_threshold: u32,
 }
 
 impl LWDCompactBlockSource {
-    pub fn new(channel: Channel) -> Result<Self> {
-        Ok(Self { channel })
+    /// Download from the given servers, with at most `concurrency`
+    /// block ranges in flight
+    pub fn new(channels: Vec<Channel>, concurrency: usize) -> Result<Self> {
+        if channels.is_empty() {
+            anyhow::bail!("No block server");
+        }
+        Ok(Self {
+            channels,
+            concurrency: concurrency.max(1),
+            spam_filter_threshold: 0,
+        })
+    }
+
+    /// Ask the servers to collapse the transactions with more than
+    /// `threshold` outputs into bridges, 0 to get every output
+    pub fn with_spam_filter(mut self, threshold: u32) -> Self {
+        self.spam_filter_threshold = threshold;
+        self
     }
 }
 
+// Number of blocks requested by a single stream
+const FETCH_SEGMENT_BLOCKS: u32 = 1_000;
+// Number of blocks a stream can get ahead of the consumer
+const FETCH_SEGMENT_BUFFER: usize = 100;
+
+fn fetch_segment(
+    server: Channel,
+    start: u32,
+    end: u32,
+    spam_filter_threshold: u32,
+) -> Receiver<Result<CompactBlock>> {
+    let (tx, rx) = channel(FETCH_SEGMENT_BUFFER);
+    tokio::spawn(async move {
+        let r = async {
+            let mut client = Client::new(server);
+            let mut range =
+                get_compact_block_range_filtered(&mut client, start, end, spam_filter_threshold)
+                    .await?;
+            while let Some(block) = range.message().await? {
+                tx.send(Ok(block)).await?;
+            }
+            Ok::<_, anyhow::Error>(())
+        }
+        .await;
+        if let Err(e) = r {
+            let _ = tx.send(Err(e)).await;
+        }
+    });
+    rx
+}
+
 impl CompactBlockSource for LWDCompactBlockSource {
     fn chunked(&self) -> bool {
         true
     }
 
-    fn run(self, start: u32, end: u32, sender: Sender<CompactBlock>) -> Result<()> {
-        tokio::spawn(async move {
-            let mut client = Client::new(self.channel.clone());
-            let mut range = get_compact_block_range(&mut client, start + 1, end).await?;
-            while let Some(block) = range.message().await? {
-                sender.send(block).await?;
+    fn run(
+        self,
+        start: u32,
+        end: u32,
+        sender: Sender<CompactBlock>,
+    ) -> Result<JoinHandle<Result<()>>> {
+        let task = tokio::spawn(async move {
+            let r = async {
+                // split (start, end] into segments fetched in parallel
+                // over the servers, and forward them in order
+                let mut segments = (start + 1..=end)
+                    .step_by(FETCH_SEGMENT_BLOCKS as usize)
+                    .enumerate()
+                    .map(|(i, s)| {
+                        let server = self.channels[i % self.channels.len()].clone();
+                        (server, s, (s + FETCH_SEGMENT_BLOCKS - 1).min(end))
+                    });
+                let mut pending = VecDeque::new();
+                let mut height = start + 1;
+                loop {
+                    while pending.len() < self.concurrency {
+                        match segments.next() {
+                            Some((server, s, e)) => pending.push_back((
+                                e,
+                                fetch_segment(server, s, e, self.spam_filter_threshold),
+                            )),
+                            None => break,
+                        }
+                    }
+                    let Some((e, mut segment)) = pending.pop_front() else {
+                        break;
+                    };
+                    while let Some(block) = segment.recv().await {
+                        let block = block?;
+                        if block.height as u32 != height {
+                            anyhow::bail!(
+                                "Unexpected block {} (expected {})",
+                                block.height,
+                                height
+                            );
+                        }
+                        height += 1;
+                        sender.send(block).await?;
+                    }
+                    if height != e + 1 {
+                        anyhow::bail!("Incomplete block range, stopped @{}", height);
+                    }
+                }
+                Ok::<_, anyhow::Error>(())
             }
-            Ok::<_, anyhow::Error>(())
+            .await;
+            if let Err(e) = &r {
+                tracing::error!("Block download failed: {e}");
+            }
+            r
         });
-        Ok(())
+        Ok(task)
     }
 }
 
+// Number of outputs (incl. bridged ones) after which we
+// hand the accumulated blocks to the decrypter
+const OUTPUTS_PER_CHUNK: usize = 1_000_000;
+// Trial decryptions after which we hand the accumulated blocks to the
+// decrypter, so that a wallet with many accounts still commits regularly
+const DECRYPTIONS_PER_CHUNK: usize = 50_000_000;
+// Outputs of a bridge count as 1/BRIDGE_COST_DIVISOR of a decrypted output,
+// they are only hashed and their slots are mostly empty
+const BRIDGE_COST_DIVISOR: usize = 16;
+
+// With a memory budget, a chunk is also cut when the estimated size of
+// its blocks and layers reaches half the budget. The other half is left
+// for the notes, the blocks in flight and the checkpoint being written
+// Decoded blocks take about twice their encoded size
+const DECODED_BLOCK_FACTOR: usize = 2;
+// slots of an output in the two layer buffers
+const BYTES_PER_OUTPUT: usize = 2 * std::mem::size_of::<Option<Hash>>();
+
+// Max number of blocks of a warp_synchronize call
+const SYNC_WINDOW: u32 = 100_000;
+
+// State handed from the decrypt/hash stage to the persist stage
+struct SyncCheckpoint {
+    header: BlockHeader,
+    sapling_notes: Vec<ReceivedNote>,
+    sapling_stored: Vec<Option<u32>>,
+    sapling_spends: Vec<(TxValueUpdate, IdSpent<Hash>)>,
+    sapling_edge: Edge,
+    orchard_notes: Vec<ReceivedNote>,
+    orchard_stored: Vec<Option<u32>>,
+    orchard_spends: Vec<(TxValueUpdate, IdSpent<Hash>)>,
+    orchard_edge: Edge,
+    headers: BlockHeaderStore,
+}
+
+// Ids of the notes committed by the previous checkpoints of a sync
+// The synchronizers only append notes, so the notes of a checkpoint
+// start with those of the previous one, in the same order
+#[derive(Default)]
+struct CommittedNoteIds {
+    sapling: Vec<u32>,
+    orchard: Vec<u32>,
+}
+
+// Give the notes already committed their ids
+fn fill_note_ids(notes: &mut [ReceivedNote], ids: &[u32]) {
+    for (n, &id) in notes.iter_mut().zip(ids.iter()) {
+        if n.id == 0 {
+            n.id = id;
+        }
+    }
+}
+
+impl SyncCheckpoint {
+    fn new(
+        header: &BlockHeader,
+        sap_dec: &mut SaplingSync,
+        orch_dec: &mut OrchardSync,
+        header_dec: &mut BlockHeaderStore,
+    ) -> Self {
+        let (sapling_notes, sapling_stored, sapling_spends) = sap_dec.checkpoint();
+        let (orchard_notes, orchard_stored, orchard_spends) = orch_dec.checkpoint();
+        SyncCheckpoint {
+            header: header.clone(),
+            sapling_notes,
+            sapling_stored,
+            sapling_spends,
+            sapling_edge: sap_dec.tree_state.clone(),
+            orchard_notes,
+            orchard_stored,
+            orchard_spends,
+            orchard_edge: orch_dec.tree_state.clone(),
+            headers: header_dec.take_found(),
+        }
+    }
+}
+
+/// Sync pipeline
+///
+/// - the block source downloads on its own tokio task,
+/// - the decrypt stage runs on a blocking thread (and fans out on rayon),
+/// - the persist stage verifies and commits the checkpoints.
+///
+/// The queues between the stages are bounded so that the next chunk
+/// streams in while the current one is hashed and written.
 pub async fn warp_sync<BS: CompactBlockSource + 'static>(
     coin: &CoinDef,
     start: CheckpointHeight,
     end: u32,
     source: BS,
 ) -> Result<(), SyncError> {
-    tracing::info!("{:?}-{}", start, end);
-    let permit = SYNC_LOCK.acquire().await;
+    let permit = coin.sync_lock.acquire().await;
     if !permit.is_ok() {
         return Ok(());
     }
+    warp_sync_locked(coin, start, end, source).await
+}
+
+// warp_sync for a caller that holds the sync_lock of the coin
+pub(crate) async fn warp_sync_locked<BS: CompactBlockSource + 'static>(
+    coin: &CoinDef,
+    start: CheckpointHeight,
+    end: u32,
+    source: BS,
+) -> Result<(), SyncError> {
+    tracing::info!("{:?}-{}", start, end);
+    let stats = coin.sync_stats.clone();
+    stats.start(start.0, end);
     let mut connection = coin.connection()?;
+    tune_for_sync(&connection)?;
     let mut client = coin.connect_lwd()?;
-    let (sapling_state, orchard_state) = get_tree_state(&mut client, start.into()).await?;
-
     let sap_hasher = SaplingHasher::default();
-    let mut sap_dec = SaplingSync::new(
+    let orch_hasher = OrchardHasher::default();
+    // a wallet bootstrapped from a snapshot has the trees of its start height
+    let ((sapling_size, sapling_edge), (orchard_size, orchard_edge)) =
+        match get_stored_tree_state(&connection, start.0)? {
+            Some(trees) => trees,
+            None => {
+                let (s, o) = get_tree_state(&mut client, start.into()).await?;
+                (
+                    (s.size() as u32, s.to_edge(&sap_hasher)),
+                    (o.size() as u32, o.to_edge(&orch_hasher)),
+                )
+            }
+        };
+
+    let sap_dec = SaplingSync::new(
         coin,
         &coin.network,
         &connection,
         start,
-        sapling_state.size() as u32,
-        sapling_state.to_edge(&sap_hasher),
+        sapling_size,
+        sapling_edge,
     )?;
 
-    let orch_hasher = OrchardHasher::default();
-    let mut orch_dec = OrchardSync::new(
+    let orch_dec = OrchardSync::new(
         coin,
         &coin.network,
         &connection,
         start,
-        orchard_state.size() as u32,
-        orchard_state.to_edge(&orch_hasher),
+        orchard_size,
+        orchard_edge,
     )?;
 
+    // The transparent scan runs alongside the shielded stages
+    // Its result is only needed when the first checkpoint is committed
     tracing::info!("Transparent Sync...");
     let mut trp_dec = TransparentSync::new(&coin.network, &connection)?;
+    let transparent = {
+        let client = client.clone();
+        let concurrency = coin.download_concurrency();
+        tokio::spawn(async move {
+            let addresses = trp_dec.addresses.clone();
+            trp_dec
+                .scan_addresses(&client, &addresses, start.0 + 1, end, concurrency)
+                .await?;
+            Ok::<_, anyhow::Error>(trp_dec)
+        })
+    };
 
-    let addresses = trp_dec.addresses.clone();
-    for (path, taddr) in addresses.into_iter() {
-        let txs = get_transparent(
-            &coin.network,
+    tracing::info!("Shielded Sync...");
+    // the transparent heights come later, until then keep all the headers
+    let header_dec = BlockHeaderStore::new_keep_all();
+    let (heights_sender, heights_recv) = oneshot::channel::<HashSet<u32>>();
+
+    let bh = get_block_header(&connection, start.into())?;
+    let prev_hash = bh.hash;
+
+    // under a memory budget, every chunk is committed so that
+    // its state does not pile up until the end of the range
+    let memory_limit = coin.memory_limit();
+    let chunked = source.chunked() || memory_limit > 0;
+    let (block_sender, block_recv) = channel::<CompactBlock>(20);
+    let (checkpoint_sender, mut checkpoint_recv) = channel::<SyncCheckpoint>(1);
+    // blocks with filtered transactions that may involve the wallet are
+    // downloaded again in full from the lwd server
+    let refetch = if coin.config.spam_filter_threshold > 0 && coin.config.spam_refetch {
+        Some(Refetch {
+            client: client.clone(),
+            handle: tokio::runtime::Handle::current(),
+            pending_txids: coin.unconfirmed.lock().txids(),
+            pending_orchard_spends: has_pending_spends(&connection, true)?,
+        })
+    } else {
+        None
+    };
+    let source_task = source.run(start.0, end, block_sender)?;
+    let decrypt_stats = stats.clone();
+    let handle = tokio::runtime::Handle::current();
+    let decrypter = tokio::task::spawn_blocking(move || {
+        run_decrypt_stage(
+            sap_dec,
+            orch_dec,
+            header_dec,
+            decrypt_stats,
+            heights_recv,
+            refetch,
+            prev_hash,
+            (handle, source_task),
+            chunked,
+            memory_limit / 2,
+            block_recv,
+            checkpoint_sender,
+        )
+    });
+
+    let mut trp_dec = transparent.await.map_err(anyhow::Error::new)??;
+    tracing::info!("BH {:?}", trp_dec.heights);
+    let _ = heights_sender.send(trp_dec.heights.clone());
+
+    let mut note_ids = CommittedNoteIds::default();
+    while let Some(checkpoint) = checkpoint_recv.recv().await {
+        let height = checkpoint.header.height;
+        let commit_start = Instant::now();
+        commit_checkpoint(
+            coin,
+            &mut connection,
             &mut client,
-            path.account,
-            path.external,
-            path.addr_index,
-            taddr,
-            start.0 + 1,
-            end,
+            &sap_hasher,
+            &orch_hasher,
+            &mut trp_dec,
+            &mut note_ids,
+            checkpoint,
         )
         .await?;
-        let address = taddr.encode(&coin.network);
-        trp_dec.process_txs(&address, &txs)?;
+        stats.committed(height, commit_start.elapsed());
+        report_progress(height);
     }
 
-    tracing::info!("Shielded Sync...");
-    let heights = &trp_dec.heights;
-    let mut header_dec = BlockHeaderStore::new();
-    tracing::info!("BH {:?}", heights);
-    header_dec.add_heights(heights.iter())?;
+    match decrypter.await.map_err(anyhow::Error::new)? {
+        Err(SyncError::Reorg(height)) => {
+            stats.reorg();
+            rewind_checkpoint(&coin.network, &mut connection, &mut client).await?;
+            return Err(SyncError::Reorg(height));
+        }
+        Err(e) => return Err(e),
+        Ok(_) => {}
+    }
+    tracing::info!("Sync finished");
 
-    let bh = get_block_header(&connection, start.into())?;
-    let mut prev_hash = bh.hash;
+    Ok(())
+}
 
+fn run_decrypt_stage(
+    mut sap_dec: SaplingSync,
+    mut orch_dec: OrchardSync,
+    mut header_dec: BlockHeaderStore,
+    stats: Arc<SyncStats>,
+    heights_recv: oneshot::Receiver<HashSet<u32>>,
+    mut refetch: Option<Refetch>,
+    mut prev_hash: Hash,
+    (handle, source_task): (tokio::runtime::Handle, JoinHandle<Result<()>>),
+    chunked: bool,
+    chunk_budget: usize,
+    mut block_recv: Receiver<CompactBlock>,
+    checkpoint_sender: Sender<SyncCheckpoint>,
+) -> Result<(), SyncError> {
+    let accounts = sap_dec.account_infos.len().max(orch_dec.account_infos.len());
+    let mut heights_recv = Some(heights_recv);
+    let mut wallet_heights: Option<HashSet<u32>> = None;
     let mut bs = vec![];
     let mut bh = BlockHeader::default();
     let mut c = 0;
-    let chunked = source.chunked();
-    let (block_sender, mut block_recv) = channel::<CompactBlock>(20);
-    source.run(start.0, end, block_sender)?;
-    while let Some(block) = block_recv.recv().await {
-        bh = BlockHeader {
-            height: block.height as u32,
-            hash: block.hash.clone().try_into().unwrap(),
-            prev_hash: block.prev_hash.clone().try_into().unwrap(),
-            timestamp: block.time,
-        };
+    let mut cost = 0;
+    let mut size = 0;
+    let mut pending = false;
+    while let Some(mut block) = block_recv.blocking_recv() {
+        if wallet_heights.is_none() {
+            // a filtered block can only be checked against the heights
+            // of the wallet once the transparent scan has them
+            let wait = refetch.is_some() && has_bridges(&block);
+            let heights = match heights_recv.take() {
+                Some(recv) if wait => recv.blocking_recv().ok(),
+                Some(mut recv) => match recv.try_recv() {
+                    Ok(heights) => Some(heights),
+                    Err(_) => {
+                        heights_recv = Some(recv);
+                        None
+                    }
+                },
+                None => None,
+            };
+            if let Some(heights) = heights {
+                header_dec.set_heights(&heights)?;
+                wallet_heights = Some(heights);
+            }
+        }
+        if let Some(refetch) = &mut refetch {
+            if refetch.is_needed(&block, wallet_heights.as_ref(), &sap_dec) {
+                let height = block.height as u32;
+                info!("Refetch filtered block {}", height);
+                block = refetch
+                    .handle
+                    .block_on(get_compact_block(&mut refetch.client, height))?;
+            }
+        }
+
+        stats.downloaded(&block);
+        bh = BlockHeader::from(&block);
         if prev_hash != bh.prev_hash {
-            rewind_checkpoint(&coin.network, &mut connection, &mut client).await?;
             return Err(SyncError::Reorg(bh.height));
         }
         prev_hash = bh.hash;
 
         header_dec.process(&bh)?;
-        for vtx in block.vtx.iter() {
-            c += vtx.outputs.len();
-            c += vtx.actions.len();
-            for b in [&vtx.sapling_bridge, &vtx.orchard_bridge] {
-                if let Some(b) = b {
-                    c += b.len as usize;
-                }
-            }
-        }
+        let (slots, block_cost) = block_cost(&block, accounts);
+        c += slots;
+        cost += block_cost;
 
-        let height = block.height;
+        if chunk_budget > 0 {
+            size += block.encoded_len() * DECODED_BLOCK_FACTOR;
+        }
         bs.push(block);
+        pending = true;
 
-        if c >= 1000000 {
-            info!("Height {}", height);
-            sap_dec.add(&bs)?;
-            orch_dec.add(&bs)?;
+        let over_budget = chunk_budget > 0 && size + c * BYTES_PER_OUTPUT >= chunk_budget;
+        if c >= OUTPUTS_PER_CHUNK || cost >= DECRYPTIONS_PER_CHUNK || over_budget {
+            info!("Height {}", bh.height);
+            add_blocks(&mut sap_dec, &mut orch_dec, &bs, &stats)?;
             bs.clear();
             c = 0;
+            cost = 0;
+            size = 0;
             if chunked {
-                break;
+                let checkpoint =
+                    SyncCheckpoint::new(&bh, &mut sap_dec, &mut orch_dec, &mut header_dec);
+                pending = false;
+                stats.checkpoint_sent();
+                if checkpoint_sender.blocking_send(checkpoint).is_err() {
+                    // the persist stage failed and reports the error
+                    return Ok(());
+                }
+            }
+        }
+    }
+    // a source that failed ends the stream early, its last
+    // blocks must not be committed as the end of the range
+    handle
+        .block_on(source_task)
+        .map_err(anyhow::Error::new)??;
+    add_blocks(&mut sap_dec, &mut orch_dec, &bs, &stats)?;
+
+    if pending {
+        let checkpoint = SyncCheckpoint::new(&bh, &mut sap_dec, &mut orch_dec, &mut header_dec);
+        stats.checkpoint_sent();
+        let _ = checkpoint_sender.blocking_send(checkpoint);
+    }
+    Ok(())
+}
+
+// With a spam filter, the server replaces the outputs and the Orchard
+// actions of the large transactions by bridges. Their notes cannot be
+// decrypted, and their Orchard nullifiers are gone. A filtered tx is
+// downloaded again in full when it may be one of the wallet:
+// - its block has a transparent tx of the wallet,
+// - it is a pending tx of the wallet (seen in the mempool),
+// - one of its Sapling spends is a note of the wallet (the change
+// is in the bridge),
+// - it has Orchard actions while the wallet has unmined Orchard spends.
+// A filtered tx that only pays the wallet with shielded notes matches
+// none of these: the threshold can hide incoming shielded notes
+struct Refetch {
+    client: Client,
+    handle: tokio::runtime::Handle,
+    pending_txids: HashSet<Hash>,
+    pending_orchard_spends: bool,
+}
+
+impl Refetch {
+    fn is_needed(
+        &self,
+        block: &CompactBlock,
+        wallet_heights: Option<&HashSet<u32>>,
+        sap_dec: &SaplingSync,
+    ) -> bool {
+        if !has_bridges(block) {
+            return false;
+        }
+        if let Some(heights) = wallet_heights {
+            if heights.contains(&(block.height as u32)) {
+                return true;
+            }
+        }
+        block
+            .vtx
+            .iter()
+            .filter(|vtx| vtx.sapling_bridge.is_some() || vtx.orchard_bridge.is_some())
+            .any(|vtx| {
+                <Hash>::try_from(&*vtx.hash)
+                    .map(|txid| self.pending_txids.contains(&txid))
+                    .unwrap_or(false)
+                    || vtx.spends.iter().any(|sp| sap_dec.has_nullifier(&sp.nf))
+                    || (vtx.orchard_bridge.is_some() && self.pending_orchard_spends)
+            })
+    }
+}
+
+fn has_bridges(block: &CompactBlock) -> bool {
+    block
+        .vtx
+        .iter()
+        .any(|vtx| vtx.sapling_bridge.is_some() || vtx.orchard_bridge.is_some())
+}
+
+// Slots in the note commitment trees (incl. bridged outputs)
+// and decryption cost of a block for a wallet of `accounts` accounts
+// Every output is tried against every account and then hashed
+fn block_cost(block: &CompactBlock, accounts: usize) -> (usize, usize) {
+    let mut slots = 0;
+    let mut cost = 0;
+    for vtx in block.vtx.iter() {
+        let outputs = vtx.outputs.len() + vtx.actions.len();
+        slots += outputs;
+        cost += outputs * (accounts + 1);
+        for b in [&vtx.sapling_bridge, &vtx.orchard_bridge] {
+            if let Some(b) = b {
+                slots += b.len as usize;
+                cost += b.len as usize / BRIDGE_COST_DIVISOR;
             }
         }
     }
-    sap_dec.add(&bs)?;
-    orch_dec.add(&bs)?;
+    (slots, cost)
+}
+
+// Sapling and Orchard are independent, process them side by side
+// and let rayon balance the workers between the two
+fn add_blocks(
+    sap_dec: &mut SaplingSync,
+    orch_dec: &mut OrchardSync,
+    blocks: &[CompactBlock],
+    stats: &SyncStats,
+) -> Result<()> {
+    if blocks.is_empty() {
+        return Ok(());
+    }
+    let start = Instant::now();
+    let ((rs, ts), (ro, to)) = rayon::join(
+        || {
+            let start = Instant::now();
+            (sap_dec.add(blocks), start.elapsed())
+        },
+        || {
+            let start = Instant::now();
+            (orch_dec.add(blocks), start.elapsed())
+        },
+    );
+    info!("Sapling {} ms, Orchard {} ms", ts.as_millis(), to.as_millis());
+    stats.decrypted(blocks, start.elapsed());
+    rs?;
+    ro?;
+    Ok(())
+}
+
+async fn commit_checkpoint(
+    coin: &CoinDef,
+    connection: &mut Connection,
+    client: &mut Client,
+    sap_hasher: &SaplingHasher,
+    orch_hasher: &OrchardHasher,
+    trp_dec: &mut TransparentSync,
+    note_ids: &mut CommittedNoteIds,
+    checkpoint: SyncCheckpoint,
+) -> Result<()> {
+    let SyncCheckpoint {
+        header: bh,
+        mut sapling_notes,
+        sapling_stored,
+        sapling_spends,
+        sapling_edge,
+        mut orchard_notes,
+        orchard_stored,
+        orchard_spends,
+        orchard_edge,
+        mut headers,
+    } = checkpoint;
+    // drop the headers kept before the transparent heights were known
+    headers.retain_heights(&trp_dec.heights);
 
     // Verification
-    let (s, o) = get_tree_state(&mut client, CheckpointHeight(bh.height as u32)).await?;
-    let r = s.to_edge(&sap_dec.hasher).root(&sap_dec.hasher);
-    let r2 = sap_dec.tree_state.root(&sap_dec.hasher);
+    let (s, o) = get_tree_state(client, CheckpointHeight(bh.height)).await?;
+    let r = s.to_edge(sap_hasher).root(sap_hasher);
+    let r2 = sapling_edge.root(sap_hasher);
     info!("s_root {}", hex::encode(&r));
     assert_eq!(r, r2);
-    let r = o.to_edge(&orch_dec.hasher).root(&orch_dec.hasher);
-    let r2 = orch_dec.tree_state.root(&orch_dec.hasher);
+    let r = o.to_edge(orch_hasher).root(orch_hasher);
+    let r2 = orchard_edge.root(orch_hasher);
     assert_eq!(r, r2);
     info!("o_root {}", hex::encode(&r));
 
-    if bh.height != 0 {
-        let db_tx = connection.transaction().map_err(anyhow::Error::new)?;
-
-        store_received_note(&db_tx, bh.height, &*sap_dec.notes)?;
-        for (tx_value, spend) in sap_dec.spends.iter() {
-            add_tx_value(&db_tx, tx_value)?;
-            mark_shielded_spent(&db_tx, spend)?;
-        }
+    let db_tx = connection.transaction()?;
 
-        store_received_note(&db_tx, bh.height, &*orch_dec.notes)?;
-        for (tx_value, spend) in orch_dec.spends.iter() {
-            add_tx_value(&db_tx, tx_value)?;
-            mark_shielded_spent(&db_tx, spend)?;
-        }
+    fill_note_ids(&mut sapling_notes, &note_ids.sapling);
+    store_received_note(&db_tx, bh.height, &mut sapling_notes, &sapling_stored)?;
+    for (tx_value, spend) in sapling_spends.iter() {
+        add_tx_value(&db_tx, tx_value)?;
+        mark_shielded_spent(&db_tx, spend)?;
+    }
 
-        trp_dec.flush(&db_tx)?;
+    fill_note_ids(&mut orchard_notes, &note_ids.orchard);
+    store_received_note(&db_tx, bh.height, &mut orchard_notes, &orchard_stored)?;
+    for (tx_value, spend) in orchard_spends.iter() {
+        add_tx_value(&db_tx, tx_value)?;
+        mark_shielded_spent(&db_tx, spend)?;
+    }
 
-        update_tx_timestamp(&db_tx, header_dec.heights.values())?;
+    trp_dec.flush(&db_tx, bh.height)?;
 
-        store_block(&db_tx, &bh)?;
-        update_account_balances(&db_tx)?;
+    update_tx_timestamp(&db_tx, headers.heights.values())?;
 
-        // Save block times
-        header_dec.save(&db_tx)?;
-        copy_block_times_from_tx(&db_tx)?;
+    store_block(&db_tx, &bh)?;
+    update_account_balances(&db_tx)?;
 
-        let accounts = list_accounts(coin, &db_tx)?;
-        for a in accounts.items.unwrap() {
-            extend_transparent_addresses(&coin.network, &db_tx, a.id, 0)?;
-            extend_transparent_addresses(&coin.network, &db_tx, a.id, 1)?;
-        }
+    // Save block times
+    headers.save(&db_tx)?;
+    copy_block_times_from_tx(&db_tx)?;
 
-        recover_expired_spends(&db_tx, bh.height)?;
-        db_tx.commit().map_err(anyhow::Error::new)?;
+    let accounts = list_accounts(coin, &db_tx)?;
+    for a in accounts.items.unwrap() {
+        extend_transparent_addresses(&coin.network, &db_tx, a.id, 0)?;
+        extend_transparent_addresses(&coin.network, &db_tx, a.id, 1)?;
     }
-    tracing::info!("Sync finished");
 
+    recover_expired_spends(&db_tx, bh.height)?;
+    db_tx.commit()?;
+    // the next checkpoints have these notes again, without their ids
+    note_ids.sapling = sapling_notes.iter().map(|n| n.id).collect();
+    note_ids.orchard = orchard_notes.iter().map(|n| n.id).collect();
+    info!("Checkpoint @{}", bh.height);
     Ok(())
 }
 
-#[c_export]
-pub async fn warp_synchronize(coin: &CoinDef, end_height: u32) -> Result<()> {
+/// The range (start, end] of the next warp_synchronize call, None if
+/// the wallet is already at `end_height`. A new wallet is first reset
+/// to the activation height
+pub(crate) async fn next_sync_range(coin: &CoinDef, end_height: u32) -> Result<Option<(u32, u32)>> {
     let mut connection = coin.connection()?;
     let start_height = get_sync_height(&connection)?.height;
     if start_height == 0 {
@@ -394,17 +884,32 @@ pub async fn warp_synchronize(coin: &CoinDef, end_height: u32) -> Result<()> {
         )
         .await?;
     }
-    if start_height < end_height {
-        let end_height = (start_height + 100_000).min(end_height);
-        let channel = if end_height < coin.config.warp_end_height {
-            let url = fb_unwrap!(coin.config.warp_url);
-            tracing::info!("Using Warp block server @ {}", url);
-            let ep = Channel::from_shared(url.clone()).unwrap();
-            ep.connect().await?
-        } else {
-            fb_unwrap!(coin.channel).clone()
-        };
-        let bs = LWDCompactBlockSource::new(channel)?;
+    if start_height >= end_height {
+        return Ok(None);
+    }
+    Ok(Some((start_height, (start_height + SYNC_WINDOW).min(end_height))))
+}
+
+/// Block source of the coin servers, with the warp server first
+/// while the range is below its end height
+pub(crate) async fn lwd_block_source(coin: &CoinDef, end_height: u32) -> Result<LWDCompactBlockSource> {
+    let lwd_channel = fb_unwrap!(coin.channel).clone();
+    let channels = if end_height < coin.config.warp_end_height {
+        let url = fb_unwrap!(coin.config.warp_url);
+        tracing::info!("Using Warp block server @ {}", url);
+        let ep = Channel::from_shared(url.clone()).unwrap();
+        vec![ep.connect().await?, lwd_channel]
+    } else {
+        vec![lwd_channel]
+    };
+    let source = LWDCompactBlockSource::new(channels, coin.download_concurrency())?;
+    Ok(source.with_spam_filter(coin.config.spam_filter_threshold))
+}
+
+#[c_export]
+pub async fn warp_synchronize(coin: &CoinDef, end_height: u32) -> Result<()> {
+    if let Some((start_height, end_height)) = next_sync_range(coin, end_height).await? {
+        let bs = lwd_block_source(coin, end_height).await?;
         warp_sync(&coin, CheckpointHeight(start_height), end_height, bs).await?;
     }
     Ok(())
@@ -420,19 +925,25 @@ impl CompactBlockSource for FileCompactBlockSource {
         false
     }
 
-    fn run(self, _start: u32, _end: u32, sender: Sender<CompactBlock>) -> Result<()> {
-        tokio::spawn(async move {
+    fn run(
+        self,
+        start: u32,
+        end: u32,
+        sender: Sender<CompactBlock>,
+    ) -> Result<JoinHandle<Result<()>>> {
+        let task = tokio::task::spawn_blocking(move || {
             let file = File::open(self.file)?;
-            let mut reader = BufReader::new(file);
-            while let Ok(size) = reader.read_u32_le() {
-                let mut buf = vec![0u8; size as usize];
-                reader.read_exact(&mut buf)?;
-                let block = CompactBlock::decode(&*buf)?;
-                sender.send(block).await?;
+            let send = |block: CompactBlock| {
+                sender.blocking_send(block)?;
+                Ok(())
+            };
+            match WarpFile::open(&file)? {
+                Some(warp_file) => warp_file.for_each_block(start, end, send)?,
+                None => for_each_legacy_block(file, start, end, send)?,
             }
             Ok::<_, anyhow::Error>(())
         });
-        Ok(())
+        Ok(task)
     }
 }
 
@@ -442,14 +953,21 @@ pub async fn warp_synchronize_from_file(coin: &CoinDef, file: &str) -> Result<()
         file: file.to_string(),
     };
     let activation = get_activation_height(&coin.network)?;
-    {
+    let start = {
         let mut connection = coin.connection()?;
-        let mut client = coin.connect_lwd()?;
-        reset_chain(&coin.network, &mut connection, &mut client, activation).await?;
-    }
+        // resume from a loaded snapshot instead of replaying from activation
+        let height = get_sync_height(&connection)?.height;
+        if height > activation && get_stored_tree_state(&connection, height)?.is_some() {
+            height
+        } else {
+            let mut client = coin.connect_lwd()?;
+            reset_chain(&coin.network, &mut connection, &mut client, activation).await?;
+            activation
+        }
+    };
     warp_sync(
         &coin,
-        CheckpointHeight(activation),
+        CheckpointHeight(start),
         coin.config.warp_end_height,
         source,
     )
@@ -459,6 +977,7 @@ pub async fn warp_synchronize_from_file(coin: &CoinDef, file: &str) -> Result<()
 
 #[c_export]
 pub async fn transparent_scan(
+    coin: &CoinDef,
     network: &Network,
     connection: &mut Connection,
     client: &mut Client,
@@ -472,24 +991,29 @@ pub async fn transparent_scan(
     if start >= end_height {
         return Ok(());
     }
-    let db_tx = connection.transaction()?;
-    for a in addresses {
-        let taddr = a.address.as_deref().unwrap();
-        let address = TransparentAddress::decode(network, taddr)?;
-        let txs = get_transparent(
-            network,
+    let addresses = addresses
+        .iter()
+        .map(|a| {
+            let path = TransparentDerPath {
+                account: a.account,
+                external: a.external,
+                addr_index: a.addr_index,
+            };
+            let address = TransparentAddress::decode(network, a.address.as_deref().unwrap())?;
+            Ok((path, address))
+        })
+        .collect::<Result<Vec<_>>>()?;
+    trp_dec
+        .scan_addresses(
             client,
-            a.account,
-            a.external,
-            a.addr_index,
-            address,
+            &addresses,
             start,
             end_height,
+            coin.download_concurrency(),
         )
         .await?;
-        trp_dec.process_txs(taddr, &*txs)?;
-    }
-    trp_dec.flush(&db_tx)?;
+    let db_tx = connection.transaction()?;
+    trp_dec.flush(&db_tx, end_height)?;
     update_tx_values(&db_tx)?;
 
     // there may be some block heights for which we don't have the time
@@ -514,6 +1038,109 @@ pub async fn transparent_scan(
     Ok(())
 }
 
-lazy_static! {
-    static ref SYNC_LOCK: Arc<Semaphore> = Arc::new(Semaphore::new(1));
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::db::create_schema;
+
+    fn block_hash(height: u32) -> Vec<u8> {
+        let mut hash = [0u8; 32];
+        hash[0..4].copy_from_slice(&height.to_le_bytes());
+        hash.to_vec()
+    }
+
+    // A warp file like download_warp_blocks writes: (start, end)
+    fn write_warp_file(name: &str, start: u32, end: u32) -> String {
+        let path = std::env::temp_dir().join(format!("{name}-{}.bin", std::process::id()));
+        let mut w = WarpFileWriter::new(BufWriter::new(File::create(&path).unwrap())).unwrap();
+        for height in start + 1..end {
+            let block = CompactBlock {
+                height: height as u64,
+                hash: block_hash(height),
+                prev_hash: block_hash(height - 1),
+                ..CompactBlock::default()
+            };
+            w.write_block(&block).unwrap();
+        }
+        w.finish().unwrap();
+        path.to_string_lossy().to_string()
+    }
+
+    // Run the source and the decrypt stage over (start, end] and
+    // return the heights of the checkpoints
+    fn sync_file(file: &str, start: u32, end: u32) -> Result<Vec<u32>, SyncError> {
+        let coin = CoinDef::from_network(0, Network::Main);
+        let mut connection = Connection::open_in_memory().unwrap();
+        create_schema(&mut connection, "").unwrap();
+        let sap_dec = SaplingSync::new(
+            &coin,
+            &coin.network,
+            &connection,
+            CheckpointHeight(start),
+            0,
+            Edge::default(),
+        )?;
+        let orch_dec = OrchardSync::new(
+            &coin,
+            &coin.network,
+            &connection,
+            CheckpointHeight(start),
+            0,
+            Edge::default(),
+        )?;
+        let source = FileCompactBlockSource {
+            file: file.to_string(),
+        };
+        let stats = coin.sync_stats.clone();
+        let runtime = coin.runtime.0.clone().unwrap();
+        runtime.block_on(async move {
+            let (block_sender, block_recv) = channel::<CompactBlock>(20);
+            let (checkpoint_sender, mut checkpoint_recv) = channel::<SyncCheckpoint>(1);
+            let (heights_sender, heights_recv) = oneshot::channel::<HashSet<u32>>();
+            let _ = heights_sender.send(HashSet::new());
+            let source_task = source.run(start, end, block_sender)?;
+            let handle = tokio::runtime::Handle::current();
+            let prev_hash = block_hash(start).try_into().unwrap();
+            let decrypter = tokio::task::spawn_blocking(move || {
+                run_decrypt_stage(
+                    sap_dec,
+                    orch_dec,
+                    BlockHeaderStore::new_keep_all(),
+                    stats,
+                    heights_recv,
+                    None,
+                    prev_hash,
+                    (handle, source_task),
+                    false,
+                    0,
+                    block_recv,
+                    checkpoint_sender,
+                )
+            });
+            let mut heights = vec![];
+            while let Some(checkpoint) = checkpoint_recv.recv().await {
+                heights.push(checkpoint.header.height);
+            }
+            decrypter.await.map_err(anyhow::Error::new)??;
+            Ok::<_, SyncError>(heights)
+        })
+    }
+
+    #[test]
+    fn sync_from_warp_file() {
+        let file = write_warp_file("warp-sync-file", 1_000, 3_500);
+        // the file stops one block below the end height
+        let heights = sync_file(&file, 1_000, 3_500).unwrap();
+        assert_eq!(heights, vec![3_499]);
+        let heights = sync_file(&file, 2_000, 3_500).unwrap();
+        assert_eq!(heights, vec![3_499]);
+        std::fs::remove_file(&file).unwrap();
+    }
+
+    #[test]
+    fn sync_from_missing_file() {
+        let file = std::env::temp_dir().join("warp-sync-missing.bin");
+        let r = sync_file(&file.to_string_lossy(), 1_000, 3_500);
+        assert!(matches!(r, Err(SyncError::Other(_))));
+    }
 }
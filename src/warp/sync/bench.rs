@@ -0,0 +1,442 @@
+use std::{
+    fs::File,
+    hint::black_box,
+    time::{Duration, Instant},
+};
+
+use anyhow::Result;
+use group::{ff::Field as _, ff::PrimeField as _, Curve as _, Group as _, GroupEncoding as _};
+use halo2_proofs::pasta::{pallas::Point, Fp};
+use orchard::keys::{FullViewingKey, Scope, SpendingKey};
+use rand::{
+    rngs::{OsRng, StdRng},
+    Rng as _, RngCore, SeedableRng as _,
+};
+use rusqlite::Connection;
+use sapling_crypto::SaplingIvk;
+
+use crate::{
+    coin::CoinDef,
+    data::fb::PacketsT,
+    db::{account_manager::create_new_account, create_schema, notes::store_received_note},
+    keys::generate_random_mnemonic_phrase,
+    lwd::rpc::{CompactBlock, CompactOrchardAction, CompactSaplingOutput, CompactTx},
+    types::CheckpointHeight,
+    utils::{
+        chain::get_activation_height,
+        data_split::{merge, split},
+    },
+    warp::{
+        hasher::{empty_roots, OrchardHasher, SaplingHasher},
+        Edge, Hasher, OrchardDecryptKey, SaplingDecryptKey, Witness, MERKLE_DEPTH,
+    },
+};
+
+use super::{
+    add_blocks, block_cost,
+    warp_file::{for_each_legacy_block, WarpFile, WarpFileWriter},
+    OrchardSync, ReceivedNote, ReceivedTx, SaplingSync, DECRYPTIONS_PER_CHUNK, OUTPUTS_PER_CHUNK,
+};
+
+// Throughput baselines of the warp hot paths, run by the `bench` command
+// The fixtures are shared with the criterion suite in benches/
+// Built with the `bench` feature only
+//
+// The hashers, tree roots, note storage and QR codec run on synthetic
+// data. The sync stages replay a warp block file against an in-memory
+// wallet of random accounts, none of which receives anything, so
+// the trial decryptions are the spam case. The outputs per block
+// are printed to tell apart files of different spam density
+// Synthetic block files of every density are generated from a seed,
+// so that the numbers can be reproduced without a recorded file
+
+fn report(stage: &str, count: usize, unit: &str, elapsed: Duration) {
+    let secs = elapsed.as_secs_f64();
+    println!(
+        "{stage:<28} {count:>10} {unit:<8} {:>10.1} ms {:>14.0} {unit}/s",
+        secs * 1000.0,
+        count as f64 / secs.max(1e-9),
+    );
+}
+
+fn timed<T>(f: impl FnOnce() -> T) -> (T, Duration) {
+    let start = Instant::now();
+    let r = f();
+    (r, start.elapsed())
+}
+
+fn bench_hasher<H: Hasher>(name: &str, h: &H, pairs: usize) {
+    let empty = h.empty();
+    let layer = vec![empty; 2 * pairs];
+    let n = pairs.min(10_000);
+    let (_, e) = timed(|| {
+        for i in 0..n {
+            black_box(h.combine(0, &layer[2 * i], &layer[2 * i + 1]));
+        }
+    });
+    report(&format!("{name} combine"), n, "hashes", e);
+    let (_, e) = timed(|| black_box(h.parallel_combine(0, &layer, pairs)));
+    report(&format!("{name} parallel_combine"), pairs, "hashes", e);
+
+    let layer = vec![Some(empty); 2 * pairs];
+    let mut out = Vec::with_capacity(pairs);
+    let (_, e) = timed(|| h.parallel_combine_opt(0, &layer, pairs, &mut out));
+    report(&format!("{name} parallel_combine_opt"), pairs, "hashes", e);
+
+    let edge = Edge([Some(empty); MERKLE_DEPTH as usize]);
+    let n = 1_000;
+    let (_, e) = timed(|| {
+        for _ in 0..n {
+            black_box(edge.root(h));
+        }
+    });
+    report(&format!("{name} Edge::root"), n, "roots", e);
+
+    let auth_path = edge.to_auth_path(h);
+    let witness = Witness {
+        value: empty,
+        position: 0,
+        ommers: edge.clone(),
+    };
+    let (_, e) = timed(|| {
+        for _ in 0..n {
+            black_box(witness.root(&auth_path, h));
+        }
+    });
+    report(&format!("{name} Witness::root"), n, "roots", e);
+    black_box(empty_roots(h));
+}
+
+pub fn bench_hashers(pairs: usize) {
+    bench_hasher("sapling", &SaplingHasher::default(), pairs);
+    bench_hasher("orchard", &OrchardHasher::default(), pairs);
+}
+
+pub fn bench_data_split(size: usize) -> Result<()> {
+    let mut data = vec![0u8; size];
+    OsRng.fill_bytes(&mut data);
+    let threshold = (size / 256 + 10) as u32;
+    let (packets, e) = timed(|| split(&data, threshold));
+    let packets = packets?;
+    report("split", size, "bytes", e);
+    let packets = PacketsT {
+        packets: Some(packets),
+    };
+    let (merged, e) = timed(|| merge(&packets));
+    report("merge", size, "bytes", e);
+    if merged? != data {
+        anyhow::bail!("merge did not restore the data");
+    }
+    Ok(())
+}
+
+fn synthetic_note(i: u32, orchard: bool) -> ReceivedNote {
+    let mut hash = [0u8; 32];
+    hash[0..4].copy_from_slice(&i.to_le_bytes());
+    hash[4] = orchard as u8;
+    ReceivedNote {
+        is_new: true,
+        id: 0,
+        account: 1,
+        position: i,
+        height: 1 + i / 10,
+        address: [0u8; 43],
+        value: 10_000,
+        rcm: hash,
+        nf: hash,
+        rho: if orchard { Some(hash) } else { None },
+        vout: 0,
+        tx: ReceivedTx {
+            id: 0,
+            account: 1,
+            height: 1 + i / 10,
+            txid: hash,
+            timestamp: 0,
+            ivtx: 0,
+            value: 10_000,
+        },
+        spent: None,
+        witness: Witness {
+            value: hash,
+            position: i,
+            ommers: Edge([Some(hash); MERKLE_DEPTH as usize]),
+        },
+    }
+}
+
+/// `count` new notes, alternating Sapling and Orchard
+pub fn synthetic_notes(count: u32) -> Vec<ReceivedNote> {
+    (0..count)
+        .map(|i| synthetic_note(i, i % 2 == 1))
+        .collect::<Vec<_>>()
+}
+
+/// Empty in-memory wallet database
+pub fn empty_wallet() -> Result<Connection> {
+    let mut connection = Connection::open_in_memory()?;
+    create_schema(&mut connection, "")?;
+    Ok(connection)
+}
+
+/// Store the notes and their witnesses in one db transaction
+pub fn store_notes(connection: &mut Connection, notes: &mut [ReceivedNote]) -> Result<()> {
+    let stored = vec![None; notes.len()];
+    let height = notes.iter().map(|n| n.height).max().unwrap_or_default();
+    let db_tx = connection.transaction()?;
+    store_received_note(&db_tx, height, notes, &stored)?;
+    db_tx.commit()?;
+    Ok(())
+}
+
+pub fn bench_store_notes(count: u32) -> Result<()> {
+    let mut connection = empty_wallet()?;
+    let mut notes = synthetic_notes(count);
+    let (r, e) = timed(|| store_notes(&mut connection, &mut notes));
+    r?;
+    report("store_received_note", count as usize, "notes", e);
+    Ok(())
+}
+
+/// In-memory wallet with `accounts` random accounts
+pub fn synthetic_wallet(coin: &CoinDef, accounts: u32) -> Result<Connection> {
+    let mut connection = empty_wallet()?;
+    let birth = get_activation_height(&coin.network)?;
+    for i in 0..accounts {
+        let seed = generate_random_mnemonic_phrase(OsRng);
+        create_new_account(
+            &coin.network,
+            &mut connection,
+            &format!("bench-{i}"),
+            &seed,
+            0,
+            birth,
+            7,
+            false,
+        )?;
+    }
+    Ok(connection)
+}
+
+fn read_blocks(file: &str, start: u32, max_blocks: u32) -> Result<Vec<CompactBlock>> {
+    let end = start + max_blocks;
+    let mut blocks = vec![];
+    let push = |block: CompactBlock| {
+        blocks.push(block);
+        Ok(())
+    };
+    let f = File::open(file)?;
+    match WarpFile::open(&f)? {
+        Some(warp_file) => warp_file.for_each_block(start, end, push)?,
+        None => for_each_legacy_block(f, start, end, push)?,
+    }
+    Ok(blocks)
+}
+
+/// Replay up to `max_blocks` of a warp block file through the
+/// decrypt and hash stages, for each wallet size
+pub fn bench_sync(coin: &CoinDef, file: &str, max_blocks: u32, accounts: &[u32]) -> Result<()> {
+    let start = get_activation_height(&coin.network)?;
+    let (blocks, e) = timed(|| read_blocks(file, start, max_blocks));
+    let blocks = blocks?;
+    report("read warp file", blocks.len(), "blocks", e);
+    let outputs = blocks
+        .iter()
+        .flat_map(|b| b.vtx.iter())
+        .map(|vtx| vtx.outputs.len() + vtx.actions.len())
+        .sum::<usize>();
+    println!(
+        "{} outputs, {:.1} outputs/block",
+        outputs,
+        outputs as f64 / blocks.len().max(1) as f64
+    );
+
+    for &n in accounts {
+        println!("-- {n} account(s)");
+        let (connection, e) = timed(|| synthetic_wallet(coin, n));
+        let connection = connection?;
+        report("create accounts", n as usize, "accounts", e);
+
+        let (mut sap_dec, mut orch_dec) = synchronizers(coin, &connection, start)?;
+
+        // cut the chunks the way the decrypt stage does
+        let mut total = Duration::ZERO;
+        let mut i = 0;
+        while i < blocks.len() {
+            let mut c = 0;
+            let mut cost = 0;
+            let mut j = i;
+            while j < blocks.len() && c < OUTPUTS_PER_CHUNK && cost < DECRYPTIONS_PER_CHUNK {
+                let (slots, block_cost) = block_cost(&blocks[j], n as usize);
+                c += slots;
+                cost += block_cost;
+                j += 1;
+            }
+            let (r, e) = timed(|| add_blocks(&mut sap_dec, &mut orch_dec, &blocks[i..j], &coin.sync_stats));
+            r?;
+            total += e;
+            i = j;
+        }
+        report("Synchronizer::add", blocks.len(), "blocks", total);
+        report("Synchronizer::add", outputs, "outputs", total);
+        report(
+            "trial decryptions",
+            outputs * n as usize,
+            "trials",
+            total,
+        );
+    }
+    Ok(())
+}
+
+/// Spam profiles of the synthetic blocks: (name, txs per block,
+/// outputs and actions per tx)
+pub const SPAM_DENSITIES: [(&str, usize, usize); 3] =
+    [("light", 2, 2), ("medium", 10, 5), ("spam", 5, 200)];
+
+pub fn spam_density(name: &str) -> Result<(usize, usize)> {
+    SPAM_DENSITIES
+        .iter()
+        .find(|(n, _, _)| *n == name)
+        .map(|&(_, txs, outputs)| (txs, outputs))
+        .ok_or(anyhow::anyhow!("Unknown spam density {name}"))
+}
+
+fn block_hash(height: u32) -> Vec<u8> {
+    let mut hash = [0u8; 32];
+    hash[0..4].copy_from_slice(&height.to_le_bytes());
+    hash.to_vec()
+}
+
+/// The blocks (start, start + count] with `txs` txs of `outputs` Sapling
+/// outputs and Orchard actions each. The points and field elements are
+/// valid, so that the decrypter tries every output, and the same `seed`
+/// gives the same blocks
+pub fn synthetic_blocks(
+    seed: u64,
+    start: u32,
+    count: u32,
+    txs: usize,
+    outputs: usize,
+) -> Vec<CompactBlock> {
+    let mut rng = StdRng::seed_from_u64(seed);
+    let mut random_bytes = |n: usize| {
+        let mut b = vec![0u8; n];
+        rng.fill_bytes(&mut b);
+        b
+    };
+    let mut blocks = vec![];
+    for height in start + 1..=start + count {
+        let mut vtx = vec![];
+        for index in 0..txs {
+            vtx.push(CompactTx {
+                index: index as u64,
+                hash: random_bytes(32),
+                ..CompactTx::default()
+            });
+        }
+        blocks.push(CompactBlock {
+            height: height as u64,
+            hash: block_hash(height),
+            prev_hash: block_hash(height - 1),
+            time: height,
+            vtx,
+            ..CompactBlock::default()
+        });
+    }
+    for tx in blocks.iter_mut().flat_map(|b| b.vtx.iter_mut()) {
+        for _ in 0..outputs {
+            let epk = jubjub::AffinePoint::from(jubjub::ExtendedPoint::random(&mut rng));
+            let mut ciphertext = vec![0u8; 52];
+            rng.fill(&mut ciphertext[..]);
+            tx.outputs.push(CompactSaplingOutput {
+                cmu: jubjub::Base::random(&mut rng).to_bytes().to_vec(),
+                epk: epk.to_bytes().to_vec(),
+                ciphertext,
+            });
+            let mut ciphertext = vec![0u8; 52];
+            rng.fill(&mut ciphertext[..]);
+            tx.actions.push(CompactOrchardAction {
+                nullifier: Fp::random(&mut rng).to_repr().to_vec(),
+                cmx: Fp::random(&mut rng).to_repr().to_vec(),
+                ephemeral_key: Point::random(&mut rng).to_affine().to_bytes().to_vec(),
+                ciphertext,
+            });
+        }
+    }
+    blocks
+}
+
+/// Write a warp block file of synthetic blocks from the activation
+/// height, for `bench sync`
+pub fn write_fixture(coin: &CoinDef, file: &str, density: &str, count: u32) -> Result<()> {
+    let (txs, outputs) = spam_density(density)?;
+    let start = get_activation_height(&coin.network)?;
+    let blocks = synthetic_blocks(0, start, count, txs, outputs);
+    let mut w = WarpFileWriter::new(std::io::BufWriter::new(File::create(file)?))?;
+    for b in blocks.iter() {
+        w.write_block(b)?;
+    }
+    w.finish()?;
+    Ok(())
+}
+
+/// Decryption keys of `count` random accounts
+pub fn sapling_keys(count: u32) -> Vec<(u32, SaplingDecryptKey)> {
+    (0..count)
+        .map(|i| {
+            let ivk = SaplingIvk(jubjub::Fr::random(OsRng));
+            (i, SaplingDecryptKey::new(&ivk))
+        })
+        .collect()
+}
+
+pub fn orchard_keys(count: u32) -> Vec<(u32, OrchardDecryptKey)> {
+    (0..count)
+        .map(|i| {
+            let sk = loop {
+                let mut b = [0u8; 32];
+                OsRng.fill_bytes(&mut b);
+                if let Some(sk) = Option::from(SpendingKey::from_bytes(b)) {
+                    break sk;
+                }
+            };
+            let ivk = FullViewingKey::from(&sk).to_ivk(Scope::External);
+            (i, OrchardDecryptKey::new(&ivk))
+        })
+        .collect()
+}
+
+/// Synchronizers of the wallet at `start`, with empty trees
+pub fn synchronizers(
+    coin: &CoinDef,
+    connection: &Connection,
+    start: u32,
+) -> Result<(SaplingSync, OrchardSync)> {
+    let sap_dec = SaplingSync::new(
+        coin,
+        &coin.network,
+        connection,
+        CheckpointHeight(start),
+        0,
+        Edge::default(),
+    )?;
+    let orch_dec = OrchardSync::new(
+        coin,
+        &coin.network,
+        connection,
+        CheckpointHeight(start),
+        0,
+        Edge::default(),
+    )?;
+    Ok((sap_dec, orch_dec))
+}
+
+/// Decrypt and hash the blocks, as the decrypt stage does
+pub fn sync_blocks(
+    coin: &CoinDef,
+    sap_dec: &mut SaplingSync,
+    orch_dec: &mut OrchardSync,
+    blocks: &[CompactBlock],
+) -> Result<()> {
+    add_blocks(sap_dec, orch_dec, blocks, &coin.sync_stats)
+}
@@ -1,4 +1,4 @@
-use std::collections::HashMap;
+use std::collections::{HashMap, HashSet};
 
 use anyhow::Result;
 use rusqlite::Connection;
@@ -7,15 +7,40 @@ use crate::{db::tx::store_block_time, warp::BlockHeader};
 
 pub struct BlockHeaderStore {
     pub heights: HashMap<u32, Option<BlockHeader>>,
+    // the heights are not known yet, keep every header
+    pub keep_all: bool,
 }
 
 impl BlockHeaderStore {
     pub fn new() -> Self {
         Self {
             heights: HashMap::new(),
+            keep_all: false,
         }
     }
 
+    /// Store that keeps every header until `set_heights` is called
+    pub fn new_keep_all() -> Self {
+        Self {
+            heights: HashMap::new(),
+            keep_all: true,
+        }
+    }
+
+    /// Only keep the headers at these heights from now on
+    pub fn set_heights(&mut self, heights: &HashSet<u32>) -> Result<()> {
+        self.retain_heights(heights);
+        for h in heights {
+            self.heights.entry(*h).or_insert(None);
+        }
+        self.keep_all = false;
+        Ok(())
+    }
+
+    pub fn retain_heights(&mut self, heights: &HashSet<u32>) {
+        self.heights.retain(|h, _| heights.contains(h));
+    }
+
     pub fn add_heights<'a>(&mut self, heights: impl IntoIterator<Item = &'a u32>) -> Result<()> {
         for h in heights {
             self.heights.insert(*h, None);
@@ -24,12 +49,29 @@ impl BlockHeaderStore {
     }
 
     pub fn process(&mut self, header: &BlockHeader) -> Result<()> {
-        if self.heights.contains_key(&header.height) {
+        if self.keep_all || self.heights.contains_key(&header.height) {
             self.heights.insert(header.height, Some(header.clone()));
         }
         Ok(())
     }
 
+    /// Split off the headers found so far, keeping the heights still pending
+    pub fn take_found(&mut self) -> Self {
+        let mut found = HashMap::new();
+        self.heights.retain(|height, header| {
+            if header.is_some() {
+                found.insert(*height, header.take());
+                false
+            } else {
+                true
+            }
+        });
+        Self {
+            heights: found,
+            keep_all: false,
+        }
+    }
+
     pub fn save(&self, connection: &Connection) -> Result<()> {
         for (height, header) in self.heights.iter() {
             if let Some(header) = header {
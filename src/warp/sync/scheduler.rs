@@ -0,0 +1,289 @@
+use std::{collections::BTreeMap, sync::Arc, time::Duration};
+
+use anyhow::Result;
+use parking_lot::Mutex;
+use tokio::{
+    runtime::Handle,
+    sync::{
+        mpsc::{channel, Receiver, Sender},
+        OwnedSemaphorePermit, Semaphore,
+    },
+    task::JoinHandle,
+    time::timeout,
+};
+
+use crate::{coin::CoinDef, lwd::rpc::CompactBlock, types::CheckpointHeight};
+use zcash_protocol::consensus::Parameters as _;
+
+use super::{lwd_block_source, next_sync_range, warp_sync_locked, CompactBlockSource};
+
+// Sync of many wallets (a CoinDef and its database each) from one process
+//
+// The wallets that sync the same range of the same chain, from the same
+// servers and with the same spam filter form a group. A group downloads
+// and decodes its blocks once, and every wallet gets a copy to run its own
+// trial decryption, hashing and commits. At most `max_concurrent` wallets
+// sync at the same time. Their decrypt stages share the global rayon pool,
+// whose work stealing interleaves them
+
+// Blocks a wallet can fall behind the others of its group
+const FAN_OUT_BUFFER: usize = 100;
+// A wallet that does not take a block for that long is dropped
+// from its group, so that it does not stall the others
+const FAN_OUT_TIMEOUT: Duration = Duration::from_secs(60);
+
+// A block of the group, or the error that stopped its download
+type GroupBlock = Result<CompactBlock, String>;
+
+// Hands the blocks of the group to one wallet
+#[derive(Clone)]
+struct ChannelBlockSource {
+    recv: Arc<Mutex<Option<Receiver<GroupBlock>>>>,
+}
+
+impl CompactBlockSource for ChannelBlockSource {
+    fn chunked(&self) -> bool {
+        true
+    }
+
+    fn run(
+        self,
+        _start: u32,
+        _end: u32,
+        sender: Sender<CompactBlock>,
+    ) -> Result<JoinHandle<Result<()>>> {
+        let mut recv = self
+            .recv
+            .lock()
+            .take()
+            .ok_or(anyhow::anyhow!("Block source already running"))?;
+        let task = tokio::spawn(async move {
+            while let Some(block) = recv.recv().await {
+                let block = block.map_err(|e| anyhow::anyhow!("Block download failed: {e}"))?;
+                if sender.send(block).await.is_err() {
+                    break;
+                }
+            }
+            Ok(())
+        });
+        Ok(task)
+    }
+}
+
+// Copy every block of `source` to each sender. A wallet that fails
+// drops its receiver, a wallet that stops taking blocks is cut off and
+// added to `stalled`. The others keep going
+// A failed download is passed on to the wallets, whose sync then fails
+fn fan_out<BS: CompactBlockSource + Send + 'static>(
+    source: BS,
+    start: u32,
+    end: u32,
+    mut senders: Vec<(usize, Sender<GroupBlock>)>,
+    stalled: Arc<Mutex<Vec<usize>>>,
+) -> Result<()> {
+    let (tx, mut rx) = channel::<CompactBlock>(FAN_OUT_BUFFER);
+    let download = source.run(start, end, tx)?;
+    tokio::spawn(async move {
+        while let Some(block) = rx.recv().await {
+            let mut alive = Vec::with_capacity(senders.len());
+            for (i, s) in senders {
+                match timeout(FAN_OUT_TIMEOUT, s.send(Ok(block.clone()))).await {
+                    Ok(Ok(_)) => alive.push((i, s)),
+                    Ok(Err(_)) => {}
+                    Err(_) => {
+                        tracing::warn!("Wallet {i} stalled its sync group");
+                        stalled.lock().push(i);
+                    }
+                }
+            }
+            senders = alive;
+            if senders.is_empty() {
+                return;
+            }
+        }
+        let r = download.await.map_err(anyhow::Error::new).and_then(|r| r);
+        if let Err(e) = r {
+            for (_, s) in senders {
+                let _ = timeout(FAN_OUT_TIMEOUT, s.send(Err(e.to_string()))).await;
+            }
+        }
+    });
+    Ok(())
+}
+
+// The wallets of a group get the same blocks
+#[derive(PartialEq, Eq, PartialOrd, Ord)]
+struct GroupKey {
+    coin: u8,
+    network: u8,
+    servers: Vec<String>,
+    warp_url: Option<String>,
+    spam_filter_threshold: u32,
+    start: u32,
+    end: u32,
+}
+
+impl GroupKey {
+    fn new(coin: &CoinDef, (start, end): (u32, u32)) -> Self {
+        let config = &coin.config;
+        // see lwd_block_source
+        let warp_url = if end < config.warp_end_height {
+            config.warp_url.clone()
+        } else {
+            None
+        };
+        GroupKey {
+            coin: coin.coin,
+            network: coin.network.network_type() as u8,
+            servers: config.servers.clone().unwrap_or_default(),
+            warp_url,
+            spam_filter_threshold: config.spam_filter_threshold,
+            start,
+            end,
+        }
+    }
+}
+
+// Every wallet of the group comes with the permit of its sync_lock
+async fn sync_group<BS: CompactBlockSource + Send + 'static>(
+    coins: Vec<(usize, CoinDef, OwnedSemaphorePermit)>,
+    start: u32,
+    end: u32,
+    source: BS,
+) -> Vec<(usize, Result<()>)> {
+    let handle = Handle::current();
+    let mut senders = vec![];
+    let mut tasks = vec![];
+    for (i, coin, permit) in coins {
+        let (tx, rx) = channel::<GroupBlock>(FAN_OUT_BUFFER);
+        senders.push((i, tx));
+        let source = ChannelBlockSource {
+            recv: Arc::new(Mutex::new(Some(rx))),
+        };
+        let handle = handle.clone();
+        // the futures of warp_sync are not Send, drive each of them
+        // on its own blocking thread
+        let task = tokio::task::spawn_blocking(move || {
+            let _permit = permit;
+            handle.block_on(async {
+                warp_sync_locked(&coin, CheckpointHeight(start), end, source)
+                    .await
+                    .map_err(anyhow::Error::from)
+            })
+        });
+        tasks.push((i, task));
+    }
+    let stalled = Arc::new(Mutex::new(vec![]));
+    let fan_out_result = fan_out(source, start, end, senders, stalled.clone());
+
+    let mut results = vec![];
+    for (i, task) in tasks {
+        let r = task.await.map_err(anyhow::Error::new).and_then(|r| r);
+        let r = match &fan_out_result {
+            Err(e) => Err(anyhow::anyhow!("Block download failed: {e}")),
+            Ok(_) if stalled.lock().contains(&i) => Err(anyhow::anyhow!(
+                "Sync stopped, the wallet fell behind its group"
+            )),
+            Ok(_) => r,
+        };
+        results.push((i, r));
+    }
+    results
+}
+
+/// Sync every wallet up to `end_height` (by windows of SYNC_WINDOW like
+/// warp_synchronize) and return the result of each wallet, in order
+pub async fn synchronize_wallets(
+    wallets: &[CoinDef],
+    end_height: u32,
+    max_concurrent: usize,
+) -> Vec<Result<()>> {
+    let max_concurrent = max_concurrent.max(1);
+    let mut results = (0..wallets.len()).map(|_| Ok(())).collect::<Vec<Result<()>>>();
+
+    // a wallet listed twice shares the sync_lock of its first entry
+    // and gets its result
+    let mut duplicates = vec![];
+    let mut locks: Vec<Option<OwnedSemaphorePermit>> = vec![];
+    for (i, w) in wallets.iter().enumerate() {
+        let first = wallets[..i]
+            .iter()
+            .position(|o| Arc::ptr_eq(&o.sync_lock, &w.sync_lock));
+        match first {
+            Some(j) => {
+                duplicates.push((i, j));
+                locks.push(None);
+            }
+            // a wallet already syncing (e.g. by a job) would never
+            // drain its blocks, leave it out
+            None => match w.sync_lock.clone().try_acquire_owned() {
+                Ok(permit) => locks.push(Some(permit)),
+                Err(_) => {
+                    results[i] = Err(anyhow::anyhow!("Sync already running"));
+                    locks.push(None);
+                }
+            },
+        }
+    }
+
+    let mut groups: BTreeMap<GroupKey, Vec<usize>> = BTreeMap::new();
+    for (i, w) in wallets.iter().enumerate() {
+        if locks[i].is_none() {
+            continue;
+        }
+        match next_sync_range(w, end_height).await {
+            Ok(Some(range)) => groups.entry(GroupKey::new(w, range)).or_default().push(i),
+            Ok(None) => {}
+            Err(e) => results[i] = Err(e),
+        }
+    }
+
+    let permits = Arc::new(Semaphore::new(max_concurrent));
+    let mut tasks = vec![];
+    for (GroupKey { start, end, .. }, members) in groups {
+        // a group holds a permit per wallet for its whole sync, so that
+        // none of its wallets waits for a permit while the others wait for it
+        for members in members.chunks(max_concurrent) {
+            let source = match lwd_block_source(&wallets[members[0]], end).await {
+                Ok(source) => source,
+                Err(e) => {
+                    for &i in members {
+                        results[i] = Err(anyhow::anyhow!("{e}"));
+                    }
+                    continue;
+                }
+            };
+            let permit = permits
+                .clone()
+                .acquire_many_owned(members.len() as u32)
+                .await
+                .unwrap();
+            let coins = members
+                .iter()
+                .map(|&i| (i, wallets[i].clone(), locks[i].take().unwrap()))
+                .collect::<Vec<_>>();
+            tasks.push(tokio::spawn(async move {
+                let _permit = permit;
+                sync_group(coins, start, end, source).await
+            }));
+        }
+    }
+
+    for task in tasks {
+        match task.await {
+            Ok(rs) => {
+                for (i, r) in rs {
+                    results[i] = r;
+                }
+            }
+            Err(e) => tracing::error!("Sync group failed: {e}"),
+        }
+    }
+    for (i, j) in duplicates {
+        results[i] = match &results[j] {
+            Ok(_) => Ok(()),
+            Err(e) => Err(anyhow::anyhow!("{e}")),
+        };
+    }
+    results
+}
@@ -1,10 +1,12 @@
 use rusqlite::Connection;
 use std::marker::PhantomData;
-use std::sync::mpsc::Sender;
-use std::{collections::HashMap, mem::swap, sync::mpsc::channel};
+use std::sync::Arc;
+use std::time::Instant;
+use std::{collections::HashMap, mem::swap};
 
 use crate::coin::CoinDef;
 use crate::db::notes::list_all_received_notes;
+use crate::db::witnesses::ommer_mask;
 use crate::lwd::rpc::CompactTx;
 use crate::network::Network;
 use crate::warp::sync::IdSpent;
@@ -20,7 +22,7 @@ use tracing::info;
 
 use crate::warp::{Edge, Hasher, MERKLE_DEPTH};
 
-use super::{ReceivedNote, TxValueUpdate};
+use super::{stats::SyncStats, ReceivedNote, TxValueUpdate};
 
 pub mod orchard;
 pub mod sapling;
@@ -49,7 +51,7 @@ pub trait ShieldedProtocol {
         ivtx: u32,
         vout: u32,
         output: &Self::Output,
-        sender: &mut Sender<ReceivedNote>,
+        notes: &mut Vec<ReceivedNote>,
     ) -> Result<()>;
     fn finalize_received_note(txid: Hash, note: &mut ReceivedNote, ai: &AccountInfo) -> Result<()>;
 }
@@ -61,9 +63,15 @@ pub struct Synchronizer<P: ShieldedProtocol> {
     pub account_infos: Vec<AccountInfo>,
     pub start: u32,
     pub notes: Vec<ReceivedNote>,
+    // nullifier -> indices in notes, maintained as notes are added
+    nf_index: HashMap<Hash, Vec<usize>>,
+    // mask of the ommers already in the db, per note (None for new notes)
+    stored_ommers: Vec<Option<u32>>,
     pub spends: Vec<(TxValueUpdate, IdSpent<Hash>)>,
     pub position: u32,
     pub tree_state: Edge,
+    layers: (Vec<Option<Hash>>, Vec<Option<Hash>>),
+    stats: Arc<SyncStats>,
     pub _data: PhantomData<P>,
 }
 
@@ -91,6 +99,14 @@ impl<P: ShieldedProtocol> Synchronizer<P> {
         }
         let is_orchard = P::is_orchard();
         let notes = list_all_received_notes(connection, start, is_orchard)?;
+        let mut nf_index: HashMap<Hash, Vec<usize>> = HashMap::new();
+        for (i, n) in notes.iter().enumerate() {
+            nf_index.entry(n.nf).or_default().push(i);
+        }
+        let stored_ommers = notes
+            .iter()
+            .map(|n| Some(ommer_mask(&n.witness.ommers)))
+            .collect();
 
         Ok(Self {
             hasher: P::Hasher::default(),
@@ -98,13 +114,44 @@ impl<P: ShieldedProtocol> Synchronizer<P> {
             account_infos,
             start: start.into(),
             notes,
+            nf_index,
+            stored_ommers,
             spends: vec![],
             position,
             tree_state,
+            layers: (vec![], vec![]),
+            stats: coin.sync_stats.clone(),
             _data: PhantomData::<P>::default(),
         })
     }
 
+    /// Whether `nf` is the nullifier of a note of the wallet
+    pub fn has_nullifier(&self, nf: &[u8]) -> bool {
+        <Hash>::try_from(nf)
+            .map(|nf| self.nf_index.contains_key(&nf))
+            .unwrap_or(false)
+    }
+
+    // snapshot of the notes (with their current witnesses), the mask
+    // of their ommers saved by the previous checkpoint and
+    // the spends detected since the previous checkpoint
+    pub fn checkpoint(
+        &mut self,
+    ) -> (
+        Vec<ReceivedNote>,
+        Vec<Option<u32>>,
+        Vec<(TxValueUpdate, IdSpent<Hash>)>,
+    ) {
+        let notes = self.notes.clone();
+        let stored = std::mem::take(&mut self.stored_ommers);
+        for n in self.notes.iter_mut() {
+            n.is_new = false;
+            self.stored_ommers.push(Some(ommer_mask(&n.witness.ommers)));
+        }
+        let spends = std::mem::take(&mut self.spends);
+        (notes, stored, spends)
+    }
+
     pub fn add(&mut self, blocks: &[CompactBlock]) -> Result<()> {
         let ivks = self
             .account_infos
@@ -121,10 +168,9 @@ impl<P: ShieldedProtocol> Synchronizer<P> {
             })
         });
 
-        let (sender, receiver) = channel();
-        outputs
-            .into_par_iter()
-            .for_each_with(sender, |sender, (height, time, ivtx, vout, o)| {
+        // each worker decrypts into its own buffer, buffers are concatenated at the end
+        let mut notes = outputs
+            .fold(Vec::new, |mut notes, (height, time, ivtx, vout, o)| {
                 P::try_decrypt(
                     &self.network,
                     &ivks,
@@ -133,56 +179,24 @@ impl<P: ShieldedProtocol> Synchronizer<P> {
                     ivtx as u32,
                     vout as u32,
                     o,
-                    sender,
+                    &mut notes,
                 )
                 .unwrap();
+                notes
+            })
+            .reduce(Vec::new, |mut a, mut b| {
+                a.append(&mut b);
+                a
             });
 
-        let mut notes = vec![];
-        while let Ok(mut note) = receiver.recv() {
-            let mut position = self.position;
-            for cb in blocks.iter() {
-                if cb.height as u32 == note.height {
-                    break;
-                }
-                for tx in cb.vtx.iter() {
-                    position += P::extract_outputs(tx).len() as u32;
-                    position += P::extract_bridge(tx)
-                        .map(|b| b.len as u32)
-                        .unwrap_or_default();
-                }
-            }
-            let cb = &blocks[(note.height - self.start - 1) as usize];
-            for (ivtx, tx) in cb.vtx.iter().enumerate() {
-                if ivtx as u32 == note.tx.ivtx {
-                    break;
-                }
-                position += P::extract_outputs(tx).len() as u32;
-                position += P::extract_bridge(tx)
-                    .map(|b| b.len as u32)
-                    .unwrap_or_default();
-            }
-            position += note.vout;
-            note.position = position;
-
-            let ai = self
-                .account_infos
-                .iter()
-                .find(|&ai| ai.account == note.account)
-                .unwrap();
-            let txid = cb.vtx[note.tx.ivtx as usize]
-                .hash
-                .clone()
-                .try_into()
-                .unwrap();
-            P::finalize_received_note(txid, &mut note, ai)?;
-            notes.push(note);
-        }
-
+        // position of the first output of every tx, and the bridges
+        let mut tx_positions = Vec::with_capacity(blocks.len());
         let mut bridges = vec![];
         let mut p = self.position;
         for cb in blocks.iter() {
+            let mut positions = Vec::with_capacity(cb.vtx.len());
             for tx in cb.vtx.iter() {
+                positions.push(p);
                 p += P::extract_outputs(tx).len() as u32;
                 if let Some(b) = P::extract_bridge(tx) {
                     let be = BridgeExt {
@@ -194,38 +208,57 @@ impl<P: ShieldedProtocol> Synchronizer<P> {
                     p += b.len;
                 }
             }
+            tx_positions.push(positions);
+        }
+
+        for note in notes.iter_mut() {
+            let ib = (note.height - self.start - 1) as usize;
+            note.position = tx_positions[ib][note.tx.ivtx as usize] + note.vout;
+
+            let ai = self
+                .account_infos
+                .iter()
+                .find(|&ai| ai.account == note.account)
+                .unwrap();
+            let txid = blocks[ib].vtx[note.tx.ivtx as usize]
+                .hash
+                .clone()
+                .try_into()
+                .unwrap();
+            P::finalize_received_note(txid, note, ai)?;
         }
 
-        let mut cmxs = vec![];
+        // the layers are hashed back and forth between two buffers
+        // that keep their capacity from one chunk to the next
+        let (mut cmxs, mut cmxs2) = std::mem::take(&mut self.layers);
+        cmxs.clear();
         let mut count_cmxs = 0;
 
+        // preprend previous trailing node (if resuming a half pair)
+        if self.position % 2 == 1 {
+            cmxs.push(Some(self.tree_state.0[0].unwrap()));
+        }
+        for cb in blocks.iter() {
+            for vtx in cb.vtx.iter() {
+                for co in P::extract_outputs(vtx).iter() {
+                    let cmx = P::extract_cmx(co);
+                    cmxs.push(Some(cmx));
+                }
+                count_cmxs += P::extract_outputs(vtx).len();
+                if let Some(b) = P::extract_bridge(vtx) {
+                    cmxs.resize(cmxs.len() + b.len as usize, None);
+                    count_cmxs += b.len as usize;
+                }
+            }
+        }
+
         for depth in 0..MERKLE_DEPTH as usize {
             let mut position = self.position >> depth;
-            // preprend previous trailing node (if resuming a half pair)
+            // the trailing node was prepended when the layer was built
             if position % 2 == 1 {
-                cmxs.insert(0, Some(self.tree_state.0[depth].unwrap()));
                 position -= 1;
             }
 
-            // slightly more efficient than doing it before the insert
-            if depth == 0 {
-                for cb in blocks.iter() {
-                    for vtx in cb.vtx.iter() {
-                        for co in P::extract_outputs(vtx).iter() {
-                            let cmx = P::extract_cmx(co);
-                            cmxs.push(Some(cmx));
-                        }
-                        count_cmxs += P::extract_outputs(vtx).len();
-                        if let Some(b) = P::extract_bridge(vtx) {
-                            for _ in 0..b.len {
-                                cmxs.push(None);
-                            }
-                            count_cmxs += b.len as usize;
-                        }
-                    }
-                }
-            }
-
             // restore bridge start/end nodes
             let p = position as i32;
             for be in bridges.iter_mut() {
@@ -308,30 +341,39 @@ impl<P: ShieldedProtocol> Synchronizer<P> {
 
             // hash and combine to next depth
             let pairs = len / 2;
-            let mut cmxs2 = self.hasher.parallel_combine_opt(depth as u8, &cmxs, pairs);
+            cmxs2.clear();
+            if depth + 1 < MERKLE_DEPTH as usize && (self.position >> (depth + 1)) % 2 == 1 {
+                cmxs2.push(Some(self.tree_state.0[depth + 1].unwrap()));
+            }
+            let hash_start = Instant::now();
+            self.hasher
+                .parallel_combine_opt(depth as u8, &cmxs, pairs, &mut cmxs2);
+            self.stats.hashed(depth, hash_start.elapsed());
             swap(&mut cmxs, &mut cmxs2);
         }
+        cmxs.clear();
+        cmxs2.clear();
+        self.layers = (cmxs, cmxs2);
 
         tracing::info!("Old notes #{}", self.notes.len());
         tracing::info!("New notes #{}", notes.len());
+        let offset = self.notes.len();
+        for (i, n) in notes.iter().enumerate() {
+            self.nf_index.entry(n.nf).or_default().push(offset + i);
+            self.stored_ommers.push(None);
+        }
         self.notes.append(&mut notes);
         self.position += count_cmxs as u32;
         self.start += blocks.len() as u32;
 
         // detect spends
-
-        let mut nfs: HashMap<Hash, Vec<&mut ReceivedNote>> = HashMap::new();
-        for n in self.notes.iter_mut() {
-            let e = nfs.entry(n.nf).or_insert(vec![]);
-            e.push(n);
-        }
-
         for cb in blocks.iter() {
             for vtx in cb.vtx.iter() {
                 for sp in P::extract_inputs(vtx).iter() {
                     let nf = P::extract_nf(sp);
-                    if let Some(ns) = nfs.get_mut(&nf) {
-                        for n in ns {
+                    if let Some(ns) = self.nf_index.get(&nf) {
+                        for &i in ns {
+                            let n = &mut self.notes[i];
                             n.spent = Some(cb.height as u32);
                             let id_spent = IdSpent::<Hash> {
                                 id_note: n.id,
@@ -1,8 +1,6 @@
-use std::sync::mpsc::Sender;
-
 use anyhow::Result;
 use orchard::{
-    keys::{IncomingViewingKey, Scope},
+    keys::Scope,
     note::{RandomSeed, Rho},
     value::NoteValue,
     Address, Note,
@@ -12,7 +10,7 @@ use crate::{
     lwd::rpc::{Bridge, CompactOrchardAction, CompactTx},
     network::Network,
     types::AccountInfo,
-    warp::{hasher::OrchardHasher, sync::ReceivedNote, try_orchard_decrypt},
+    warp::{hasher::OrchardHasher, sync::ReceivedNote, try_orchard_decrypt, OrchardDecryptKey},
     Hash,
 };
 
@@ -22,7 +20,7 @@ pub struct OrchardProtocol;
 
 impl ShieldedProtocol for OrchardProtocol {
     type Hasher = OrchardHasher;
-    type IVK = IncomingViewingKey;
+    type IVK = OrchardDecryptKey;
     type Spend = CompactOrchardAction;
     type Output = CompactOrchardAction;
 
@@ -33,7 +31,7 @@ impl ShieldedProtocol for OrchardProtocol {
     fn extract_ivk(ai: &AccountInfo) -> Option<(u32, Self::IVK)> {
         ai.orchard
             .as_ref()
-            .map(|oi| (ai.account, oi.vk.to_ivk(Scope::External)))
+            .map(|oi| (ai.account, OrchardDecryptKey::new(&oi.vk.to_ivk(Scope::External))))
     }
 
     fn extract_inputs(tx: &CompactTx) -> &Vec<Self::Spend> {
@@ -64,9 +62,9 @@ impl ShieldedProtocol for OrchardProtocol {
         ivtx: u32,
         vout: u32,
         output: &Self::Output,
-        sender: &mut Sender<ReceivedNote>,
+        notes: &mut Vec<ReceivedNote>,
     ) -> Result<()> {
-        try_orchard_decrypt(network, ivks, height, time, ivtx, vout, output, sender)
+        try_orchard_decrypt(network, ivks, height, time, ivtx, vout, output, notes)
     }
 
     fn finalize_received_note(txid: Hash, note: &mut ReceivedNote, ai: &AccountInfo) -> Result<()> {
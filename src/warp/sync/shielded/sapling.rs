@@ -1,11 +1,11 @@
 use anyhow::Result;
 use jubjub::Fr;
-use sapling_crypto::{value::NoteValue, Note, PaymentAddress, Rseed, SaplingIvk};
+use sapling_crypto::{value::NoteValue, Note, PaymentAddress, Rseed};
 
 use crate::{
     lwd::rpc::{Bridge, CompactSaplingOutput, CompactSaplingSpend, CompactTx},
     types::AccountInfo,
-    warp::{hasher::SaplingHasher, sync::ReceivedNote, try_sapling_decrypt},
+    warp::{hasher::SaplingHasher, sync::ReceivedNote, try_sapling_decrypt, SaplingDecryptKey},
     Hash,
 };
 
@@ -15,7 +15,7 @@ pub struct SaplingProtocol;
 
 impl ShieldedProtocol for SaplingProtocol {
     type Hasher = SaplingHasher;
-    type IVK = SaplingIvk;
+    type IVK = SaplingDecryptKey;
     type Spend = CompactSaplingSpend;
     type Output = CompactSaplingOutput;
 
@@ -26,7 +26,7 @@ impl ShieldedProtocol for SaplingProtocol {
     fn extract_ivk(ai: &AccountInfo) -> Option<(u32, Self::IVK)> {
         ai.sapling
             .as_ref()
-            .map(|si| (ai.account, si.vk.fvk().vk.ivk()))
+            .map(|si| (ai.account, SaplingDecryptKey::new(&si.vk.fvk().vk.ivk())))
     }
 
     fn extract_inputs(tx: &CompactTx) -> &Vec<Self::Spend> {
@@ -57,7 +57,7 @@ impl ShieldedProtocol for SaplingProtocol {
         ivtx: u32,
         vout: u32,
         output: &Self::Output,
-        sender: &mut std::sync::mpsc::Sender<crate::warp::sync::ReceivedNote>,
+        notes: &mut Vec<crate::warp::sync::ReceivedNote>,
     ) -> Result<()> {
         try_sapling_decrypt(
             network,
@@ -67,7 +67,7 @@ impl ShieldedProtocol for SaplingProtocol {
             ivtx as u32,
             vout as u32,
             output,
-            sender,
+            notes,
         )
     }
 
@@ -0,0 +1,322 @@
+use std::{
+    fs::File,
+    io::{BufReader, BufWriter, Read, Write},
+};
+
+use anyhow::Result;
+use blake2b_simd::Params;
+use rusqlite::{Connection, DropBehavior};
+use secp256k1::{ecdsa::Signature, All, Message, PublicKey, Secp256k1, SecretKey};
+use zip::unstable::{LittleEndianReadExt, LittleEndianWriteExt};
+
+use crate::{
+    coin::{connect_lwd, CoinDef},
+    db::{
+        account_manager::get_min_birth,
+        chain::{store_block, store_tree_state, truncate_scan},
+        tx::store_block_time,
+    },
+    lwd::{get_compact_block, get_tree_state},
+    types::CheckpointHeight,
+    warp::{
+        hasher::{OrchardHasher, SaplingHasher},
+        BlockHeader, Edge, MERKLE_DEPTH,
+    },
+    Hash,
+};
+
+use warp_macros::c_export;
+
+// Warp snapshot, version 1
+//
+// MAGIC | body | signed: u8 | signature: 64 bytes if signed
+// body: height: u32, hash, prev_hash, timestamp: u32,
+//   sapling tree: size: u32, edge; orchard tree: size: u32, edge,
+//   block times: count: u32, (height: u32, timestamp: u32)*
+// edge: MERKLE_DEPTH x (present: u8, hash)
+//
+// The signature is an ECDSA/secp256k1 signature of the blake2b-256
+// of MAGIC | body. A wallet that loads a snapshot starts its sync at
+// the snapshot height and never sees the blocks before it
+
+const MAGIC: &[u8; 8] = b"WARPSNP1";
+
+#[derive(Debug)]
+pub struct WarpSnapshot {
+    pub header: BlockHeader,
+    pub sapling: (u32, Edge),
+    pub orchard: (u32, Edge),
+    pub block_times: Vec<(u32, u32)>,
+}
+
+fn write_edge<W: Write>(mut w: W, edge: &Edge) -> Result<()> {
+    for n in edge.0.iter() {
+        match n {
+            Some(h) => {
+                w.write_all(&[1])?;
+                w.write_all(h)?;
+            }
+            None => {
+                w.write_all(&[0])?;
+                w.write_all(&[0u8; 32])?;
+            }
+        }
+    }
+    Ok(())
+}
+
+fn read_byte<R: Read>(mut r: R) -> Result<u8> {
+    let mut b = [0u8; 1];
+    r.read_exact(&mut b)?;
+    Ok(b[0])
+}
+
+fn read_hash<R: Read>(mut r: R) -> Result<Hash> {
+    let mut h = [0u8; 32];
+    r.read_exact(&mut h)?;
+    Ok(h)
+}
+
+fn read_edge<R: Read>(mut r: R) -> Result<Edge> {
+    let mut edge = Edge::default();
+    for i in 0..MERKLE_DEPTH as usize {
+        let present = read_byte(&mut r)?;
+        let h = read_hash(&mut r)?;
+        edge.0[i] = (present != 0).then_some(h);
+    }
+    Ok(edge)
+}
+
+fn digest(data: &[u8]) -> Hash {
+    let h = Params::new()
+        .hash_length(32)
+        .personal(b"Warp_Snapshot_v1")
+        .hash(data);
+    h.as_bytes().try_into().unwrap()
+}
+
+impl WarpSnapshot {
+    fn body(&self) -> Result<Vec<u8>> {
+        let mut w = MAGIC.to_vec();
+        let bh = &self.header;
+        w.write_u32_le(bh.height)?;
+        w.write_all(&bh.hash)?;
+        w.write_all(&bh.prev_hash)?;
+        w.write_u32_le(bh.timestamp)?;
+        for (size, edge) in [&self.sapling, &self.orchard] {
+            w.write_u32_le(*size)?;
+            write_edge(&mut w, edge)?;
+        }
+        w.write_u32_le(self.block_times.len() as u32)?;
+        for (height, timestamp) in self.block_times.iter() {
+            w.write_u32_le(*height)?;
+            w.write_u32_le(*timestamp)?;
+        }
+        Ok(w)
+    }
+
+    pub fn write<W: Write>(&self, mut w: W, sk: Option<&SecretKey>) -> Result<()> {
+        let body = self.body()?;
+        w.write_all(&body)?;
+        match sk {
+            Some(sk) => {
+                let secp = Secp256k1::<All>::new();
+                let msg = Message::from_slice(&digest(&body))?;
+                let sig = secp.sign_ecdsa(&msg, sk);
+                w.write_all(&[1])?;
+                w.write_all(&sig.serialize_compact())?;
+            }
+            None => w.write_all(&[0])?,
+        }
+        w.flush()?;
+        Ok(())
+    }
+
+    /// Read a snapshot. With a public key, the snapshot must be
+    /// signed by it
+    pub fn read<R: Read>(mut r: R, pk: Option<&PublicKey>) -> Result<Self> {
+        let mut data = vec![];
+        r.read_to_end(&mut data)?;
+        if data.len() < MAGIC.len() || &data[0..8] != MAGIC {
+            anyhow::bail!("Not a warp snapshot");
+        }
+        let mut reader = &data[8..];
+        let height = reader.read_u32_le()?;
+        let hash = read_hash(&mut reader)?;
+        let prev_hash = read_hash(&mut reader)?;
+        let timestamp = reader.read_u32_le()?;
+        let sapling_size = reader.read_u32_le()?;
+        let sapling_edge = read_edge(&mut reader)?;
+        let orchard_size = reader.read_u32_le()?;
+        let orchard_edge = read_edge(&mut reader)?;
+        let count = reader.read_u32_le()? as usize;
+        let mut block_times = Vec::with_capacity(count.min(1 << 20));
+        for _ in 0..count {
+            let height = reader.read_u32_le()?;
+            let timestamp = reader.read_u32_le()?;
+            block_times.push((height, timestamp));
+        }
+        let body = &data[..data.len() - reader.len()];
+        let signed = read_byte(&mut reader)? != 0;
+
+        if let Some(pk) = pk {
+            if !signed {
+                anyhow::bail!("Warp snapshot is not signed");
+            }
+            let mut sig = [0u8; 64];
+            reader.read_exact(&mut sig)?;
+            let sig = Signature::from_compact(&sig)?;
+            let msg = Message::from_slice(&digest(body))?;
+            Secp256k1::<All>::new()
+                .verify_ecdsa(&msg, &sig, pk)
+                .map_err(|_| anyhow::anyhow!("Invalid warp snapshot signature"))?;
+        }
+
+        Ok(Self {
+            header: BlockHeader {
+                height,
+                hash,
+                prev_hash,
+                timestamp,
+            },
+            sapling: (sapling_size, sapling_edge),
+            orchard: (orchard_size, orchard_edge),
+            block_times,
+        })
+    }
+
+    /// Replace the chain data of the wallet with the snapshot
+    ///
+    /// The sync resumes after the snapshot height, so the snapshot
+    /// must be older than the birth height of every account
+    pub fn store(&self, connection: &mut Connection) -> Result<()> {
+        if let Some(birth) = get_min_birth(connection)? {
+            if self.header.height >= birth {
+                anyhow::bail!(
+                    "Warp snapshot @{} is not older than the wallet birth height {}",
+                    self.header.height,
+                    birth
+                );
+            }
+        }
+        let mut db_tx = connection.transaction()?;
+        db_tx.set_drop_behavior(DropBehavior::Rollback);
+        truncate_scan(&db_tx)?;
+        store_block(&db_tx, &self.header)?;
+        store_tree_state(&db_tx, self.header.height, &self.sapling, &self.orchard)?;
+        for (height, timestamp) in self.block_times.iter() {
+            store_block_time(&db_tx, *height, *timestamp)?;
+        }
+        db_tx.commit()?;
+        Ok(())
+    }
+}
+
+/// Build a snapshot at `height` from the warp server and write it
+/// to `dest`, unsigned
+#[c_export]
+pub async fn download_warp_snapshot(warp_url: &str, height: u32, dest: &str) -> Result<()> {
+    let mut client = connect_lwd(warp_url).await?;
+    let block = get_compact_block(&mut client, height).await?;
+    let (s, o) = get_tree_state(&mut client, CheckpointHeight(height)).await?;
+    let header = BlockHeader::from(&block);
+    let snapshot = WarpSnapshot {
+        block_times: vec![(header.height, header.timestamp)],
+        header,
+        sapling: (s.size() as u32, s.to_edge(&SaplingHasher::default())),
+        orchard: (o.size() as u32, o.to_edge(&OrchardHasher::default())),
+    };
+    let dest = BufWriter::new(File::create(dest)?);
+    snapshot.write(dest, None)?;
+    Ok(())
+}
+
+/// Sign a snapshot for publication, `secret_key` in hex
+pub fn sign_warp_snapshot(file: &str, secret_key: &str, dest: &str) -> Result<()> {
+    let sk = SecretKey::from_slice(&hex::decode(secret_key)?)?;
+    let snapshot = WarpSnapshot::read(BufReader::new(File::open(file)?), None)?;
+    snapshot.write(BufWriter::new(File::create(dest)?), Some(&sk))?;
+    Ok(())
+}
+
+/// Bootstrap the wallet from a snapshot: the scan data is erased and
+/// the next sync starts at its height. The snapshot must be older
+/// than the birth height of every account, or their earlier notes
+/// would never be found. `public_key` (hex) is the key of the
+/// publisher, an empty key accepts unsigned snapshots
+#[c_export]
+pub fn load_warp_snapshot(coin: &CoinDef, file: &str, public_key: &str) -> Result<u32> {
+    let pk = if public_key.is_empty() {
+        None
+    } else {
+        Some(PublicKey::from_slice(&hex::decode(public_key)?)?)
+    };
+    let snapshot = WarpSnapshot::read(BufReader::new(File::open(file)?), pk.as_ref())?;
+    let mut connection = coin.connection()?;
+    snapshot.store(&mut connection)?;
+    tracing::info!("Loaded warp snapshot @{}", snapshot.header.height);
+    Ok(snapshot.header.height)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn sample() -> WarpSnapshot {
+        let mut edge = Edge::default();
+        edge.0[0] = Some([1u8; 32]);
+        edge.0[5] = Some([2u8; 32]);
+        WarpSnapshot {
+            header: BlockHeader {
+                height: 2_000_000,
+                hash: [3u8; 32],
+                prev_hash: [4u8; 32],
+                timestamp: 1_700_000_000,
+            },
+            sapling: (123, edge.clone()),
+            orchard: (45, Edge::default()),
+            block_times: vec![(2_000_000, 1_700_000_000), (1_999_999, 1_699_999_925)],
+        }
+    }
+
+    fn check_same(a: &WarpSnapshot, b: &WarpSnapshot) {
+        assert_eq!(a.header.height, b.header.height);
+        assert_eq!(a.header.hash, b.header.hash);
+        assert_eq!(a.header.prev_hash, b.header.prev_hash);
+        assert_eq!(a.header.timestamp, b.header.timestamp);
+        assert_eq!(a.sapling, b.sapling);
+        assert_eq!(a.orchard, b.orchard);
+        assert_eq!(a.block_times, b.block_times);
+    }
+
+    #[test]
+    fn snapshot_roundtrip() {
+        let snapshot = sample();
+        let mut data = vec![];
+        snapshot.write(&mut data, None).unwrap();
+        let read = WarpSnapshot::read(&*data, None).unwrap();
+        check_same(&snapshot, &read);
+    }
+
+    #[test]
+    fn snapshot_signature() {
+        let secp = Secp256k1::<All>::new();
+        let sk = SecretKey::from_slice(&[7u8; 32]).unwrap();
+        let pk = PublicKey::from_secret_key(&secp, &sk);
+        let snapshot = sample();
+        let mut data = vec![];
+        snapshot.write(&mut data, Some(&sk)).unwrap();
+        let read = WarpSnapshot::read(&*data, Some(&pk)).unwrap();
+        check_same(&snapshot, &read);
+
+        // tampered body
+        let mut tampered = data.clone();
+        tampered[12] ^= 1;
+        assert!(WarpSnapshot::read(&*tampered, Some(&pk)).is_err());
+
+        // unsigned snapshot with a required key
+        let mut unsigned = vec![];
+        snapshot.write(&mut unsigned, None).unwrap();
+        assert!(WarpSnapshot::read(&*unsigned, Some(&pk)).is_err());
+    }
+}
@@ -0,0 +1,173 @@
+use std::{
+    sync::atomic::{AtomicU32, AtomicU64, Ordering},
+    time::{Duration, Instant},
+};
+
+use anyhow::Result;
+use parking_lot::Mutex;
+
+use crate::{coin::CoinDef, data::fb::SyncStatsT, lwd::rpc::CompactBlock, warp::MERKLE_DEPTH};
+
+use warp_macros::c_export;
+
+// Counters of the running (or last) warp_sync of a coin, read by
+// c_get_sync_stats. Every CoinDef has its own, shared by its clones
+//
+// They are updated by the stages of the pipeline with relaxed atomics,
+// a snapshot may be slightly inconsistent but never blocks the sync
+
+// commit latency buckets: 0 ms, 1 ms, 2-3 ms, 4-7 ms, ... >= 16 s
+const HISTOGRAM_BUCKETS: usize = 16;
+
+#[derive(Debug, Default)]
+pub struct SyncStats {
+    started: Mutex<Option<Instant>>,
+    start_height: AtomicU32,
+    end_height: AtomicU32,
+    height: AtomicU32,
+    blocks_downloaded: AtomicU64,
+    outputs_downloaded: AtomicU64,
+    blocks_decrypted: AtomicU64,
+    outputs_decrypted: AtomicU64,
+    decrypt_us: AtomicU64,
+    hash_us: [AtomicU64; MERKLE_DEPTH as usize],
+    commits: AtomicU32,
+    commit_ms: AtomicU64,
+    commit_max_ms: AtomicU32,
+    commit_histogram: [AtomicU32; HISTOGRAM_BUCKETS],
+    checkpoints_sent: AtomicU32,
+    // not reset between syncs
+    reorgs: AtomicU32,
+}
+
+fn count_outputs(block: &CompactBlock) -> u64 {
+    block
+        .vtx
+        .iter()
+        .map(|vtx| (vtx.outputs.len() + vtx.actions.len()) as u64)
+        .sum()
+}
+
+impl SyncStats {
+    pub fn start(&self, start_height: u32, end_height: u32) {
+        *self.started.lock() = Some(Instant::now());
+        self.start_height.store(start_height, Ordering::Relaxed);
+        self.end_height.store(end_height, Ordering::Relaxed);
+        self.height.store(start_height, Ordering::Relaxed);
+        for c in [
+            &self.blocks_downloaded,
+            &self.outputs_downloaded,
+            &self.blocks_decrypted,
+            &self.outputs_decrypted,
+            &self.decrypt_us,
+            &self.commit_ms,
+        ]
+        .into_iter()
+        .chain(self.hash_us.iter())
+        {
+            c.store(0, Ordering::Relaxed);
+        }
+        for c in [&self.commits, &self.commit_max_ms, &self.checkpoints_sent]
+            .into_iter()
+            .chain(self.commit_histogram.iter())
+        {
+            c.store(0, Ordering::Relaxed);
+        }
+    }
+
+    /// The decrypt stage received `block`
+    pub fn downloaded(&self, block: &CompactBlock) {
+        self.blocks_downloaded.fetch_add(1, Ordering::Relaxed);
+        self.outputs_downloaded
+            .fetch_add(count_outputs(block), Ordering::Relaxed);
+    }
+
+    pub fn decrypted(&self, blocks: &[CompactBlock], elapsed: Duration) {
+        let outputs = blocks.iter().map(count_outputs).sum::<u64>();
+        self.blocks_decrypted
+            .fetch_add(blocks.len() as u64, Ordering::Relaxed);
+        self.outputs_decrypted.fetch_add(outputs, Ordering::Relaxed);
+        self.decrypt_us
+            .fetch_add(elapsed.as_micros() as u64, Ordering::Relaxed);
+    }
+
+    pub fn hashed(&self, depth: usize, elapsed: Duration) {
+        self.hash_us[depth].fetch_add(elapsed.as_micros() as u64, Ordering::Relaxed);
+    }
+
+    pub fn checkpoint_sent(&self) {
+        self.checkpoints_sent.fetch_add(1, Ordering::Relaxed);
+    }
+
+    pub fn committed(&self, height: u32, elapsed: Duration) {
+        let ms = elapsed.as_millis() as u64;
+        self.height.store(height, Ordering::Relaxed);
+        self.commits.fetch_add(1, Ordering::Relaxed);
+        self.commit_ms.fetch_add(ms, Ordering::Relaxed);
+        self.commit_max_ms.fetch_max(ms as u32, Ordering::Relaxed);
+        let bucket = ((u64::BITS - ms.leading_zeros()) as usize).min(HISTOGRAM_BUCKETS - 1);
+        self.commit_histogram[bucket].fetch_add(1, Ordering::Relaxed);
+    }
+
+    pub fn reorg(&self) {
+        self.reorgs.fetch_add(1, Ordering::Relaxed);
+    }
+
+    pub fn snapshot(&self) -> SyncStatsT {
+        let load32 = |c: &AtomicU32| c.load(Ordering::Relaxed);
+        let load64 = |c: &AtomicU64| c.load(Ordering::Relaxed);
+        let elapsed = self
+            .started
+            .lock()
+            .map(|s| s.elapsed())
+            .unwrap_or_default();
+        let secs = elapsed.as_secs_f64();
+        let rate = |n: u64| if secs > 0.0 { (n as f64 / secs) as u32 } else { 0 };
+
+        let start_height = load32(&self.start_height);
+        let end_height = load32(&self.end_height);
+        let blocks_downloaded = load64(&self.blocks_downloaded);
+        let blocks_decrypted = load64(&self.blocks_decrypted);
+        let commits = load32(&self.commits);
+        let blocks_per_sec = rate(blocks_decrypted);
+        let remaining = (end_height as u64).saturating_sub(start_height as u64 + blocks_decrypted);
+        let eta_sec = if blocks_per_sec > 0 {
+            (remaining / blocks_per_sec as u64) as u32
+        } else {
+            0
+        };
+
+        SyncStatsT {
+            start_height,
+            end_height,
+            height: load32(&self.height),
+            elapsed_ms: elapsed.as_millis() as u64,
+            blocks_downloaded,
+            outputs_downloaded: load64(&self.outputs_downloaded),
+            blocks_decrypted,
+            outputs_decrypted: load64(&self.outputs_decrypted),
+            blocks_per_sec,
+            outputs_per_sec: rate(load64(&self.outputs_decrypted)),
+            eta_sec,
+            decrypt_ms: load64(&self.decrypt_us) / 1000,
+            hash_us: Some(self.hash_us.iter().map(load64).collect()),
+            commits,
+            commit_ms: load64(&self.commit_ms),
+            commit_max_ms: load32(&self.commit_max_ms),
+            commit_histogram: Some(self.commit_histogram.iter().map(load32).collect()),
+            reorgs: load32(&self.reorgs),
+            // blocks in the chunk being accumulated
+            block_queue: blocks_downloaded.saturating_sub(blocks_decrypted) as u32,
+            checkpoint_queue: load32(&self.checkpoints_sent).saturating_sub(commits),
+        }
+    }
+}
+
+/// Throughput, stage latencies and queue depths of the running
+/// (or last) warp_sync of the coin
+// c_export locks the coin, the stats can only be polled during
+// a sync started by c_warp_synchronize_async
+#[c_export]
+pub fn get_sync_stats(coin: &CoinDef) -> Result<SyncStatsT> {
+    Ok(coin.sync_stats.snapshot())
+}
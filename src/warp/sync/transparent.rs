@@ -1,7 +1,11 @@
-use std::collections::HashSet;
+use std::{
+    collections::{HashMap, HashSet},
+    sync::Arc,
+};
 
 use anyhow::Result;
 use rusqlite::{Connection, Transaction};
+use tokio::sync::Semaphore;
 use zcash_client_backend::encoding::AddressCodec;
 use zcash_keys::address::Address as RecipientAddress;
 use zcash_primitives::legacy::TransparentAddress;
@@ -12,8 +16,10 @@ use crate::{
         notes::{list_all_utxos, mark_transparent_spent, store_utxo},
         tx::add_tx_value,
     },
+    lwd::get_transparent,
     network::Network,
     warp::{OutPoint, TransparentTx, UTXO},
+    Client,
 };
 
 use super::{IdSpent, ReceivedTx, TxValueUpdate};
@@ -22,6 +28,8 @@ pub struct TransparentSync {
     pub network: Network,
     pub addresses: Vec<(TransparentDerPath, TransparentAddress)>,
     pub utxos: Vec<UTXO>,
+    // outpoint -> indices in utxos, maintained as utxos are added
+    utxo_index: HashMap<OutPoint, Vec<usize>>,
     pub txs: Vec<(ReceivedTx, OutPoint, u64)>,
     pub tx_updates: Vec<(TxValueUpdate, IdSpent<OutPoint>)>,
     pub heights: HashSet<u32>,
@@ -41,25 +49,72 @@ impl TransparentSync {
             })
             .collect::<Vec<_>>();
         let utxos = list_all_utxos(connection)?;
+        let mut utxo_index: HashMap<OutPoint, Vec<usize>> = HashMap::new();
+        for (i, utxo) in utxos.iter().enumerate() {
+            utxo_index.entry(utxo.outpoint()).or_default().push(i);
+        }
 
         Ok(Self {
             network: network.clone(),
             addresses,
             utxos,
+            utxo_index,
             txs: vec![],
             tx_updates: vec![],
             heights: HashSet::new(),
         })
     }
 
+    /// Fetch the history of the addresses in [start, end] with at most
+    /// `concurrency` requests in flight, then process it in address order
+    pub async fn scan_addresses(
+        &mut self,
+        client: &Client,
+        addresses: &[(TransparentDerPath, TransparentAddress)],
+        start: u32,
+        end: u32,
+        concurrency: usize,
+    ) -> Result<()> {
+        let semaphore = Arc::new(Semaphore::new(concurrency.max(1)));
+        let handles = addresses
+            .iter()
+            .map(|(path, taddr)| {
+                let network = self.network;
+                let mut client = client.clone();
+                let semaphore = semaphore.clone();
+                let path = path.clone();
+                let taddr = *taddr;
+                tokio::spawn(async move {
+                    let _permit = semaphore.acquire_owned().await?;
+                    get_transparent(
+                        &network,
+                        &mut client,
+                        path.account,
+                        path.external,
+                        path.addr_index,
+                        taddr,
+                        start,
+                        end,
+                    )
+                    .await
+                })
+            })
+            .collect::<Vec<_>>();
+        for (handle, (_, taddr)) in handles.into_iter().zip(addresses.iter()) {
+            let txs = handle.await??;
+            let address = taddr.encode(&self.network);
+            self.process_txs(&address, &txs)?;
+        }
+        Ok(())
+    }
+
     pub fn process_txs(&mut self, address: &str, txs: &[TransparentTx]) -> Result<()> {
         for tx in txs {
             for vin in tx.vins.iter() {
-                let r = self.utxos.iter().find(|&utxo| {
-                    utxo.txid == vin.txid
-                        && utxo.vout == vin.vout
-                        && utxo.account == tx.account
-                        && &utxo.address == address
+                let r = self.utxo_index.get(vin).and_then(|ids| {
+                    ids.iter().map(|&i| &self.utxos[i]).find(|&utxo| {
+                        utxo.account == tx.account && &utxo.address == address
+                    })
                 });
                 if let Some(utxo) = r {
                     let id_spent = IdSpent::<OutPoint> {
@@ -114,6 +169,10 @@ impl TransparentSync {
                     address,
                     value: txout.value,
                 };
+                self.utxo_index
+                    .entry(utxo.outpoint())
+                    .or_default()
+                    .push(self.utxos.len());
                 self.utxos.push(utxo);
                 self.heights.insert(tx.height);
             }
@@ -122,14 +181,22 @@ impl TransparentSync {
         Ok(())
     }
 
-    pub fn flush(self, db_tx: &Transaction) -> Result<()> {
-        for utxo in self.utxos.iter() {
-            store_utxo(db_tx, utxo)?;
+    // write the utxos and spends up to (and including) height
+    // the rest is kept for a later checkpoint
+    pub fn flush(&mut self, db_tx: &Transaction, height: u32) -> Result<()> {
+        for utxo in self.utxos.iter_mut() {
+            if utxo.is_new && utxo.height <= height {
+                store_utxo(db_tx, utxo)?;
+                utxo.is_new = false;
+            }
         }
         for (tx, spend) in self.tx_updates.iter() {
-            add_tx_value(db_tx, &tx)?;
-            mark_transparent_spent(db_tx, spend)?;
+            if tx.height <= height {
+                add_tx_value(db_tx, &tx)?;
+                mark_transparent_spent(db_tx, spend)?;
+            }
         }
+        self.tx_updates.retain(|(tx, _)| tx.height > height);
         Ok(())
     }
 }
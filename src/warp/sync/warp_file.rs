@@ -0,0 +1,331 @@
+use std::{
+    fs::File,
+    io::{BufReader, Read, Write},
+};
+
+use anyhow::{anyhow, Result};
+use blake2b_simd::Params;
+use memmap2::Mmap;
+use prost::Message;
+use zip::unstable::{LittleEndianReadExt, LittleEndianWriteExt};
+
+use crate::{lwd::rpc::CompactBlock, Hash};
+
+// Warp block file, version 1
+//
+// MAGIC | segment* | index | index offset: u64 | MAGIC
+// segment: (len: u32, CompactBlock)* for SEGMENT_BLOCKS consecutive blocks
+// index: count: u32, then per segment
+//   start height: u32, end height: u32 (inclusive), offset: u64, size: u64,
+//   checksum: blake2b-256 of the segment
+//
+// Files without the magic are read as the legacy flat stream of
+// (len, CompactBlock)
+
+const MAGIC: &[u8; 8] = b"WARPBLK1";
+const SEGMENT_BLOCKS: usize = 1_000;
+const INDEX_ENTRY_SIZE: usize = 4 + 4 + 8 + 8 + 32;
+
+#[derive(Clone, Debug)]
+pub struct SegmentIndex {
+    pub start: u32,
+    pub end: u32,
+    pub offset: u64,
+    pub size: u64,
+    pub checksum: Hash,
+}
+
+fn segment_checksum(data: &[u8]) -> Hash {
+    let h = Params::new()
+        .hash_length(32)
+        .personal(b"Warp_BlkSegments")
+        .hash(data);
+    h.as_bytes().try_into().unwrap()
+}
+
+pub struct WarpFileWriter<W: Write> {
+    writer: W,
+    position: u64,
+    segment: Vec<u8>,
+    segment_start: u32,
+    segment_end: u32,
+    segment_len: usize,
+    index: Vec<SegmentIndex>,
+}
+
+impl<W: Write> WarpFileWriter<W> {
+    pub fn new(mut writer: W) -> Result<Self> {
+        writer.write_all(MAGIC)?;
+        Ok(Self {
+            writer,
+            position: MAGIC.len() as u64,
+            segment: vec![],
+            segment_start: 0,
+            segment_end: 0,
+            segment_len: 0,
+            index: vec![],
+        })
+    }
+
+    pub fn write_block(&mut self, block: &CompactBlock) -> Result<()> {
+        let height = block.height as u32;
+        if self.segment_len == 0 {
+            self.segment_start = height;
+        }
+        self.segment_end = height;
+        self.segment.write_u32_le(block.encoded_len() as u32)?;
+        block.encode(&mut self.segment)?;
+        self.segment_len += 1;
+        if self.segment_len == SEGMENT_BLOCKS {
+            self.flush_segment()?;
+        }
+        Ok(())
+    }
+
+    fn flush_segment(&mut self) -> Result<()> {
+        if self.segment_len == 0 {
+            return Ok(());
+        }
+        self.writer.write_all(&self.segment)?;
+        self.index.push(SegmentIndex {
+            start: self.segment_start,
+            end: self.segment_end,
+            offset: self.position,
+            size: self.segment.len() as u64,
+            checksum: segment_checksum(&self.segment),
+        });
+        self.position += self.segment.len() as u64;
+        self.segment.clear();
+        self.segment_len = 0;
+        Ok(())
+    }
+
+    pub fn finish(mut self) -> Result<W> {
+        self.flush_segment()?;
+        let index_offset = self.position;
+        self.writer.write_u32_le(self.index.len() as u32)?;
+        for s in self.index.iter() {
+            self.writer.write_u32_le(s.start)?;
+            self.writer.write_u32_le(s.end)?;
+            self.writer.write_u64_le(s.offset)?;
+            self.writer.write_u64_le(s.size)?;
+            self.writer.write_all(&s.checksum)?;
+        }
+        self.writer.write_u64_le(index_offset)?;
+        self.writer.write_all(MAGIC)?;
+        self.writer.flush()?;
+        Ok(self.writer)
+    }
+}
+
+pub struct WarpFile {
+    data: Mmap,
+    pub index: Vec<SegmentIndex>,
+}
+
+impl WarpFile {
+    /// Returns None if the file does not have the indexed format
+    pub fn open(file: &File) -> Result<Option<Self>> {
+        let data = unsafe { Mmap::map(file)? };
+        let len = data.len();
+        if len < 2 * MAGIC.len() + 12
+            || &data[0..8] != MAGIC
+            || &data[len - 8..] != MAGIC
+        {
+            return Ok(None);
+        }
+        let index_offset = u64::from_le_bytes(data[len - 16..len - 8].try_into().unwrap()) as usize;
+        let mut index_data = data
+            .get(index_offset..len - 16)
+            .ok_or(anyhow!("Invalid warp file index offset"))?;
+        let count = index_data.read_u32_le()? as usize;
+        if Some(index_data.len()) != count.checked_mul(INDEX_ENTRY_SIZE) {
+            anyhow::bail!("Invalid warp file index size");
+        }
+        let mut index = Vec::with_capacity(count);
+        for _ in 0..count {
+            let start = index_data.read_u32_le()?;
+            let end = index_data.read_u32_le()?;
+            let offset = index_data.read_u64_le()?;
+            let size = index_data.read_u64_le()?;
+            let mut checksum = [0u8; 32];
+            index_data.read_exact(&mut checksum)?;
+            match offset.checked_add(size) {
+                Some(e) if e <= index_offset as u64 => {}
+                _ => anyhow::bail!("Warp file segment out of bounds"),
+            }
+            index.push(SegmentIndex {
+                start,
+                end,
+                offset,
+                size,
+                checksum,
+            });
+        }
+        Ok(Some(Self { data, index }))
+    }
+
+    /// Segments that have blocks in (start, end]
+    pub fn segments(&self, start: u32, end: u32) -> Vec<&SegmentIndex> {
+        self.index
+            .iter()
+            .filter(|s| s.end > start && s.start <= end)
+            .collect()
+    }
+
+    /// Verify and decode a segment, keeping the blocks in (start, end]
+    pub fn decode_segment(
+        &self,
+        segment: &SegmentIndex,
+        start: u32,
+        end: u32,
+    ) -> Result<Vec<CompactBlock>> {
+        let data = segment
+            .offset
+            .checked_add(segment.size)
+            .and_then(|e| self.data.get(segment.offset as usize..e as usize))
+            .ok_or(anyhow!("Warp file segment out of bounds"))?;
+        if segment_checksum(data) != segment.checksum {
+            anyhow::bail!("Checksum mismatch in warp file segment @{}", segment.start);
+        }
+        let mut blocks = vec![];
+        let mut data = data;
+        while !data.is_empty() {
+            let size = data.read_u32_le()? as usize;
+            if size > data.len() {
+                anyhow::bail!("Truncated block in warp file segment @{}", segment.start);
+            }
+            let (buf, rem) = data.split_at(size);
+            data = rem;
+            let block = CompactBlock::decode(buf)?;
+            let height = block.height as u32;
+            if height > start && height <= end {
+                blocks.push(block);
+            }
+        }
+        Ok(blocks)
+    }
+
+    /// Decode the blocks in (start, end] and pass them in order to `f`
+    ///
+    /// The next segment is decoded on rayon while the blocks of the
+    /// current one are passed, so at most two segments are in memory.
+    /// `f` runs on the calling thread and may block without holding
+    /// a rayon worker
+    pub fn for_each_block<F: FnMut(CompactBlock) -> Result<()>>(
+        &self,
+        start: u32,
+        end: u32,
+        mut f: F,
+    ) -> Result<()> {
+        let segments = self.segments(start, end);
+        let mut next = segments
+            .first()
+            .map(|s| self.decode_segment(s, start, end));
+        for i in 0..segments.len() {
+            let blocks = next.take().unwrap()?;
+            let mut decoded = None;
+            rayon::in_place_scope(|scope| {
+                if let Some(s) = segments.get(i + 1) {
+                    scope.spawn(|_| decoded = Some(self.decode_segment(s, start, end)));
+                }
+                for block in blocks {
+                    f(block)?;
+                }
+                Ok::<_, anyhow::Error>(())
+            })?;
+            next = decoded;
+        }
+        Ok(())
+    }
+}
+
+/// Read the legacy flat stream of (len, CompactBlock)
+pub fn for_each_legacy_block<F: FnMut(CompactBlock) -> Result<()>>(
+    file: File,
+    start: u32,
+    end: u32,
+    mut f: F,
+) -> Result<()> {
+    let mut reader = BufReader::new(file);
+    while let Ok(size) = reader.read_u32_le() {
+        let mut buf = vec![0u8; size as usize];
+        reader.read_exact(&mut buf)?;
+        let block = CompactBlock::decode(&*buf)?;
+        let height = block.height as u32;
+        if height > end {
+            break;
+        }
+        if height > start {
+            f(block)?;
+        }
+    }
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn write_file(name: &str, blocks: u32) -> std::path::PathBuf {
+        let path = std::env::temp_dir().join(format!("{name}-{}.bin", std::process::id()));
+        let mut w = WarpFileWriter::new(File::create(&path).unwrap()).unwrap();
+        for height in 1..=blocks {
+            let block = CompactBlock {
+                height: height as u64,
+                hash: height.to_le_bytes().to_vec(),
+                ..CompactBlock::default()
+            };
+            w.write_block(&block).unwrap();
+        }
+        w.finish().unwrap();
+        path
+    }
+
+    fn heights(file: &WarpFile, start: u32, end: u32) -> Result<Vec<u32>> {
+        let mut heights = vec![];
+        file.for_each_block(start, end, |b| {
+            heights.push(b.height as u32);
+            Ok(())
+        })?;
+        Ok(heights)
+    }
+
+    #[test]
+    fn warp_file_roundtrip() {
+        let path = write_file("warp-file-roundtrip", 2500);
+        let file = WarpFile::open(&File::open(&path).unwrap()).unwrap().unwrap();
+        assert_eq!(file.index.len(), 3);
+        assert_eq!(heights(&file, 0, 2500).unwrap(), (1..=2500).collect::<Vec<_>>());
+        assert_eq!(
+            heights(&file, 999, 2001).unwrap(),
+            (1000..=2001).collect::<Vec<_>>()
+        );
+        std::fs::remove_file(path).unwrap();
+    }
+
+    #[test]
+    fn warp_file_checksum() {
+        let path = write_file("warp-file-checksum", 1500);
+        let mut data = std::fs::read(&path).unwrap();
+        // flip a byte of the second segment
+        let second = {
+            let file = WarpFile::open(&File::open(&path).unwrap()).unwrap().unwrap();
+            file.index[1].offset as usize
+        };
+        data[second + 8] ^= 1;
+        std::fs::write(&path, &data).unwrap();
+        let file = WarpFile::open(&File::open(&path).unwrap()).unwrap().unwrap();
+        assert!(heights(&file, 0, 1500).is_err());
+        assert_eq!(heights(&file, 0, 1000).unwrap().len(), 1000);
+        std::fs::remove_file(path).unwrap();
+    }
+
+    #[test]
+    fn warp_file_legacy() {
+        let path = std::env::temp_dir().join(format!("warp-file-legacy-{}.bin", std::process::id()));
+        std::fs::write(&path, [0u8; 64]).unwrap();
+        assert!(WarpFile::open(&File::open(&path).unwrap()).unwrap().is_none());
+        std::fs::remove_file(path).unwrap();
+    }
+}